@@ -0,0 +1,3 @@
+#!/bin/env bash
+
+meson test -C build --benchmark
@@ -0,0 +1,203 @@
+/**
+ * @file bench.cpp
+ *
+ * End-to-end benchmark driver: loads a knowledge base, computes its fixpoint
+ * and prints one JSON object with the measurements on stdout.
+ */
+
+#include "datalog.hh"
+#include "evaluator.hh"
+#include "loader.hh"
+#include "relation.hh"
+#include "snapshot.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
+
+// Times each reader thread runs the queries, see --readers
+static const size_t READER_ROUNDS = 200;
+
+void
+usage(char **argv) {
+  std::cout << "Usage: " << argv[0]
+            << " [--name NAME] [--jobs N] [--compress] [--batch] [--budget MB]"
+            << " [--readers N] <KB> [QUERIES]\n"
+            << "  --readers  run QUERIES on versions of the fixpoint from N"
+            << " threads, while a writer inserts facts\n";
+}
+
+double
+elapsed_ms(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double, std::milli> ms
+    = std::chrono::steady_clock::now() - start;
+  return ms.count();
+}
+
+long
+peak_rss_kb(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+int
+main(int argc, char **argv) {
+  std::vector<std::string> args(argv + 1, argv + argc);
+  std::string name;
+  size_t jobs = 1;
+  bool compress = false;
+  bool batched = false;
+  size_t budget_mb = 0;
+  size_t nreaders = 0;
+  while (!args.empty()) {
+    if (args[0] == "--compress") {
+      compress = true;
+      args.erase(args.begin());
+    }
+    else if (args.size() >= 2 && args[0] == "--name") {
+      name = args[1];
+      args.erase(args.begin(), args.begin() + 2);
+    }
+    else if (args[0] == "--batch") {
+      batched = true;
+      args.erase(args.begin());
+    }
+    else if (args.size() >= 2 && args[0] == "--budget") {
+      budget_mb = std::strtoul(args[1].c_str(), nullptr, 10);
+      args.erase(args.begin(), args.begin() + 2);
+    }
+    else if (args.size() >= 2 && args[0] == "--readers") {
+      nreaders = std::strtoul(args[1].c_str(), nullptr, 10);
+      args.erase(args.begin(), args.begin() + 2);
+    }
+    else if (args.size() >= 2 && args[0] == "--jobs") {
+      jobs = std::strtoul(args[1].c_str(), nullptr, 10);
+      args.erase(args.begin(), args.begin() + 2);
+    }
+    else {
+      break;
+    }
+  }
+  if (args.empty()) {
+    usage(argv);
+    return 1;
+  }
+  if (name.empty()) {
+    name = args[0].substr(args[0].find_last_of('/') + 1);
+  }
+
+  // The lexer and the parser report on stdout, which carries the results
+  std::ostringstream discarded;
+  std::streambuf *out = std::cout.rdbuf(discarded.rdbuf());
+
+  auto start = std::chrono::steady_clock::now();
+  Loader loader(jobs);
+  Program prog;
+  Database db;
+  size_t nfacts = loader.load(args[0], prog, db);
+  if (compress) {
+    for (auto &entry : db.get_relations()) {
+      entry.second->compress();
+    }
+  }
+  if (budget_mb > 0) {
+    db.set_memory_budget(budget_mb << 20,
+                         std::filesystem::temp_directory_path().string());
+    db.enforce_memory_budget();
+  }
+  double load_ms = elapsed_ms(start);
+  size_t edb_bytes = 0;
+  for (auto &entry : db.get_relations()) {
+    edb_bytes += entry.second->memory_usage();
+  }
+
+  start = std::chrono::steady_clock::now();
+  Evaluator evaluator(db, prog);
+  evaluator.set_batched(batched);
+  ThreadPool pool(jobs);
+  size_t nderived = evaluator.run(pool);
+  double eval_ms = elapsed_ms(start);
+
+  size_t nanswers = 0;
+  double query_ms = 0;
+  std::vector<Atom> queries;
+  if (args.size() > 1) {
+    Lexer lexer(args[1]);
+    std::vector<Token> query_tokens = lexer.run();
+    Parser parser(query_tokens);
+    Program query = parser.parse();
+    start = std::chrono::steady_clock::now();
+    for (Rule rule : query.get_rules()) {
+      queries.push_back(rule.get_head());
+      nanswers += evaluator.query(queries.back()).size();
+    }
+    query_ms = elapsed_ms(start);
+  }
+  size_t ntuples = db.size();
+
+  // Readers of the current version while a writer publishes new ones
+  size_t nreader_queries = 0;
+  size_t ninserts = 0;
+  double readers_ms = 0;
+  if (nreaders > 0 && !queries.empty()) {
+    VersionedDatabase versions(std::move(db), prog);
+    std::atomic<bool> reading(true);
+    std::thread writer([&]() {
+      std::string tick("bench_tick");
+      while (reading) {
+        std::string name = "t" + std::to_string(ninserts);
+        std::vector<Term> terms{Term(name, TermType::CONSTANT)};
+        std::vector<Atom> facts{Atom(tick, terms)};
+        versions.insert(facts);
+        ++ninserts;
+      }
+    });
+    start = std::chrono::steady_clock::now();
+    std::vector<std::thread> readers;
+    for (size_t t = 0; t < nreaders; ++t) {
+      readers.emplace_back([&versions, &queries]() {
+        std::vector<Atom> own(queries);
+        for (size_t round = 0; round < READER_ROUNDS; ++round) {
+          for (Atom &atom : own) {
+            versions.query(atom);
+          }
+        }
+      });
+    }
+    for (std::thread &reader : readers) {
+      reader.join();
+    }
+    readers_ms = elapsed_ms(start);
+    reading = false;
+    writer.join();
+    nreader_queries = nreaders * READER_ROUNDS * queries.size();
+  }
+  std::cout.rdbuf(out);
+
+  double tuples_per_sec = eval_ms > 0 ? nderived / (eval_ms / 1000.0) : 0;
+  std::cout << "{\"workload\": \"" << name << "\", \"jobs\": " << jobs
+            << ", \"compress\": " << (compress ? "true" : "false")
+            << ", \"batch\": " << (batched ? "true" : "false")
+            << ", \"budget_mb\": " << budget_mb
+            << ", \"facts\": " << nfacts << ", \"derived\": " << nderived
+            << ", \"tuples\": " << ntuples << ", \"answers\": " << nanswers
+            << ", \"edb_kb\": " << edb_bytes / 1024
+            << ", \"load_ms\": " << load_ms << ", \"eval_ms\": " << eval_ms
+            << ", \"query_ms\": " << query_ms
+            << ", \"tuples_per_sec\": " << static_cast<size_t>(tuples_per_sec)
+            << ", \"readers\": " << nreaders
+            << ", \"reader_queries_per_sec\": "
+            << static_cast<size_t>(
+                 readers_ms > 0 ? nreader_queries / (readers_ms / 1000.0) : 0)
+            << ", \"inserts\": " << ninserts
+            << ", \"peak_rss_kb\": " << peak_rss_kb() << "}\n";
+  return 0;
+}
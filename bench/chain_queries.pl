@@ -0,0 +1,2 @@
+path(n1, X).
+path(X, n1).
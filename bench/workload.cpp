@@ -0,0 +1,203 @@
+/**
+ * @file workload.cpp
+ *
+ * Generators of synthetic knowledge bases for the benchmarks.
+ * Each workload is a set of facts plus the rules of a standard datalog
+ * program, scaled by a size parameter.
+ */
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+
+void
+usage(char **argv) {
+  std::cout << "Usage: " << argv[0] << " <WORKLOAD> <SIZE> [OUTPUT] [SEED]\n"
+            << "Workloads: chain, grid, random, samegen, pointsto, join,"
+            << " views\n";
+}
+
+std::string
+node(size_t i) {
+  return "n" + std::to_string(i);
+}
+
+void
+transitive_closure(std::ostream &out) {
+  out << "path(X, Y) :- edge(X, Y).\n"
+      << "path(X, Y) :- edge(X, Z), path(Z, Y).\n";
+}
+
+/**
+ * @brief A path of size nodes: the closure has size^2 / 2 tuples
+ */
+void
+gen_chain(std::ostream &out, size_t size, std::mt19937 &) {
+  for (size_t i = 0; i + 1 < size; ++i) {
+    out << "edge(" << node(i) << ", " << node(i + 1) << ").\n";
+  }
+  transitive_closure(out);
+}
+
+/**
+ * @brief A size x size grid with edges to the right and downwards
+ */
+void
+gen_grid(std::ostream &out, size_t size, std::mt19937 &) {
+  for (size_t r = 0; r < size; ++r) {
+    for (size_t c = 0; c < size; ++c) {
+      size_t n = r * size + c;
+      if (c + 1 < size) {
+        out << "edge(" << node(n) << ", " << node(n + 1) << ").\n";
+      }
+      if (r + 1 < size) {
+        out << "edge(" << node(n) << ", " << node(n + size) << ").\n";
+      }
+    }
+  }
+  transitive_closure(out);
+}
+
+/**
+ * @brief A random graph of size nodes with an average out-degree of 2
+ */
+void
+gen_random(std::ostream &out, size_t size, std::mt19937 &rng) {
+  std::uniform_int_distribution<size_t> pick(0, size - 1);
+  for (size_t i = 0; i < 2 * size; ++i) {
+    out << "edge(" << node(pick(rng)) << ", " << node(pick(rng)) << ").\n";
+  }
+  transitive_closure(out);
+}
+
+/**
+ * @brief Same generation over a random tree of size nodes
+ */
+void
+gen_samegen(std::ostream &out, size_t size, std::mt19937 &rng) {
+  for (size_t i = 1; i < size; ++i) {
+    std::uniform_int_distribution<size_t> parent(i > 4 ? i - 4 : 0, i - 1);
+    out << "parent(" << node(i) << ", " << node(parent(rng)) << ").\n";
+  }
+  out << "sg(X, Y) :- parent(X, P), parent(Y, P).\n"
+      << "sg(X, Y) :- parent(X, A), sg(A, B), parent(Y, B).\n";
+}
+
+/**
+ * @brief Andersen-style points-to analysis over size variables
+ */
+void
+gen_pointsto(std::ostream &out, size_t size, std::mt19937 &rng) {
+  std::uniform_int_distribution<size_t> var(0, size - 1);
+  std::uniform_int_distribution<size_t> obj(0, size / 4);
+  std::uniform_int_distribution<size_t> field(0, 3);
+  for (size_t i = 0; i < size / 2; ++i) {
+    out << "new(v" << var(rng) << ", o" << obj(rng) << ").\n";
+  }
+  for (size_t i = 0; i < size; ++i) {
+    out << "assign(v" << var(rng) << ", v" << var(rng) << ").\n";
+  }
+  for (size_t i = 0; i < size / 4; ++i) {
+    out << "load(v" << var(rng) << ", v" << var(rng) << ", f" << field(rng)
+        << ").\n";
+    out << "store(v" << var(rng) << ", f" << field(rng) << ", v" << var(rng)
+        << ").\n";
+  }
+  out << "pt(V, O) :- new(V, O).\n"
+      << "pt(V, O) :- assign(V, W), pt(W, O).\n"
+      << "hpt(O, F, P) :- store(V, F, W), pt(V, O), pt(W, P).\n"
+      << "pt(V, P) :- load(V, W, F), pt(W, O), hpt(O, F, P).\n";
+}
+
+/**
+ * @brief The loves/likes/alive join of tests/kb0.pl over size people
+ */
+void
+gen_join(std::ostream &out, size_t size, std::mt19937 &rng) {
+  std::uniform_int_distribution<size_t> person(0, size - 1);
+  std::bernoulli_distribution is_alive(0.8);
+  for (size_t i = 0; i < 8 * size; ++i) {
+    out << "likes(" << node(person(rng)) << ", " << node(person(rng))
+        << ").\n";
+  }
+  for (size_t i = 0; i < size; ++i) {
+    if (is_alive(rng)) {
+      out << "alive(" << node(i) << ").\n";
+    }
+  }
+  out << "loves(X, Y) :- likes(X, Y), alive(X), alive(Y).\n";
+}
+
+/**
+ * @brief 16 unrelated views, each the transitive closure of its own random
+ * graph of size nodes, then the pairs connected in every view
+ */
+void
+gen_views(std::ostream &out, size_t size, std::mt19937 &rng) {
+  std::uniform_int_distribution<size_t> pick(0, size - 1);
+  const size_t NVIEWS = 16;
+  for (size_t v = 0; v < NVIEWS; ++v) {
+    std::string edge = "edge" + std::to_string(v);
+    std::string path = "path" + std::to_string(v);
+    for (size_t i = 0; i < 2 * size; ++i) {
+      out << edge << "(" << node(pick(rng)) << ", " << node(pick(rng))
+          << ").\n";
+    }
+    out << path << "(X, Y) :- " << edge << "(X, Y).\n"
+        << path << "(X, Y) :- " << edge << "(X, Z), " << path << "(Z, Y).\n";
+  }
+  out << "everywhere(X, Y) :- ";
+  for (size_t v = 0; v < NVIEWS; ++v) {
+    out << (v > 0 ? ", " : "") << "path" << v << "(X, Y)";
+  }
+  out << ".\n";
+}
+
+int
+main(int argc, char **argv) {
+  if (argc < 3) {
+    usage(argv);
+    return 1;
+  }
+  std::string workload(argv[1]);
+  size_t size = std::strtoul(argv[2], nullptr, 10);
+  std::mt19937 rng(argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 42);
+  std::ofstream ofs;
+  if (argc > 3) {
+    ofs.open(argv[3]);
+  }
+  std::ostream &out = argc > 3 ? ofs : std::cout;
+  if (size < 2) {
+    std::cerr << "The size must be at least 2\n";
+    return 1;
+  }
+
+  if (workload == "chain") {
+    gen_chain(out, size, rng);
+  }
+  else if (workload == "grid") {
+    gen_grid(out, size, rng);
+  }
+  else if (workload == "random") {
+    gen_random(out, size, rng);
+  }
+  else if (workload == "samegen") {
+    gen_samegen(out, size, rng);
+  }
+  else if (workload == "pointsto") {
+    gen_pointsto(out, size, rng);
+  }
+  else if (workload == "join") {
+    gen_join(out, size, rng);
+  }
+  else if (workload == "views") {
+    gen_views(out, size, rng);
+  }
+  else {
+    usage(argv);
+    return 1;
+  }
+  return out.good() ? 0 : 1;
+}
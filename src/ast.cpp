@@ -7,10 +7,14 @@
 /*
  * <program> ::= <fact> <program> | <rule> <program> | ɛ
  * <fact> ::=  <relation> "(" <constant-list> "). | halt."
- * <rule> ::= <atom> ":-" <atom-list> "."
+ * <rule> ::= <atom> ":-" <goal-list> "."
  * <atom> ::= <relation> "(" <term-list> ")"
- * <atom-list> ::= <atom> | <atom> "," <atom-list>
- * <term> ::= <constant> | <variable>
+ * <goal> ::= <atom> | <term> <comparison> <term>
+ *          | <term> "=" <term> <arithmetic> <term>
+ * <goal-list> ::= <goal> | <goal> "," <goal-list>
+ * <comparison> ::= "<" | "<=" | ">" | ">=" | "=" | "!="
+ * <arithmetic> ::= "+" | "-" | "*" | "/" | "%"
+ * <term> ::= <constant> | <variable> | <number>
  * <term-list> ::= <term> | <term> "," <term-list>
  * <constant-list> ::= <constant> | <constant> "," <constant-list>
  */
@@ -22,6 +26,9 @@ AstPrinter::visit(Term &term) {
   if (term.get_term_type() == TermType::VARIABLE) {
     term_type = "var";
   }
+  else if (term.get_term_type() == TermType::NUMBER) {
+    term_type = "num";
+  }
   return term.get_name() + ":" + term_type;
 }
 
@@ -34,7 +41,10 @@ AstPrinter::visit(EvaluatedTerm &eterm) {
   }
   else {
     return eterm.get_name() + ":"
-           + (eterm.get_term_type() == TermType::CONSTANT ? "const" : "var");
+           + (eterm.get_term_type() == TermType::VARIABLE
+                ? "var"
+                : (eterm.get_term_type() == TermType::NUMBER ? "num"
+                                                             : "const"));
   }
 }
 
@@ -43,6 +53,14 @@ std::string
 AstPrinter::visit(Atom &atom) {
   std::string s = atom.get_predicate();
   std::vector<Term> terms = atom.get_terms();
+  // Built-in predicates are infix, arithmetic ones assign their first term
+  if (atom.is_builtin() && terms.size() == 2) {
+    return terms[0].accept(*this) + " " + s + " " + terms[1].accept(*this);
+  }
+  if (atom.is_builtin() && terms.size() == 3) {
+    return terms[0].accept(*this) + " = " + terms[1].accept(*this) + " " + s
+           + " " + terms[2].accept(*this);
+  }
   if (terms.empty()) {
     return s;
   }
@@ -83,7 +101,7 @@ AstPrinter::visit(Rule &rule) {
   }
   s += ":-\n";
   size_t i = 0;
-  for (; i < goals.size(); ++i) {
+  for (; i + 1 < goals.size(); ++i) {
     s += "\t" + goals[i].accept(*this) + ",\n";
   }
   return s + "\t" + goals[goals.size() - 1].accept(*this) + ".\n";
@@ -93,6 +111,9 @@ template <>
 std::string
 AstPrinter::visit(Program &program) {
   std::string s;
+  for (Atom directive : program.get_directives()) {
+    s += ":- " + directive.accept(*this) + ".\n";
+  }
   std::vector<Rule> facts_rules = program.get_rules();
   for (size_t i = 0; i < facts_rules.size(); ++i) {
     s += facts_rules[i].accept(*this);
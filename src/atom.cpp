@@ -26,3 +26,19 @@ std::vector<Term>
 Atom::get_terms(void) {
   return terms;
 }
+
+/**
+ * @brief Whether the atom is a comparison, with two terms, or an arithmetic
+ * operation, whose first term is the result of the other two
+ */
+bool
+Atom::is_builtin(void) {
+  static const char *const BUILTINS[] = {"<", "<=", ">", ">=", "=", "!=",
+                                         "+", "-", "*", "/", "%"};
+  for (const char *builtin : BUILTINS) {
+    if (predicate == builtin) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,196 @@
+/**
+ * @file bitmap.cpp
+ *
+ * Compressed bitmaps over symbols, used for unary relations
+ */
+
+#include "bitmap.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+// Words of a bitmap container: 65536 bits
+static const size_t CONTAINER_WORDS = 1024;
+
+bool
+RoaringBitmap::Container::contains(uint16_t low) const {
+  if (!bits.empty()) {
+    return (bits[low >> 6] >> (low & 63)) & 1;
+  }
+  return std::binary_search(array.begin(), array.end(), low);
+}
+
+RoaringBitmap::
+RoaringBitmap(void)
+  : keys(), containers(), count(0) {
+}
+
+const RoaringBitmap::Container *
+RoaringBitmap::find_container(uint16_t key) const {
+  auto it = std::lower_bound(keys.begin(), keys.end(), key);
+  if (it == keys.end() || *it != key) {
+    return nullptr;
+  }
+  return &containers[it - keys.begin()];
+}
+
+/**
+ * @returns Whether value was not yet a member
+ */
+bool
+RoaringBitmap::add(SymbolId value) {
+  uint16_t key = static_cast<uint16_t>(value >> 16);
+  uint16_t low = static_cast<uint16_t>(value & 0xffff);
+  auto it = std::lower_bound(keys.begin(), keys.end(), key);
+  size_t idx = it - keys.begin();
+  if (it == keys.end() || *it != key) {
+    keys.insert(it, key);
+    containers.insert(containers.begin() + idx, Container{{}, {}, 0});
+  }
+  Container &c = containers[idx];
+  if (!c.bits.empty()) {
+    uint64_t &word = c.bits[low >> 6];
+    uint64_t bit = 1ULL << (low & 63);
+    if (word & bit) {
+      return false;
+    }
+    word |= bit;
+  }
+  else {
+    auto pos = std::lower_bound(c.array.begin(), c.array.end(), low);
+    if (pos != c.array.end() && *pos == low) {
+      return false;
+    }
+    c.array.insert(pos, low);
+    if (c.array.size() > ARRAY_LIMIT) {
+      c.bits.assign(CONTAINER_WORDS, 0);
+      for (uint16_t v : c.array) {
+        c.bits[v >> 6] |= 1ULL << (v & 63);
+      }
+      std::vector<uint16_t>().swap(c.array);
+    }
+  }
+  ++c.count;
+  ++count;
+  return true;
+}
+
+bool
+RoaringBitmap::contains(SymbolId value) const {
+  const Container *c = find_container(static_cast<uint16_t>(value >> 16));
+  return c != nullptr && c->contains(static_cast<uint16_t>(value & 0xffff));
+}
+
+size_t
+RoaringBitmap::size(void) const {
+  return count;
+}
+
+size_t
+RoaringBitmap::get_containers(void) const {
+  return containers.size();
+}
+
+/**
+ * @brief Members of both bitmaps. Two bitmap containers are intersected a
+ * word at a time, arrays by merging or by testing against a bitmap.
+ */
+RoaringBitmap
+RoaringBitmap::intersect(const RoaringBitmap &other) const {
+  RoaringBitmap result;
+  size_t i = 0;
+  size_t j = 0;
+  while (i < keys.size() && j < other.keys.size()) {
+    if (keys[i] < other.keys[j]) {
+      ++i;
+      continue;
+    }
+    if (other.keys[j] < keys[i]) {
+      ++j;
+      continue;
+    }
+    const Container &c1 = containers[i];
+    const Container &c2 = other.containers[j];
+    Container c{{}, {}, 0};
+    if (!c1.bits.empty() && !c2.bits.empty()) {
+      c.bits.resize(CONTAINER_WORDS);
+      uint32_t n = 0;
+      for (size_t w = 0; w < CONTAINER_WORDS; ++w) {
+        c.bits[w] = c1.bits[w] & c2.bits[w];
+        n += __builtin_popcountll(c.bits[w]);
+      }
+      c.count = n;
+      if (n <= ARRAY_LIMIT) {
+        c.array.reserve(n);
+        for (size_t w = 0; w < CONTAINER_WORDS; ++w) {
+          for (uint64_t word = c.bits[w]; word != 0; word &= word - 1) {
+            c.array.push_back(
+              static_cast<uint16_t>(w * 64 + __builtin_ctzll(word)));
+          }
+        }
+        std::vector<uint64_t>().swap(c.bits);
+      }
+    }
+    else if (c1.bits.empty() && c2.bits.empty()) {
+      std::set_intersection(c1.array.begin(), c1.array.end(),
+                            c2.array.begin(), c2.array.end(),
+                            std::back_inserter(c.array));
+      c.count = static_cast<uint32_t>(c.array.size());
+    }
+    else {
+      const Container &sparse = c1.bits.empty() ? c1 : c2;
+      const Container &dense = c1.bits.empty() ? c2 : c1;
+      for (uint16_t v : sparse.array) {
+        if (dense.contains(v)) {
+          c.array.push_back(v);
+        }
+      }
+      c.count = static_cast<uint32_t>(c.array.size());
+    }
+    if (c.count > 0) {
+      result.keys.push_back(keys[i]);
+      result.count += c.count;
+      result.containers.push_back(std::move(c));
+    }
+    ++i;
+    ++j;
+  }
+  return result;
+}
+
+/**
+ * @brief Append the members to out, in increasing order
+ */
+void
+RoaringBitmap::to_vector(std::vector<SymbolId> &out) const {
+  out.reserve(out.size() + count);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    SymbolId high = static_cast<SymbolId>(keys[i]) << 16;
+    const Container &c = containers[i];
+    if (c.bits.empty()) {
+      for (uint16_t v : c.array) {
+        out.push_back(high | v);
+      }
+      continue;
+    }
+    for (size_t w = 0; w < CONTAINER_WORDS; ++w) {
+      for (uint64_t word = c.bits[w]; word != 0; word &= word - 1) {
+        out.push_back(high
+                      | static_cast<SymbolId>(w * 64 + __builtin_ctzll(word)));
+      }
+    }
+  }
+}
+
+size_t
+RoaringBitmap::memory_usage(void) const {
+  size_t bytes = keys.capacity() * sizeof(uint16_t)
+                 + containers.capacity() * sizeof(Container);
+  for (const Container &c : containers) {
+    bytes += c.array.capacity() * sizeof(uint16_t)
+             + c.bits.capacity() * sizeof(uint64_t);
+  }
+  return bytes;
+}
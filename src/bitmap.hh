@@ -0,0 +1,47 @@
+#ifndef BITMAP_HH_INCLUDED
+#define BITMAP_HH_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+typedef uint32_t SymbolId;
+
+/**
+ * @brief Compressed set of symbols, in the layout of roaring bitmaps.
+ * Symbols are grouped by their high 16 bits; each group holds its low 16
+ * bits as a sorted array while it is sparse, and as a 65536-bit bitmap once
+ * it has more than ARRAY_LIMIT members.
+ */
+class RoaringBitmap {
+public:
+  static const size_t ARRAY_LIMIT = 4096;
+
+private:
+  struct Container {
+    // Sorted low bits, while bits is empty
+    std::vector<uint16_t> array;
+    std::vector<uint64_t> bits;
+    uint32_t count;
+
+    bool contains(uint16_t low) const;
+  };
+  // Containers sorted by the high 16 bits of their members
+  std::vector<uint16_t> keys;
+  std::vector<Container> containers;
+  size_t count;
+
+  const Container *find_container(uint16_t key) const;
+
+public:
+  RoaringBitmap(void);
+  bool add(SymbolId value);
+  bool contains(SymbolId value) const;
+  size_t size(void) const;
+  size_t get_containers(void) const;
+  RoaringBitmap intersect(const RoaringBitmap &other) const;
+  void to_vector(std::vector<SymbolId> &out) const;
+  size_t memory_usage(void) const;
+};
+
+#endif
@@ -0,0 +1,369 @@
+/**
+ * @file btree.cpp
+ *
+ * Sorted B+-tree index over fixed width tuples of symbols
+ */
+
+#include "btree.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// Target size of the keys of a node: a few cache lines
+static const size_t NODE_BYTES = 512;
+
+BTreeNode::
+BTreeNode(bool is_leaf, size_t capacity, size_t width)
+  : is_leaf(is_leaf), nkeys(0),
+    // One spare key, to hold the overflow before a split
+    keys(new SymbolId[(capacity + 1) * std::max<size_t>(width, 1)]),
+    children(), next(nullptr) {
+  if (!is_leaf) {
+    children.reserve(capacity + 2);
+  }
+}
+
+BTreeIndex::
+BTreeIndex(size_t width)
+  : width(width),
+    capacity(std::max<size_t>(
+      4, NODE_BYTES / (sizeof(SymbolId) * std::max<size_t>(width, 1)))),
+    nkeys(0), nnodes(1), root(new BTreeNode(true, capacity, width)),
+    hint(nullptr) {
+}
+
+size_t
+BTreeIndex::get_width(void) const {
+  return width;
+}
+
+size_t
+BTreeIndex::size(void) const {
+  return nkeys;
+}
+
+/**
+ * @brief Approximate heap usage of the nodes, in bytes
+ */
+size_t
+BTreeIndex::memory_usage(void) const {
+  return nnodes
+         * (sizeof(BTreeNode)
+            + (capacity + 1) * std::max<size_t>(width, 1) * sizeof(SymbolId));
+}
+
+/**
+ * @brief Compare the first len symbols of k1 and k2, lexicographically
+ */
+int
+BTreeIndex::compare(const SymbolId *k1, const SymbolId *k2, size_t len) const {
+  for (size_t i = 0; i < len; ++i) {
+    if (k1[i] != k2[i]) {
+      return k1[i] < k2[i] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+const SymbolId *
+BTreeIndex::key_at(const BTreeNode *node, size_t idx) const {
+  return node->keys.get() + idx * width;
+}
+
+/**
+ * @brief Binary search among the keys of a node
+ * @returns The first key whose first len symbols are not less than (or, if
+ * upper, greater than) those of key
+ */
+size_t
+BTreeIndex::node_position(const BTreeNode *node, const SymbolId *key,
+                          size_t len, bool upper) const {
+  size_t lo = 0;
+  size_t hi = node->nkeys;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    int cmp = compare(key_at(node, mid), key, len);
+    if (cmp < 0 || (upper && cmp == 0)) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+void
+BTreeIndex::insert_key(BTreeNode *node, size_t pos, const SymbolId *key) {
+  SymbolId *at = node->keys.get() + pos * width;
+  std::memmove(at + width, at, (node->nkeys - pos) * width * sizeof(SymbolId));
+  std::memcpy(at, key, width * sizeof(SymbolId));
+  ++node->nkeys;
+}
+
+/**
+ * @brief Move the keys of node from index at onwards to a new right sibling
+ * @param separator Set to the smallest key under the new sibling
+ */
+std::unique_ptr<BTreeNode>
+BTreeIndex::split(BTreeNode *node, size_t at,
+                  std::vector<SymbolId> &separator) {
+  std::unique_ptr<BTreeNode> right(
+    new BTreeNode(node->is_leaf, capacity, width));
+  ++nnodes;
+  if (node->is_leaf) {
+    separator.assign(key_at(node, at), key_at(node, at) + width);
+    right->nkeys = node->nkeys - at;
+    std::memcpy(right->keys.get(), key_at(node, at),
+                right->nkeys * width * sizeof(SymbolId));
+    right->next = node->next;
+    node->next = right.get();
+  }
+  else {
+    // The separator at moves up, it is not kept in either node
+    separator.assign(key_at(node, at), key_at(node, at) + width);
+    right->nkeys = node->nkeys - at - 1;
+    std::memcpy(right->keys.get(), key_at(node, at + 1),
+                right->nkeys * width * sizeof(SymbolId));
+    for (size_t i = at + 1; i < node->children.size(); ++i) {
+      right->children.push_back(std::move(node->children[i]));
+    }
+    node->children.resize(at + 1);
+  }
+  node->nkeys = at;
+  return right;
+}
+
+/**
+ * @brief Insert key under node
+ * @returns The new right sibling of node if it was split, nullptr otherwise
+ */
+std::unique_ptr<BTreeNode>
+BTreeIndex::insert_into(BTreeNode *node, const SymbolId *key,
+                        std::vector<SymbolId> &separator, bool &inserted) {
+  if (node->is_leaf) {
+    size_t pos = node_position(node, key, width, false);
+    if (pos < node->nkeys && compare(key_at(node, pos), key, width) == 0) {
+      return nullptr;
+    }
+    insert_key(node, pos, key);
+    inserted = true;
+    hint = node;
+    if (node->nkeys <= capacity) {
+      return nullptr;
+    }
+    // Appending past the last leaf leaves it full, as sequential inserts
+    // would otherwise leave every leaf half empty
+    size_t at = node->nkeys / 2;
+    if (pos == node->nkeys - 1 && node->next == nullptr) {
+      at = node->nkeys - 1;
+    }
+    std::unique_ptr<BTreeNode> right = split(node, at, separator);
+    if (pos >= at) {
+      hint = right.get();
+    }
+    return right;
+  }
+  size_t child = node_position(node, key, width, true);
+  std::vector<SymbolId> child_separator;
+  std::unique_ptr<BTreeNode> right = insert_into(
+    node->children[child].get(), key, child_separator, inserted);
+  if (!right) {
+    return nullptr;
+  }
+  insert_key(node, child, child_separator.data());
+  node->children.insert(node->children.begin() + child + 1, std::move(right));
+  if (node->nkeys <= capacity) {
+    return nullptr;
+  }
+  return split(node, node->nkeys / 2, separator);
+}
+
+/**
+ * @brief Insert key, if not already present
+ * @returns true iff the key was inserted
+ */
+bool
+BTreeIndex::insert(const SymbolId *key) {
+  std::vector<SymbolId> separator;
+  bool inserted = false;
+  std::unique_ptr<BTreeNode> right
+    = insert_into(root.get(), key, separator, inserted);
+  if (right) {
+    std::unique_ptr<BTreeNode> new_root(new BTreeNode(false, capacity, width));
+    ++nnodes;
+    std::memcpy(new_root->keys.get(), separator.data(),
+                width * sizeof(SymbolId));
+    new_root->nkeys = 1;
+    new_root->children.push_back(std::move(root));
+    new_root->children.push_back(std::move(right));
+    root = std::move(new_root);
+  }
+  nkeys += inserted ? 1 : 0;
+  return inserted;
+}
+
+/**
+ * @brief Insert key, trying the leaf of the previous insertion first.
+ * Runs of increasing keys, such as those produced by a fixpoint round over
+ * sorted inputs, are inserted without descending the tree.
+ */
+bool
+BTreeIndex::insert_hint(const SymbolId *key) {
+  if (hint != nullptr && hint->nkeys > 0 && hint->nkeys < capacity
+      && compare(key, key_at(hint, 0), width) > 0
+      && (hint->next == nullptr
+          || compare(key, key_at(hint->next, 0), width) < 0)) {
+    size_t pos = node_position(hint, key, width, false);
+    if (pos < hint->nkeys && compare(key_at(hint, pos), key, width) == 0) {
+      return false;
+    }
+    insert_key(hint, pos, key);
+    ++nkeys;
+    return true;
+  }
+  return insert(key);
+}
+
+/**
+ * @brief Replace the contents of the tree with sorted_keys, which must be
+ * sorted and free of duplicates. Leaves are filled completely.
+ */
+void
+BTreeIndex::bulk_load(const std::vector<SymbolId> &sorted_keys) {
+  size_t n = width == 0 ? 0 : sorted_keys.size() / width;
+  std::vector<std::unique_ptr<BTreeNode>> level;
+  std::vector<const SymbolId *> firsts;
+  BTreeNode *previous = nullptr;
+  nnodes = 0;
+  for (size_t i = 0; i < n; i += capacity) {
+    std::unique_ptr<BTreeNode> leaf(new BTreeNode(true, capacity, width));
+    leaf->nkeys = std::min(capacity, n - i);
+    std::memcpy(leaf->keys.get(), sorted_keys.data() + i * width,
+                leaf->nkeys * width * sizeof(SymbolId));
+    if (previous != nullptr) {
+      previous->next = leaf.get();
+    }
+    previous = leaf.get();
+    firsts.push_back(key_at(leaf.get(), 0));
+    level.push_back(std::move(leaf));
+    ++nnodes;
+  }
+  hint = previous;
+  // Group capacity + 1 children per inner node, evenly
+  while (level.size() > 1) {
+    size_t ngroups = (level.size() + capacity) / (capacity + 1);
+    std::vector<std::unique_ptr<BTreeNode>> parents;
+    std::vector<const SymbolId *> parent_firsts;
+    size_t child = 0;
+    for (size_t g = 0; g < ngroups; ++g) {
+      size_t group_size = level.size() / ngroups
+                          + (g < level.size() % ngroups ? 1 : 0);
+      std::unique_ptr<BTreeNode> inner(new BTreeNode(false, capacity, width));
+      parent_firsts.push_back(firsts[child]);
+      for (size_t c = 0; c < group_size; ++c, ++child) {
+        if (c > 0) {
+          std::memcpy(inner->keys.get() + (c - 1) * width, firsts[child],
+                      width * sizeof(SymbolId));
+        }
+        inner->children.push_back(std::move(level[child]));
+      }
+      inner->nkeys = group_size - 1;
+      parents.push_back(std::move(inner));
+      ++nnodes;
+    }
+    level = std::move(parents);
+    firsts = std::move(parent_firsts);
+  }
+  if (level.empty()) {
+    root.reset(new BTreeNode(true, capacity, width));
+    nnodes = 1;
+  }
+  else {
+    root = std::move(level[0]);
+  }
+  nkeys = n;
+}
+
+bool
+BTreeIndex::contains(const SymbolId *key) const {
+  Iterator it = lower_bound(key, width);
+  return it != end() && compare(*it, key, width) == 0;
+}
+
+BTreeIndex::Iterator
+BTreeIndex::begin(void) const {
+  const BTreeNode *node = root.get();
+  while (!node->is_leaf) {
+    node = node->children[0].get();
+  }
+  return Iterator(this, node->nkeys == 0 ? nullptr : node, 0);
+}
+
+BTreeIndex::Iterator
+BTreeIndex::end(void) const {
+  return Iterator(this, nullptr, 0);
+}
+
+/**
+ * @brief First key whose first len symbols are not less than prefix
+ */
+BTreeIndex::Iterator
+BTreeIndex::lower_bound(const SymbolId *prefix, size_t len) const {
+  const BTreeNode *node = root.get();
+  while (!node->is_leaf) {
+    node = node->children[node_position(node, prefix, len, false)].get();
+  }
+  size_t pos = node_position(node, prefix, len, false);
+  if (pos == node->nkeys) {
+    return Iterator(this, node->next, 0);
+  }
+  return Iterator(this, node, pos);
+}
+
+/**
+ * @brief First key whose first len symbols are greater than prefix
+ */
+BTreeIndex::Iterator
+BTreeIndex::upper_bound(const SymbolId *prefix, size_t len) const {
+  const BTreeNode *node = root.get();
+  while (!node->is_leaf) {
+    node = node->children[node_position(node, prefix, len, true)].get();
+  }
+  size_t pos = node_position(node, prefix, len, true);
+  if (pos == node->nkeys) {
+    return Iterator(this, node->next, 0);
+  }
+  return Iterator(this, node, pos);
+}
+
+BTreeIndex::Iterator::
+Iterator(const BTreeIndex *tree, const BTreeNode *leaf, size_t pos)
+  : tree(tree), leaf(leaf), pos(pos) {
+}
+
+const SymbolId *
+BTreeIndex::Iterator::operator*(void) const {
+  return tree->key_at(leaf, pos);
+}
+
+BTreeIndex::Iterator &
+BTreeIndex::Iterator::operator++(void) {
+  if (++pos == leaf->nkeys) {
+    leaf = leaf->next;
+    pos = 0;
+  }
+  return *this;
+}
+
+bool
+BTreeIndex::Iterator::operator==(const Iterator &other) const {
+  return leaf == other.leaf && pos == other.pos;
+}
+
+bool
+BTreeIndex::Iterator::operator!=(const Iterator &other) const {
+  return !(*this == other);
+}
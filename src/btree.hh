@@ -0,0 +1,86 @@
+#ifndef BTREE_HH_INCLUDED
+#define BTREE_HH_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+typedef uint32_t SymbolId;
+
+/**
+ * @brief Node of a \ref BTreeIndex. Keys are stored flat, width symbols
+ * each. Inner nodes hold nkeys separators and nkeys + 1 children, where
+ * separator i is the smallest key under child i + 1.
+ */
+struct BTreeNode {
+  bool is_leaf;
+  size_t nkeys;
+  std::unique_ptr<SymbolId[]> keys;
+  std::vector<std::unique_ptr<BTreeNode>> children;
+  // Next leaf in key order
+  BTreeNode *next;
+
+  BTreeNode(bool is_leaf, size_t capacity, size_t width);
+};
+
+/**
+ * @brief B+-tree set of fixed width keys in lexicographic order.
+ * Nodes are sized to a few cache lines; leaves are chained so that ranges
+ * are scanned without going back up the tree.
+ */
+class BTreeIndex {
+private:
+  size_t width;
+  size_t capacity;
+  size_t nkeys;
+  size_t nnodes;
+  std::unique_ptr<BTreeNode> root;
+  // Leaf of the last insertion, tried first by insert_hint()
+  BTreeNode *hint;
+
+  int compare(const SymbolId *k1, const SymbolId *k2, size_t len) const;
+  const SymbolId *key_at(const BTreeNode *node, size_t idx) const;
+  size_t node_position(const BTreeNode *node, const SymbolId *key,
+                       size_t len, bool upper) const;
+  std::unique_ptr<BTreeNode> insert_into(BTreeNode *node,
+                                         const SymbolId *key,
+                                         std::vector<SymbolId> &separator,
+                                         bool &inserted);
+  void insert_key(BTreeNode *node, size_t pos, const SymbolId *key);
+  std::unique_ptr<BTreeNode> split(BTreeNode *node, size_t at,
+                                   std::vector<SymbolId> &separator);
+
+public:
+  /**
+   * @brief Position of a key, in a leaf
+   */
+  class Iterator {
+  private:
+    const BTreeIndex *tree;
+    const BTreeNode *leaf;
+    size_t pos;
+
+  public:
+    Iterator(const BTreeIndex *tree, const BTreeNode *leaf, size_t pos);
+    const SymbolId *operator*(void) const;
+    Iterator &operator++(void);
+    bool operator==(const Iterator &other) const;
+    bool operator!=(const Iterator &other) const;
+  };
+
+  BTreeIndex(size_t width);
+  size_t get_width(void) const;
+  size_t size(void) const;
+  size_t memory_usage(void) const;
+  bool insert(const SymbolId *key);
+  bool insert_hint(const SymbolId *key);
+  void bulk_load(const std::vector<SymbolId> &sorted_keys);
+  bool contains(const SymbolId *key) const;
+  Iterator begin(void) const;
+  Iterator end(void) const;
+  Iterator lower_bound(const SymbolId *prefix, size_t len) const;
+  Iterator upper_bound(const SymbolId *prefix, size_t len) const;
+};
+
+#endif
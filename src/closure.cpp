@@ -0,0 +1,161 @@
+/**
+ * @file closure.cpp
+ *
+ * Transitive closure of binary relations by bit-parallel breadth-first
+ * search
+ */
+
+#include "closure.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Sources searched together, one bit each
+static const size_t BLOCK_SIZE = 64;
+
+/**
+ * @brief State of a search, reused from one block of sources to the next
+ */
+struct Search {
+  // Sources that reached each vertex, and those yet to cross its edges
+  std::vector<uint64_t> seen;
+  std::vector<uint64_t> frontier;
+  // Vertices reached, and those to expand in this and the next level
+  std::vector<uint32_t> touched;
+  std::vector<uint32_t> active;
+  std::vector<uint32_t> next_active;
+
+  Search(size_t nvertices)
+    : seen(nvertices, 0), frontier(nvertices, 0), touched(), active(),
+      next_active() {
+  }
+};
+
+AdjacencyGraph::
+AdjacencyGraph(const Relation &edges)
+  : vertex_of(), symbols(), offsets(), targets() {
+  std::vector<uint32_t> sources;
+  std::vector<uint32_t> ends;
+  sources.reserve(edges.size());
+  ends.reserve(edges.size());
+  SymbolId buffer[2];
+  for (size_t r = 0; r < edges.size(); ++r) {
+    const SymbolId *row = edges.get_row(r, buffer);
+    sources.push_back(add_vertex(row[0]));
+    ends.push_back(add_vertex(row[1]));
+  }
+  // Counting sort of the edges by source
+  offsets.assign(symbols.size() + 1, 0);
+  for (uint32_t source : sources) {
+    ++offsets[source + 1];
+  }
+  for (size_t v = 0; v < symbols.size(); ++v) {
+    offsets[v + 1] += offsets[v];
+  }
+  targets.resize(ends.size());
+  std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+  for (size_t e = 0; e < sources.size(); ++e) {
+    targets[next[sources[e]]++] = ends[e];
+  }
+}
+
+uint32_t
+AdjacencyGraph::add_vertex(SymbolId symbol) {
+  auto inserted
+    = vertex_of.emplace(symbol, static_cast<uint32_t>(symbols.size()));
+  if (inserted.second) {
+    symbols.push_back(symbol);
+  }
+  return inserted.first->second;
+}
+
+size_t
+AdjacencyGraph::size(void) const {
+  return symbols.size();
+}
+
+/**
+ * @brief Append to pairs a (source, vertex) pair for every vertex reachable
+ * by one or more edges from each of the nsources, at most 64, sources
+ */
+static void
+search_block(const std::vector<uint32_t> &offsets,
+             const std::vector<uint32_t> &targets,
+             const std::vector<SymbolId> &symbols, const uint32_t *sources,
+             size_t nsources, Search &search, std::vector<SymbolId> &pairs) {
+  auto visit = [&](uint32_t vertex, uint64_t bits) {
+    uint64_t fresh = bits & ~search.seen[vertex];
+    if (fresh == 0) {
+      return;
+    }
+    if (search.seen[vertex] == 0) {
+      search.touched.push_back(vertex);
+    }
+    search.seen[vertex] |= fresh;
+    if (search.frontier[vertex] == 0) {
+      search.next_active.push_back(vertex);
+    }
+    search.frontier[vertex] |= fresh;
+  };
+  for (size_t i = 0; i < nsources; ++i) {
+    for (uint32_t e = offsets[sources[i]]; e < offsets[sources[i] + 1]; ++e) {
+      visit(targets[e], uint64_t(1) << i);
+    }
+  }
+  while (!search.next_active.empty()) {
+    search.active.swap(search.next_active);
+    search.next_active.clear();
+    for (uint32_t vertex : search.active) {
+      // A vertex reached again in this level is expanded once, with the
+      // union of the sources that reached it
+      uint64_t bits = search.frontier[vertex];
+      search.frontier[vertex] = 0;
+      for (uint32_t e = offsets[vertex]; bits != 0 && e < offsets[vertex + 1];
+           ++e) {
+        visit(targets[e], bits);
+      }
+    }
+  }
+  for (uint32_t vertex : search.touched) {
+    for (uint64_t bits = search.seen[vertex]; bits != 0; bits &= bits - 1) {
+      pairs.push_back(symbols[sources[__builtin_ctzll(bits)]]);
+      pairs.push_back(symbols[vertex]);
+    }
+    search.seen[vertex] = 0;
+  }
+  search.touched.clear();
+}
+
+/**
+ * @brief Append to pairs every pair of the transitive closure of the
+ * edges. Blocks of sources are searched concurrently on pool, which may be
+ * the pool the caller runs on; the pairs are in the same order for any
+ * number of threads.
+ */
+void
+AdjacencyGraph::closure(ThreadPool &pool,
+                        std::vector<SymbolId> &pairs) const {
+  std::vector<uint32_t> sources;
+  for (uint32_t v = 0; v < symbols.size(); ++v) {
+    if (offsets[v + 1] > offsets[v]) {
+      sources.push_back(v);
+    }
+  }
+  size_t nblocks = (sources.size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  size_t ntasks = std::min(nblocks, 4 * pool.size());
+  std::vector<std::vector<SymbolId>> parts(ntasks);
+  pool.parallel_for(ntasks, [&](size_t t) {
+    Search search(symbols.size());
+    for (size_t b = t * nblocks / ntasks; b < (t + 1) * nblocks / ntasks;
+         ++b) {
+      size_t first = b * BLOCK_SIZE;
+      search_block(offsets, targets, symbols, sources.data() + first,
+                   std::min(BLOCK_SIZE, sources.size() - first), search,
+                   parts[t]);
+    }
+  });
+  for (std::vector<SymbolId> &part : parts) {
+    pairs.insert(pairs.end(), part.begin(), part.end());
+  }
+}
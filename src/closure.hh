@@ -0,0 +1,34 @@
+#ifndef CLOSURE_HH_INCLUDED
+#define CLOSURE_HH_INCLUDED
+
+#include "relation.hh"
+#include "thread_pool.hh"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Directed graph of the rows of a binary relation, in compressed
+ * sparse row form: the successors of vertex v are targets[offsets[v]] to
+ * targets[offsets[v + 1]], vertices numbered in order of first occurrence.
+ * Reachability is computed by breadth-first searches from 64 sources at a
+ * time, each vertex holding a bitset of the sources that reached it, so
+ * that one pass over an edge serves every source whose search crosses it.
+ */
+class AdjacencyGraph {
+private:
+  std::unordered_map<SymbolId, uint32_t> vertex_of;
+  std::vector<SymbolId> symbols;
+  std::vector<uint32_t> offsets;
+  std::vector<uint32_t> targets;
+
+  uint32_t add_vertex(SymbolId symbol);
+
+public:
+  AdjacencyGraph(const Relation &edges);
+  size_t size(void) const;
+  void closure(ThreadPool &pool, std::vector<SymbolId> &pairs) const;
+};
+
+#endif
@@ -0,0 +1,602 @@
+/**
+ * @file codegen.cpp
+ *
+ * Ahead-of-time translation of datalog programs to C++
+ */
+
+#include "codegen.hh"
+#include "evaluator.hh"
+#include "lexer.hh"
+#include "parser.hh"
+#include "relation.hh"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Quote text as a C++ string literal, one literal per line of text
+ */
+std::string
+cpp_string_literal(const std::string &text) {
+  std::ostringstream out;
+  out << "\"";
+  for (size_t i = 0; i < text.size(); ++i) {
+    unsigned char ch = static_cast<unsigned char>(text[i]);
+    switch (ch) {
+      case '"':
+        out << "\\\"";
+        break;
+      case '\\':
+        out << "\\\\";
+        break;
+      case '\n':
+        out << "\\n\"";
+        if (i + 1 < text.size()) {
+          out << "\n  \"";
+        }
+        else {
+          return out.str();
+        }
+        break;
+      case '\t':
+        out << "\\t";
+        break;
+      default:
+        if (ch < 0x20 || ch >= 0x7f) {
+          // Octal escapes take at most three digits, unlike hexadecimal ones
+          out << "\\" << std::oct << std::setw(3) << std::setfill('0')
+              << static_cast<int>(ch) << std::dec;
+        }
+        else {
+          out << ch;
+        }
+    }
+  }
+  out << "\"";
+  return out.str();
+}
+
+/**
+ * @brief The operands of builtin, and its result unless it is a comparison
+ */
+static std::vector<CompiledColumn>
+builtin_columns(const CompiledBuiltin &builtin) {
+  std::vector<CompiledColumn> columns{builtin.operands[0], builtin.operands[1]};
+  if (builtin.op >= BuiltinOp::ASSIGN) {
+    columns.push_back(builtin.result);
+  }
+  return columns;
+}
+
+CodeGenerator::
+CodeGenerator(const std::string &name, const std::string &source)
+  : name(name), source(source), nrules(0), db(), evaluator(), relations(),
+    predicates(), constants() {
+  Lexer lexer;
+  std::vector<Token> tokens = lexer.run(this->source);
+  Parser parser(tokens);
+  Program program = parser.parse();
+  std::vector<Rule> rules = program.get_rules();
+  for (Rule rule : rules) {
+    nrules += is_fact(rule) ? 0 : 1;
+  }
+  // The generated code reads rows, so equivalence relations are closed by
+  // symmetry and transitivity rules instead; the program loaded at run time
+  // keeps its directives, for the queries
+  for (Atom directive : program.get_directives()) {
+    std::string predicate = directive.get_terms()[0].get_name();
+    std::string names[3] = {"X", "Y", "Z"};
+    std::vector<Term> vars;
+    for (std::string &var : names) {
+      vars.push_back(Term(var, TermType::VARIABLE));
+    }
+    std::vector<Term> xy{vars[0], vars[1]};
+    std::vector<Term> yx{vars[1], vars[0]};
+    std::vector<Term> yz{vars[1], vars[2]};
+    std::vector<Term> xz{vars[0], vars[2]};
+    Atom head_yx(predicate, yx);
+    Atom head_xz(predicate, xz);
+    std::vector<Atom> symmetric{Atom(predicate, xy)};
+    std::vector<Atom> transitive{Atom(predicate, xy), Atom(predicate, yz)};
+    rules.push_back(Rule(head_yx, symmetric));
+    rules.push_back(Rule(head_xz, transitive));
+  }
+  program = Program(rules);
+  // Facts are loaded at run time, only the rules are compiled
+  evaluator.reset(new Evaluator(db, program));
+  for (const CompiledRule &rule : evaluator->get_rules()) {
+    std::vector<const CompiledBuiltin *> builtins;
+    for (const CompiledBuiltin &builtin : rule.builtins) {
+      builtins.push_back(&builtin);
+    }
+    for (const CompiledAtom &atom : rule.body) {
+      relation_index(atom.relation);
+      for (const CompiledColumn &column : atom.columns) {
+        if (column.kind == ColumnKind::CONSTANT) {
+          constant_index(column.value);
+        }
+      }
+      for (const CompiledBuiltin &builtin : atom.builtins) {
+        builtins.push_back(&builtin);
+      }
+    }
+    for (const CompiledBuiltin *builtin : builtins) {
+      for (const CompiledColumn &column : builtin_columns(*builtin)) {
+        if (column.kind == ColumnKind::CONSTANT) {
+          constant_index(column.value);
+        }
+      }
+    }
+    relation_index(rule.head.relation);
+    for (const CompiledColumn &column : rule.head.columns) {
+      if (column.kind == ColumnKind::CONSTANT) {
+        constant_index(column.value);
+      }
+    }
+  }
+}
+
+size_t
+CodeGenerator::relation_index(const Relation *relation) {
+  auto it = std::find(relations.begin(), relations.end(), relation);
+  if (it != relations.end()) {
+    return it - relations.begin();
+  }
+  for (auto &entry : db.get_relations()) {
+    if (entry.second.get() == relation) {
+      predicates.push_back(entry.first);
+    }
+  }
+  relations.push_back(relation);
+  return relations.size() - 1;
+}
+
+size_t
+CodeGenerator::constant_index(SymbolId id) {
+  auto it = std::find(constants.begin(), constants.end(), id);
+  if (it != constants.end()) {
+    return it - constants.begin();
+  }
+  constants.push_back(id);
+  return constants.size() - 1;
+}
+
+std::string
+CodeGenerator::column_value(const CompiledColumn &column) {
+  if (column.kind == ColumnKind::CONSTANT) {
+    return "c_" + std::to_string(constant_index(column.value));
+  }
+  return "v_" + std::to_string(column.value);
+}
+
+/**
+ * @brief The atom, with variables named after their slots, for comments
+ */
+std::string
+CodeGenerator::atom_text(const CompiledAtom &atom) {
+  std::string text = atom.predicate + "(";
+  for (size_t i = 0; i < atom.columns.size(); ++i) {
+    if (i > 0) {
+      text += ", ";
+    }
+    if (atom.columns[i].kind == ColumnKind::CONSTANT) {
+      text += db.get_symbols().get_name(atom.columns[i].value);
+    }
+    else {
+      text += "V" + std::to_string(atom.columns[i].value);
+    }
+  }
+  // Keep comments closed whatever the constants contain
+  std::string::size_type pos;
+  while ((pos = text.find("*/")) != std::string::npos) {
+    text.replace(pos, 2, "* /");
+  }
+  return text + ")";
+}
+
+// Operators of BuiltinOp, in order
+static const char *const BUILTIN_OPS[] = {"EQ", "NE", "LT", "LE", "GT", "GE",
+                                          "ASSIGN", "ADD", "SUB", "MUL", "DIV",
+                                          "MOD"};
+static const char *const BUILTIN_SYMBOLS[] = {"=", "!=", "<", "<=", ">", ">=",
+                                              "=", "+", "-", "*", "/", "%"};
+
+/**
+ * @brief The built-in predicate, with variables named as in atom_text()
+ */
+std::string
+CodeGenerator::builtin_text(const CompiledBuiltin &builtin) {
+  auto operand = [&](const CompiledColumn &column) {
+    if (column.kind == ColumnKind::CONSTANT) {
+      return db.get_symbols().get_name(column.value);
+    }
+    return "V" + std::to_string(column.value);
+  };
+  size_t op = static_cast<size_t>(builtin.op);
+  if (builtin.op < BuiltinOp::ASSIGN) {
+    return operand(builtin.operands[0]) + " " + BUILTIN_SYMBOLS[op] + " "
+           + operand(builtin.operands[1]);
+  }
+  std::string text
+    = operand(builtin.result) + " = " + operand(builtin.operands[0]);
+  if (builtin.op != BuiltinOp::ASSIGN) {
+    text += std::string(" ") + BUILTIN_SYMBOLS[op] + " "
+            + operand(builtin.operands[1]);
+  }
+  return text;
+}
+
+/**
+ * @brief Emit the tests of builtins, which run fail when one does not hold,
+ * and the assignments of the used variables they bind. Results are named
+ * after prefix.
+ */
+void
+CodeGenerator::emit_builtins(std::ostream &out,
+                             const std::vector<CompiledBuiltin> &builtins,
+                             const std::string &prefix,
+                             const std::string &indent,
+                             const std::string &fail,
+                             const std::vector<bool> &used) {
+  for (size_t k = 0; k < builtins.size(); ++k) {
+    const CompiledBuiltin &builtin = builtins[k];
+    std::string op
+      = std::string("BuiltinOp::") + BUILTIN_OPS[static_cast<size_t>(builtin.op)];
+    std::string lhs = column_value(builtin.operands[0]);
+    std::string rhs = column_value(builtin.operands[1]);
+    out << indent << "// " << builtin_text(builtin) << "\n";
+    if (builtin.op < BuiltinOp::ASSIGN) {
+      out << indent << "if (!compare_values(" << op << ", " << lhs << ", "
+          << rhs << ")) {\n"
+          << indent << "  " << fail << ";\n"
+          << indent << "}\n";
+      continue;
+    }
+    std::string value = lhs;
+    if (builtin.op != BuiltinOp::ASSIGN) {
+      value = "r_" + prefix + "_" + std::to_string(k);
+      out << indent << "SymbolId " << value << ";\n"
+          << indent << "if (!compute_value(" << op << ", " << lhs << ", "
+          << rhs << ", " << value << ")) {\n"
+          << indent << "  " << fail << ";\n"
+          << indent << "}\n";
+    }
+    if (builtin.result.kind != ColumnKind::FREE) {
+      out << indent << "if (" << value
+          << " != " << column_value(builtin.result) << ") {\n"
+          << indent << "  " << fail << ";\n"
+          << indent << "}\n";
+    }
+    else if (used[builtin.result.value]) {
+      out << indent << "const SymbolId v_" << builtin.result.value << " = "
+          << value << ";\n";
+    }
+  }
+}
+
+/**
+ * @brief Emit the join of rule in which the atom at delta_pos only sees the
+ * rows of the last round, as \ref Evaluator::join
+ */
+void
+CodeGenerator::emit_rule(std::ostream &out, const CompiledRule &rule,
+                         size_t idx, size_t delta_pos) {
+  // Variables read after being bound; the others are not declared
+  std::vector<bool> used(rule.nvars, false);
+  std::vector<const CompiledBuiltin *> builtins;
+  for (const CompiledBuiltin &builtin : rule.builtins) {
+    builtins.push_back(&builtin);
+  }
+  for (const CompiledAtom &atom : rule.body) {
+    for (const CompiledColumn &column : atom.columns) {
+      if (column.kind == ColumnKind::BOUND) {
+        used[column.value] = true;
+      }
+    }
+    for (const CompiledBuiltin &builtin : atom.builtins) {
+      builtins.push_back(&builtin);
+    }
+  }
+  for (const CompiledBuiltin *builtin : builtins) {
+    for (const CompiledColumn &column : builtin_columns(*builtin)) {
+      if (column.kind == ColumnKind::BOUND) {
+        used[column.value] = true;
+      }
+    }
+  }
+  for (const CompiledColumn &column : rule.head.columns) {
+    if (column.kind != ColumnKind::CONSTANT) {
+      used[column.value] = true;
+    }
+  }
+
+  out << "static void\nrule_" << idx << "_" << delta_pos
+      << "(Relation **rel, const std::pair<size_t, size_t> *rounds,\n"
+      << "  const SymbolId *c, std::vector<SymbolId> &out) {\n";
+  std::vector<const CompiledAtom *> atoms;
+  for (const CompiledAtom &atom : rule.body) {
+    atoms.push_back(&atom);
+  }
+  atoms.push_back(&rule.head);
+  std::vector<CompiledColumn> columns;
+  for (const CompiledAtom *atom : atoms) {
+    columns.insert(columns.end(), atom->columns.begin(), atom->columns.end());
+  }
+  for (const CompiledBuiltin *builtin : builtins) {
+    std::vector<CompiledColumn> operands = builtin_columns(*builtin);
+    columns.insert(columns.end(), operands.begin(), operands.end());
+  }
+  std::vector<bool> declared(constants.size(), false);
+  for (const CompiledColumn &column : columns) {
+    if (column.kind != ColumnKind::CONSTANT) {
+      continue;
+    }
+    size_t k = constant_index(column.value);
+    if (!declared[k]) {
+      out << "  const SymbolId c_" << k << " = c[" << k << "];\n";
+      declared[k] = true;
+    }
+  }
+  // Row ranges do not change during a join: if one is empty, so is the join
+  for (size_t pos = 0; pos < rule.body.size(); ++pos) {
+    size_t r = relation_index(rule.body[pos].relation);
+    out << "  const size_t lo_" << pos << " = "
+        << (pos == delta_pos ? "rounds[" + std::to_string(r) + "].first"
+                             : std::string("0"))
+        << ";\n";
+    out << "  const size_t hi_" << pos << " = rounds[" << r << "]."
+        << (pos < delta_pos ? "first" : "second") << ";\n";
+    out << "  if (lo_" << pos << " >= hi_" << pos << ") {\n"
+        << "    return;\n"
+        << "  }\n";
+  }
+
+  std::string indent = "  ";
+  emit_builtins(out, rule.builtins, "rule", indent, "return", used);
+  for (size_t pos = 0; pos < rule.body.size(); ++pos) {
+    const CompiledAtom &atom = rule.body[pos];
+    std::string p = std::to_string(pos);
+    size_t r = relation_index(atom.relation);
+    out << indent << "// " << atom_text(atom)
+        << (pos == delta_pos ? ", last round" : "") << "\n";
+    out << indent << "SymbolId buffer_" << p << "["
+        << std::max<size_t>(atom.columns.size(), 1) << "];\n";
+    if (atom.bound_mask != 0) {
+      out << indent << "SymbolId key_" << p << "[] = {";
+      bool first = true;
+      for (size_t i = 0; i < atom.columns.size(); ++i) {
+        if (atom.bound_mask & (1ULL << i)) {
+          out << (first ? "" : ", ") << column_value(atom.columns[i]);
+          first = false;
+        }
+      }
+      out << "};\n";
+      out << indent << "const std::vector<uint32_t> *rows_" << p << " = rel["
+          << r << "]->probe(0x" << std::hex << atom.bound_mask << std::dec
+          << "ULL, key_" << p << ");\n";
+      out << indent << "if (rows_" << p << " != nullptr) {\n";
+      indent += "  ";
+      out << indent << "for (auto it_" << p << " = std::lower_bound(rows_" << p
+          << "->begin(), rows_" << p << "->end(), lo_" << p << ");\n"
+          << indent << "     it_" << p << " != rows_" << p << "->end() && *it_"
+          << p << " < hi_" << p << "; ++it_" << p << ") {\n";
+      indent += "  ";
+      out << indent << "const SymbolId *t_" << p << " = rel[" << r
+          << "]->get_row(*it_" << p << ", buffer_" << p << ");\n";
+    }
+    else {
+      out << indent << "for (size_t i_" << p << " = lo_" << p << "; i_" << p
+          << " < hi_" << p << "; ++i_" << p << ") {\n";
+      indent += "  ";
+      out << indent << "const SymbolId *t_" << p << " = rel[" << r
+          << "]->get_row(i_" << p << ", buffer_" << p << ");\n";
+    }
+    for (size_t i = 0; i < atom.columns.size(); ++i) {
+      const CompiledColumn &column = atom.columns[i];
+      if (column.kind == ColumnKind::FREE) {
+        if (used[column.value]) {
+          out << indent << "const SymbolId v_" << column.value << " = t_" << p
+              << "[" << i << "];\n";
+        }
+        continue;
+      }
+      // Probes only compare hashes: bound columns are checked too
+      out << indent << "if (t_" << p << "[" << i
+          << "] != " << column_value(column) << ") {\n"
+          << indent << "  continue;\n"
+          << indent << "}\n";
+    }
+    emit_builtins(out, atom.builtins, p, indent, "continue", used);
+  }
+  if (rule.head.columns.empty()) {
+    out << indent << "out.push_back(0);\n";
+  }
+  for (const CompiledColumn &column : rule.head.columns) {
+    out << indent << "out.push_back(" << column_value(column) << ");\n";
+  }
+  for (size_t pos = rule.body.size(); pos-- > 0;) {
+    if (rule.body[pos].bound_mask != 0) {
+      indent.resize(indent.size() - 2);
+      out << indent << "}\n";
+    }
+    indent.resize(indent.size() - 2);
+    out << indent << "}\n";
+  }
+  out << "}\n\n";
+}
+
+/**
+ * @brief Emit the fixpoint loop, as \ref Evaluator::run
+ */
+void
+CodeGenerator::emit_run(std::ostream &out) {
+  const std::vector<CompiledRule> &rules = evaluator->get_rules();
+  out << "static size_t\n"
+      << "run(Relation **rel, const SymbolId *c) {\n"
+      << "  // In the first round every stored tuple is new\n"
+      << "  std::vector<std::pair<size_t, size_t>> rounds(NRELATIONS);\n"
+      << "  for (size_t r = 0; r < NRELATIONS; ++r) {\n"
+      << "    rounds[r] = std::make_pair(size_t(0), rel[r]->size());\n"
+      << "  }\n"
+      << "  size_t nderived = 0;\n"
+      << "  bool changed = true;\n"
+      << "  std::vector<SymbolId> derived;\n";
+  // Rules without atoms only depend on their built-in predicates
+  for (size_t idx = 0; idx < rules.size(); ++idx) {
+    const CompiledRule &rule = rules[idx];
+    if (rule.body.empty()) {
+      out << "  rule_" << idx << "_0(rel, rounds.data(), c, derived);\n"
+          << "  for (size_t i = 0; i < derived.size(); i += "
+          << std::max<size_t>(rule.head.columns.size(), 1) << ") {\n"
+          << "    nderived += rel[" << relation_index(rule.head.relation)
+          << "]->insert(derived.data() + i) ? 1 : 0;\n"
+          << "  }\n"
+          << "  derived.clear();\n";
+    }
+  }
+  out << "  while (changed) {\n";
+  for (size_t idx = 0; idx < rules.size(); ++idx) {
+    const CompiledRule &rule = rules[idx];
+    size_t head = relation_index(rule.head.relation);
+    size_t width = std::max<size_t>(rule.head.columns.size(), 1);
+    for (size_t d = 0; d < rule.body.size(); ++d) {
+      size_t r = relation_index(rule.body[d].relation);
+      out << "    if (rounds[" << r << "].first != rounds[" << r
+          << "].second) {\n"
+          << "      derived.clear();\n"
+          << "      rule_" << idx << "_" << d << "(rel, rounds.data(), c, derived);\n"
+          << "      for (size_t i = 0; i < derived.size(); i += " << width
+          << ") {\n"
+          << "        nderived += rel[" << head
+          << "]->insert(derived.data() + i) ? 1 : 0;\n"
+          << "      }\n"
+          << "    }\n";
+    }
+  }
+  out << "    changed = false;\n"
+      << "    for (size_t r = 0; r < NRELATIONS; ++r) {\n"
+      << "      rounds[r].first = rounds[r].second;\n"
+      << "      rounds[r].second = rel[r]->size();\n"
+      << "      changed = changed || rounds[r].first != rounds[r].second;\n"
+      << "    }\n"
+      << "  }\n"
+      << "  return nderived;\n"
+      << "}\n\n";
+}
+
+/**
+ * @brief Emit main(), with the same command line, output and query loop as
+ * datalogsh
+ */
+void
+CodeGenerator::emit_main(std::ostream &out) {
+  out << "int\n"
+      << "main(int argc, char **argv) {\n"
+      << "  size_t nthreads = default_concurrency();\n"
+      << "  std::vector<std::string> args;\n"
+      << "  for (int i = 1; i < argc; ++i) {\n"
+      << "    std::string arg(argv[i]);\n"
+      << "    if (arg == \"-j\" && i + 1 < argc) {\n"
+      << "      nthreads = std::strtoul(argv[++i], nullptr, 10);\n"
+      << "    }\n"
+      << "    else {\n"
+      << "      args.push_back(arg);\n"
+      << "    }\n"
+      << "  }\n"
+      << "  std::vector<std::string> files = expand_paths(args);\n"
+      << "  Program prog;\n"
+      << "  Database db;\n"
+      << "  Loader loader(nthreads);\n"
+      << "  size_t nfacts = loader.load_source(SOURCE, files, prog, db);\n"
+      << "  if (prog.get_rules().size() != NRULES) {\n"
+      << "    std::cerr << argv[0] << \": rules can only be given at compile "
+         "time\\n\";\n"
+      << "    return 1;\n"
+      << "  }\n"
+      << "  std::vector<SymbolId> c;\n"
+      << "  for (const char *constant : CONSTANTS) {\n"
+      << "    c.push_back(db.get_symbols().intern(constant));\n"
+      << "  }\n"
+      << "  std::vector<Relation *> rel;\n"
+      << "  for (size_t r = 0; r < NRELATIONS; ++r) {\n"
+      << "    rel.push_back(&db.get_relation(PREDICATES[r], ARITIES[r]));\n"
+      << "  }\n"
+      << "  size_t nderived = run(rel.data(), c.data());\n"
+      << "  std::cout << \"Loaded \" << nfacts << \" facts and \"\n"
+      << "            << prog.get_rules().size() << \" rules from \"\n"
+      << "            << files.size() + 1 << \" file(s), derived \" << "
+         "nderived\n"
+      << "            << \" facts\\n\";\n"
+      << "  // Queries go through the interpreter's evaluator\n"
+      << "  Evaluator evaluator(db, prog);\n"
+      << "  Interpreter interpreter;\n"
+      << "  interpreter.run_queries(evaluator, db, std::cin, std::cout);\n"
+      << "  return 0;\n"
+      << "}\n";
+}
+
+void
+CodeGenerator::generate(std::ostream &out) {
+  const std::vector<CompiledRule> &rules = evaluator->get_rules();
+  out << "// Generated by datalogc from " << name << ", do not edit\n\n"
+      << "#include \"datalog.hh\"\n"
+      << "#include \"evaluator.hh\"\n"
+      << "#include \"loader.hh\"\n"
+      << "#include \"relation.hh\"\n\n"
+      << "#include <algorithm>\n"
+      << "#include <cstdlib>\n"
+      << "#include <iostream>\n"
+      << "#include <string>\n"
+      << "#include <utility>\n"
+      << "#include <vector>\n\n";
+  out << "static const char SOURCE[] =\n  " << cpp_string_literal(source)
+      << ";\n";
+  out << "static const size_t NRULES = " << nrules << ";\n";
+  // Arrays get a trailing entry so that they are never empty
+  out << "static const size_t NRELATIONS = " << relations.size() << ";\n"
+      << "static const char *const PREDICATES[] = {";
+  for (size_t r = 0; r < relations.size(); ++r) {
+    out << cpp_string_literal(predicates[r]) << ", ";
+  }
+  out << "nullptr};\n"
+      << "static const size_t ARITIES[] = {";
+  for (size_t r = 0; r < relations.size(); ++r) {
+    out << relations[r]->get_arity() << ", ";
+  }
+  out << "0};\n"
+      << "static const std::vector<const char *> CONSTANTS = {";
+  for (size_t k = 0; k < constants.size(); ++k) {
+    out << (k > 0 ? ", " : "")
+        << cpp_string_literal(db.get_symbols().get_name(constants[k]));
+  }
+  out << "};\n\n";
+
+  for (size_t idx = 0; idx < rules.size(); ++idx) {
+    const CompiledRule &rule = rules[idx];
+    std::string text = atom_text(rule.head) + " :- ";
+    std::vector<std::string> goals;
+    for (const CompiledBuiltin &builtin : rule.builtins) {
+      goals.push_back(builtin_text(builtin));
+    }
+    for (const CompiledAtom &atom : rule.body) {
+      goals.push_back(atom_text(atom));
+      for (const CompiledBuiltin &builtin : atom.builtins) {
+        goals.push_back(builtin_text(builtin));
+      }
+    }
+    for (size_t i = 0; i < goals.size(); ++i) {
+      text += (i > 0 ? ", " : "") + goals[i];
+    }
+    out << "/* " << text << ". */\n";
+    for (size_t d = 0; d < std::max<size_t>(rule.body.size(), 1); ++d) {
+      emit_rule(out, rule, idx, d);
+    }
+  }
+  emit_run(out);
+  emit_main(out);
+}
@@ -0,0 +1,52 @@
+#ifndef CODEGEN_HH_INCLUDED
+#define CODEGEN_HH_INCLUDED
+
+#include "evaluator.hh"
+#include "parser.hh"
+#include "relation.hh"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Translates a datalog program into a standalone C++ program.
+ * Each rule becomes one function per semi-naive delta position, with the
+ * arities, index column masks, constants and loop nest of the join written
+ * out. The generated program behaves as datalogsh run on the source first.
+ */
+class CodeGenerator {
+private:
+  std::string name;
+  std::string source;
+  size_t nrules;
+  // Relations and constants of the rules, numbered by first use
+  Database db;
+  std::unique_ptr<Evaluator> evaluator;
+  std::vector<const Relation *> relations;
+  std::vector<std::string> predicates;
+  std::vector<SymbolId> constants;
+
+  size_t relation_index(const Relation *relation);
+  size_t constant_index(SymbolId id);
+  std::string column_value(const CompiledColumn &column);
+  std::string atom_text(const CompiledAtom &atom);
+  std::string builtin_text(const CompiledBuiltin &builtin);
+  void emit_builtins(std::ostream &out,
+                     const std::vector<CompiledBuiltin> &builtins,
+                     const std::string &prefix, const std::string &indent,
+                     const std::string &fail, const std::vector<bool> &used);
+  void emit_rule(std::ostream &out, const CompiledRule &rule, size_t idx,
+                 size_t delta_pos);
+  void emit_run(std::ostream &out);
+  void emit_main(std::ostream &out);
+
+public:
+  CodeGenerator(const std::string &name, const std::string &source);
+  void generate(std::ostream &out);
+};
+
+std::string cpp_string_literal(const std::string &text);
+
+#endif
@@ -0,0 +1,225 @@
+/**
+ * @file column.cpp
+ *
+ * Compressed, read-only columns of symbols
+ */
+
+#include "column.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Runs between two checkpoints: bounds the work of a random access
+static const size_t RUN_CHECKPOINT = 16;
+
+/**
+ * @brief Number of bits needed to represent value, 0 for 0
+ */
+unsigned
+bit_width(uint64_t value) {
+  return value == 0 ? 0 : 64 - __builtin_clzll(value);
+}
+
+PackedVector::
+PackedVector(unsigned width)
+  : width(width), count(0), words() {
+}
+
+void
+PackedVector::reserve(size_t n) {
+  words.reserve((n * width + 63) / 64 + 1);
+}
+
+void
+PackedVector::push_back(uint64_t value) {
+  size_t bit = count * width;
+  size_t word = bit / 64;
+  size_t offset = bit % 64;
+  ++count;
+  if (width == 0) {
+    return;
+  }
+  // One spare word, so that get() may always read two
+  words.resize((count * width + 63) / 64 + 1, 0);
+  words[word] |= value << offset;
+  if (offset + width > 64) {
+    words[word + 1] |= value >> (64 - offset);
+  }
+}
+
+uint64_t
+PackedVector::get(size_t idx) const {
+  if (width == 0) {
+    return 0;
+  }
+  size_t bit = idx * width;
+  size_t word = bit / 64;
+  size_t offset = bit % 64;
+  uint64_t value = words[word] >> offset;
+  if (offset + width > 64) {
+    value |= words[word + 1] << (64 - offset);
+  }
+  return width == 64 ? value : value & ((1ULL << width) - 1);
+}
+
+size_t
+PackedVector::size(void) const {
+  return count;
+}
+
+unsigned
+PackedVector::get_width(void) const {
+  return width;
+}
+
+size_t
+PackedVector::memory_usage(void) const {
+  return words.capacity() * sizeof(uint64_t);
+}
+
+/**
+ * @brief Compress count values, read stride symbols apart from data.
+ * Run-length encoding is used when the column is sorted and it is the
+ * smaller of the two encodings.
+ */
+CompressedColumn::
+CompressedColumn(const SymbolId *data, size_t stride, size_t count)
+  : runs(false), count(count), values(0), lengths(0), checkpoint_rows(),
+    checkpoint_values() {
+  SymbolId max_value = 0;
+  bool sorted = true;
+  size_t nruns = 0;
+  uint32_t max_delta = 0;
+  uint32_t max_length = 0;
+  uint32_t length = 0;
+  for (size_t i = 0; i < count; ++i) {
+    SymbolId value = data[i * stride];
+    max_value = std::max(max_value, value);
+    if (i > 0 && value < data[(i - 1) * stride]) {
+      sorted = false;
+    }
+    if (i == 0 || value != data[(i - 1) * stride]) {
+      max_delta = std::max(
+        max_delta, i == 0 ? value : value - data[(i - 1) * stride]);
+      max_length = std::max(max_length, length);
+      length = 0;
+      ++nruns;
+    }
+    ++length;
+  }
+  max_length = std::max(max_length, length);
+
+  size_t packed_bits = count * bit_width(max_value);
+  size_t run_bits = nruns * (bit_width(max_delta) + bit_width(max_length))
+                    + (nruns / RUN_CHECKPOINT + 1) * 64;
+  runs = sorted && count > 0 && run_bits < packed_bits;
+  if (!runs) {
+    values = PackedVector(bit_width(max_value));
+    values.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+      values.push_back(data[i * stride]);
+    }
+    return;
+  }
+  values = PackedVector(bit_width(max_delta));
+  lengths = PackedVector(bit_width(max_length));
+  values.reserve(nruns);
+  lengths.reserve(nruns);
+  size_t run_start = 0;
+  for (size_t i = 1; i <= count; ++i) {
+    if (i < count && data[i * stride] == data[run_start * stride]) {
+      continue;
+    }
+    SymbolId value = data[run_start * stride];
+    size_t run = values.size();
+    if (run % RUN_CHECKPOINT == 0) {
+      checkpoint_rows.push_back(static_cast<uint32_t>(run_start));
+      checkpoint_values.push_back(value);
+    }
+    values.push_back(run == 0 ? value : value - data[(run_start - 1) * stride]);
+    lengths.push_back(i - run_start);
+    run_start = i;
+  }
+}
+
+size_t
+CompressedColumn::size(void) const {
+  return count;
+}
+
+bool
+CompressedColumn::is_run_length(void) const {
+  return runs;
+}
+
+/**
+ * @brief Index of the last checkpoint at or before row
+ */
+size_t
+CompressedColumn::find_checkpoint(size_t row) const {
+  auto it = std::upper_bound(checkpoint_rows.begin(), checkpoint_rows.end(),
+                             static_cast<uint32_t>(row));
+  return (it - checkpoint_rows.begin()) - 1;
+}
+
+SymbolId
+CompressedColumn::get(size_t row) const {
+  if (!runs) {
+    return static_cast<SymbolId>(values.get(row));
+  }
+  size_t checkpoint = find_checkpoint(row);
+  size_t run = checkpoint * RUN_CHECKPOINT;
+  size_t start = checkpoint_rows[checkpoint];
+  SymbolId value = checkpoint_values[checkpoint];
+  for (;;) {
+    start += lengths.get(run);
+    if (row < start) {
+      return value;
+    }
+    ++run;
+    value += static_cast<SymbolId>(values.get(run));
+  }
+}
+
+/**
+ * @brief Decode rows [begin, end) to out, stride symbols apart
+ */
+void
+CompressedColumn::decode(size_t begin, size_t end, SymbolId *out,
+                         size_t stride) const {
+  if (begin >= end) {
+    return;
+  }
+  if (!runs) {
+    for (size_t row = begin; row < end; ++row, out += stride) {
+      *out = static_cast<SymbolId>(values.get(row));
+    }
+    return;
+  }
+  // Locate the run of begin once, then walk the runs
+  size_t checkpoint = find_checkpoint(begin);
+  size_t run = checkpoint * RUN_CHECKPOINT;
+  size_t run_end = checkpoint_rows[checkpoint] + lengths.get(run);
+  SymbolId value = checkpoint_values[checkpoint];
+  while (run_end <= begin) {
+    ++run;
+    run_end += lengths.get(run);
+    value += static_cast<SymbolId>(values.get(run));
+  }
+  for (size_t row = begin; row < end; ++row, out += stride) {
+    if (row == run_end) {
+      ++run;
+      run_end += lengths.get(run);
+      value += static_cast<SymbolId>(values.get(run));
+    }
+    *out = value;
+  }
+}
+
+size_t
+CompressedColumn::memory_usage(void) const {
+  return values.memory_usage() + lengths.memory_usage()
+         + checkpoint_rows.capacity() * sizeof(uint32_t)
+         + checkpoint_values.capacity() * sizeof(SymbolId);
+}
@@ -0,0 +1,60 @@
+#ifndef COLUMN_HH_INCLUDED
+#define COLUMN_HH_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+typedef uint32_t SymbolId;
+
+unsigned bit_width(uint64_t value);
+
+/**
+ * @brief Unsigned integers of a fixed number of bits, packed back to back in
+ * 64-bit words
+ */
+class PackedVector {
+private:
+  unsigned width;
+  size_t count;
+  std::vector<uint64_t> words;
+
+public:
+  PackedVector(unsigned width);
+  void reserve(size_t n);
+  void push_back(uint64_t value);
+  uint64_t get(size_t idx) const;
+  size_t size(void) const;
+  unsigned get_width(void) const;
+  size_t memory_usage(void) const;
+};
+
+/**
+ * @brief Immutable column of symbols, bit-packed to the width of its largest
+ * value. Columns sorted in row order are stored instead as runs of equal
+ * values, each run holding the difference to the previous run's value.
+ */
+class CompressedColumn {
+private:
+  bool runs;
+  size_t count;
+  // Packed: one value per row. Runs: value deltas between consecutive runs
+  PackedVector values;
+  // Runs: number of rows of each run
+  PackedVector lengths;
+  // Runs: first row and value of every RUN_CHECKPOINT-th run
+  std::vector<uint32_t> checkpoint_rows;
+  std::vector<SymbolId> checkpoint_values;
+
+  size_t find_checkpoint(size_t row) const;
+
+public:
+  CompressedColumn(const SymbolId *data, size_t stride, size_t count);
+  size_t size(void) const;
+  bool is_run_length(void) const;
+  SymbolId get(size_t row) const;
+  void decode(size_t begin, size_t end, SymbolId *out, size_t stride) const;
+  size_t memory_usage(void) const;
+};
+
+#endif
@@ -0,0 +1,35 @@
+#include "codegen.hh"
+#include "loader.hh"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+void
+usage(char **argv) {
+  std::cout << "Usage: " << argv[0] << " <PROGRAM> <OUTPUT>\n";
+}
+
+int
+main(int argc, char **argv) {
+  if (argc != 3) {
+    usage(argv);
+    return 1;
+  }
+  std::string source = read_file(argv[1]);
+  // The lexer and the parser report on stdout
+  std::ostringstream discarded;
+  std::streambuf *out = std::cout.rdbuf(discarded.rdbuf());
+  std::string name(argv[1]);
+  CodeGenerator generator(name.substr(name.find_last_of('/') + 1), source);
+  std::cout.rdbuf(out);
+
+  std::ofstream ofs(argv[2]);
+  if (!ofs.is_open()) {
+    std::cerr << "Cannot open " << argv[2] << "\n";
+    return 1;
+  }
+  generator.generate(ofs);
+  return ofs.good() ? 0 : 1;
+}
@@ -0,0 +1,207 @@
+/**
+ * @file dependency_graph.cpp
+ *
+ * Strongly connected components of the predicate dependency graph
+ */
+
+#include "dependency_graph.hh"
+#include "parser.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+DependencyGraph::
+DependencyGraph(Program &program)
+  : predicates(), ids(), readers(), components(), component_of(), inputs() {
+  for (Rule rule : program.get_rules()) {
+    size_t head = add_predicate(rule.get_head().get_predicate());
+    for (Atom goal : rule.get_goals()) {
+      if (goal.is_builtin()) {
+        continue;
+      }
+      size_t body = add_predicate(goal.get_predicate());
+      readers[body].push_back(head);
+    }
+  }
+  for (std::vector<size_t> &edges : readers) {
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+  }
+  find_components();
+}
+
+size_t
+DependencyGraph::add_predicate(const std::string &predicate) {
+  auto it = ids.find(predicate);
+  if (it != ids.end()) {
+    return it->second;
+  }
+  ids.emplace(predicate, predicates.size());
+  predicates.push_back(predicate);
+  readers.emplace_back();
+  return predicates.size() - 1;
+}
+
+/**
+ * @brief Tarjan's algorithm, with an explicit stack so that long chains of
+ * predicates do not exhaust the call stack.
+ * Components complete after every component that reads them, so they are
+ * numbered in reverse order of completion.
+ */
+void
+DependencyGraph::find_components(void) {
+  const size_t UNVISITED = SIZE_MAX;
+  size_t n = predicates.size();
+  std::vector<size_t> index(n, UNVISITED);
+  std::vector<size_t> lowlink(n, 0);
+  std::vector<bool> on_stack(n, false);
+  std::vector<size_t> stack;
+  // (predicate, next edge to follow)
+  std::vector<std::pair<size_t, size_t>> calls;
+  size_t next_index = 0;
+  for (size_t root = 0; root < n; ++root) {
+    if (index[root] != UNVISITED) {
+      continue;
+    }
+    calls.emplace_back(root, 0);
+    while (!calls.empty()) {
+      size_t v = calls.back().first;
+      size_t &edge = calls.back().second;
+      if (edge == 0) {
+        index[v] = lowlink[v] = next_index++;
+        stack.push_back(v);
+        on_stack[v] = true;
+      }
+      if (edge < readers[v].size()) {
+        size_t w = readers[v][edge++];
+        if (index[w] == UNVISITED) {
+          calls.emplace_back(w, 0);
+        }
+        else if (on_stack[w]) {
+          lowlink[v] = std::min(lowlink[v], index[w]);
+        }
+        continue;
+      }
+      if (lowlink[v] == index[v]) {
+        std::vector<size_t> component;
+        size_t w;
+        do {
+          w = stack.back();
+          stack.pop_back();
+          on_stack[w] = false;
+          component.push_back(w);
+        } while (w != v);
+        components.push_back(component);
+      }
+      calls.pop_back();
+      if (!calls.empty()) {
+        size_t parent = calls.back().first;
+        lowlink[parent] = std::min(lowlink[parent], lowlink[v]);
+      }
+    }
+  }
+  std::reverse(components.begin(), components.end());
+
+  component_of.assign(n, 0);
+  for (size_t c = 0; c < components.size(); ++c) {
+    for (size_t p : components[c]) {
+      component_of[p] = c;
+    }
+  }
+  inputs.assign(components.size(), {});
+  for (size_t p = 0; p < n; ++p) {
+    for (size_t reader : readers[p]) {
+      size_t from = component_of[p];
+      size_t to = component_of[reader];
+      if (from != to) {
+        inputs[to].push_back(from);
+      }
+    }
+  }
+  for (std::vector<size_t> &in : inputs) {
+    std::sort(in.begin(), in.end());
+    in.erase(std::unique(in.begin(), in.end()), in.end());
+  }
+}
+
+/**
+ * @brief Number of strongly connected components
+ */
+size_t
+DependencyGraph::size(void) const {
+  return components.size();
+}
+
+size_t
+DependencyGraph::get_component(const std::string &predicate) const {
+  auto it = ids.find(predicate);
+  if (it == ids.end()) {
+    throw std::runtime_error("Unknown predicate " + predicate);
+  }
+  return component_of[it->second];
+}
+
+std::vector<std::string>
+DependencyGraph::get_predicates(size_t component) const {
+  std::vector<std::string> names;
+  for (size_t p : components.at(component)) {
+    names.push_back(predicates[p]);
+  }
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+/**
+ * @brief Components whose predicates the rules of component read, other
+ * than itself
+ */
+const std::vector<size_t> &
+DependencyGraph::get_inputs(size_t component) const {
+  return inputs.at(component);
+}
+
+/**
+ * @brief Whether the predicates of component depend on themselves
+ */
+bool
+DependencyGraph::is_recursive(size_t component) const {
+  const std::vector<size_t> &members = components.at(component);
+  if (members.size() > 1) {
+    return true;
+  }
+  const std::vector<size_t> &edges = readers[members[0]];
+  return std::binary_search(edges.begin(), edges.end(), members[0]);
+}
+
+/**
+ * @brief predicate and the predicates whose rules read it, directly or not,
+ * sorted. Predicates unknown to the graph only have themselves.
+ */
+std::vector<std::string>
+DependencyGraph::get_dependents(const std::string &predicate) const {
+  auto it = ids.find(predicate);
+  if (it == ids.end()) {
+    return {predicate};
+  }
+  std::vector<bool> seen(predicates.size(), false);
+  std::vector<size_t> stack{it->second};
+  seen[it->second] = true;
+  std::vector<std::string> names;
+  while (!stack.empty()) {
+    size_t p = stack.back();
+    stack.pop_back();
+    names.push_back(predicates[p]);
+    for (size_t reader : readers[p]) {
+      if (!seen[reader]) {
+        seen[reader] = true;
+        stack.push_back(reader);
+      }
+    }
+  }
+  std::sort(names.begin(), names.end());
+  return names;
+}
@@ -0,0 +1,40 @@
+#ifndef DEPENDENCY_GRAPH_HH_INCLUDED
+#define DEPENDENCY_GRAPH_HH_INCLUDED
+
+#include "parser.hh"
+
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Precedence graph of the predicates of a \ref Program: an edge goes
+ * from each predicate of a rule body to the predicate of its head.
+ * The strongly connected components are the sets of mutually recursive
+ * predicates; they are numbered in topological order, so that a component
+ * only reads the predicates of components numbered before it.
+ */
+class DependencyGraph {
+private:
+  std::vector<std::string> predicates;
+  std::map<std::string, size_t> ids;
+  // Predicates whose rules read each predicate
+  std::vector<std::vector<size_t>> readers;
+  std::vector<std::vector<size_t>> components;
+  std::vector<size_t> component_of;
+  std::vector<std::vector<size_t>> inputs;
+
+  size_t add_predicate(const std::string &predicate);
+  void find_components(void);
+
+public:
+  DependencyGraph(Program &program);
+  size_t size(void) const;
+  size_t get_component(const std::string &predicate) const;
+  std::vector<std::string> get_predicates(size_t component) const;
+  const std::vector<size_t> &get_inputs(size_t component) const;
+  bool is_recursive(size_t component) const;
+  std::vector<std::string> get_dependents(const std::string &predicate) const;
+};
+
+#endif
@@ -47,7 +47,7 @@ EvaluatedAtom::update_term(EvaluatedTerm &t) {
 
 void
 EvaluatedAtom::reset(void) {
-  for (EvaluatedTerm eterm : terms) {
+  for (EvaluatedTerm &eterm : terms) {
     eterm.reset_binding();
   }
 }
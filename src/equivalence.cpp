@@ -0,0 +1,109 @@
+/**
+ * @file equivalence.cpp
+ *
+ * Union-find storage of equivalence relations
+ */
+
+#include "equivalence.hh"
+
+#include <utility>
+
+EquivalenceClasses::
+EquivalenceClasses(void)
+  : elements(), symbols(), parent(), next(), class_size(), npairs(0) {
+}
+
+/**
+ * @returns The element of symbol, added as a class of its own if new
+ */
+uint32_t
+EquivalenceClasses::add(SymbolId symbol) {
+  auto inserted
+    = elements.emplace(symbol, static_cast<uint32_t>(symbols.size()));
+  if (!inserted.second) {
+    return inserted.first->second;
+  }
+  uint32_t element = inserted.first->second;
+  symbols.push_back(symbol);
+  parent.push_back(element);
+  next.push_back(element);
+  class_size.push_back(1);
+  ++npairs;
+  return element;
+}
+
+/**
+ * @brief Root of the class of element, leaving the forest as it is
+ */
+uint32_t
+EquivalenceClasses::find(uint32_t element) const {
+  while (parent[element] != element) {
+    element = parent[element];
+  }
+  return element;
+}
+
+/**
+ * @brief Root of the class of element, halving the path to it
+ */
+uint32_t
+EquivalenceClasses::compress(uint32_t element) {
+  while (parent[element] != element) {
+    parent[element] = parent[parent[element]];
+    element = parent[element];
+  }
+  return element;
+}
+
+/**
+ * @brief Merge the classes of a and b, the smaller under the larger
+ * @returns false when they already were the same class
+ */
+bool
+EquivalenceClasses::unite(SymbolId a, SymbolId b) {
+  size_t before = symbols.size();
+  uint32_t x = compress(add(a));
+  uint32_t y = compress(add(b));
+  if (x == y) {
+    return symbols.size() != before;
+  }
+  if (class_size[x] < class_size[y]) {
+    std::swap(x, y);
+  }
+  npairs += 2 * size_t(class_size[x]) * class_size[y];
+  parent[y] = x;
+  class_size[x] += class_size[y];
+  // Splice the two circular lists of members
+  std::swap(next[x], next[y]);
+  return true;
+}
+
+bool
+EquivalenceClasses::same(SymbolId a, SymbolId b) const {
+  auto x = elements.find(a);
+  auto y = elements.find(b);
+  if (x == elements.end() || y == elements.end()) {
+    return false;
+  }
+  return find(x->second) == find(y->second);
+}
+
+/**
+ * @brief Number of pairs of the relation
+ */
+size_t
+EquivalenceClasses::size(void) const {
+  return npairs;
+}
+
+/**
+ * @brief Approximate heap usage, in bytes
+ */
+size_t
+EquivalenceClasses::memory_usage(void) const {
+  return elements.size() * (sizeof(SymbolId) + sizeof(uint32_t) + 16)
+         + elements.bucket_count() * sizeof(void *)
+         + (symbols.capacity() + parent.capacity() + next.capacity()
+            + class_size.capacity())
+             * sizeof(uint32_t);
+}
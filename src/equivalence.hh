@@ -0,0 +1,74 @@
+#ifndef EQUIVALENCE_HH_INCLUDED
+#define EQUIVALENCE_HH_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+typedef uint32_t SymbolId;
+
+/**
+ * @brief Equivalence classes of symbols, as a union-find forest.
+ * A binary relation that is reflexive, symmetric and transitive holds a
+ * pair for every two members of a class, so storing the classes takes
+ * linear space where the pairs take quadratic space. Members of a class are
+ * also linked in a circular list, to enumerate the pairs on demand.
+ * Only unite() modifies the forest: it compresses paths, whereas the other
+ * operations do not, so that any number of readers can run concurrently.
+ */
+class EquivalenceClasses {
+private:
+  // Element of each symbol, elements are numbered in order of insertion
+  std::unordered_map<SymbolId, uint32_t> elements;
+  std::vector<SymbolId> symbols;
+  std::vector<uint32_t> parent;
+  // Next member of the class of each element
+  std::vector<uint32_t> next;
+  // Number of members of the class of each root
+  std::vector<uint32_t> class_size;
+  // Sum of the squares of the class sizes
+  size_t npairs;
+
+  uint32_t add(SymbolId symbol);
+  uint32_t find(uint32_t element) const;
+  uint32_t compress(uint32_t element);
+
+public:
+  EquivalenceClasses(void);
+  bool unite(SymbolId a, SymbolId b);
+  bool same(SymbolId a, SymbolId b) const;
+  size_t size(void) const;
+  size_t memory_usage(void) const;
+
+  /**
+   * @brief Call f on each member of the class of value, value included;
+   * values that were never united have no class
+   */
+  template <class F>
+  void for_each_member(SymbolId value, F f) const {
+    auto it = elements.find(value);
+    if (it == elements.end()) {
+      return;
+    }
+    uint32_t element = it->second;
+    do {
+      f(symbols[element]);
+      element = next[element];
+    } while (element != it->second);
+  }
+
+  /**
+   * @brief Call f on one member of each class
+   */
+  template <class F>
+  void for_each_class(F f) const {
+    for (uint32_t element = 0; element < parent.size(); ++element) {
+      if (parent[element] == element) {
+        f(symbols[element]);
+      }
+    }
+  }
+};
+
+#endif
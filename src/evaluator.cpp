@@ -0,0 +1,1750 @@
+/**
+ * @file evaluator.cpp
+ *
+ * Semi-naive bottom-up evaluation of datalog rules
+ */
+
+#include "evaluator.hh"
+#include "closure.hh"
+#include "dependency_graph.hh"
+#include "fixed_relation.hh"
+#include "intersect.hh"
+#include "parser.hh"
+#include "relation.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+static inline bool
+match_columns(const CompiledColumn *columns, size_t n, const SymbolId *row,
+              SymbolId *binding) {
+  for (size_t i = 0; i < n; ++i) {
+    switch (columns[i].kind) {
+      case ColumnKind::CONSTANT:
+        if (row[i] != columns[i].value) {
+          return false;
+        }
+        break;
+      case ColumnKind::BOUND:
+        if (row[i] != binding[columns[i].value]) {
+          return false;
+        }
+        break;
+      case ColumnKind::FREE:
+        binding[columns[i].value] = row[i];
+        break;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Match a row of N columns: the column loop has a constant trip
+ * count and is unrolled, the arity argument is ignored
+ */
+template <size_t N>
+static bool
+match_fixed(const CompiledColumn *columns, size_t arity, const SymbolId *row,
+            SymbolId *binding) {
+  return match_columns(columns, N, row, binding);
+}
+
+static bool
+match_generic(const CompiledColumn *columns, size_t arity,
+              const SymbolId *row, SymbolId *binding) {
+  return match_columns(columns, arity, row, binding);
+}
+
+template <size_t... Ns>
+static MatchFn
+select_match(size_t arity, std::index_sequence<Ns...>) {
+  static const MatchFn fixed[] = {&match_fixed<Ns>...};
+  return arity < sizeof...(Ns) ? fixed[arity] : &match_generic;
+}
+
+/**
+ * @brief The operation of a built-in predicate, see Atom::is_builtin()
+ */
+BuiltinOp
+get_builtin_op(const std::string &predicate) {
+  static const std::map<std::string, BuiltinOp> OPS = {
+    {"=", BuiltinOp::EQ},  {"!=", BuiltinOp::NE}, {"<", BuiltinOp::LT},
+    {"<=", BuiltinOp::LE}, {">", BuiltinOp::GT},  {">=", BuiltinOp::GE},
+    {"+", BuiltinOp::ADD}, {"-", BuiltinOp::SUB}, {"*", BuiltinOp::MUL},
+    {"/", BuiltinOp::DIV}, {"%", BuiltinOp::MOD}};
+  auto it = OPS.find(predicate);
+  if (it == OPS.end()) {
+    throw std::runtime_error("Not a built-in predicate: " + predicate);
+  }
+  return it->second;
+}
+
+/**
+ * @brief Compare two values. Symbols are only equal or not: order is only
+ * defined between integers.
+ */
+bool
+compare_values(BuiltinOp op, SymbolId lhs, SymbolId rhs) {
+  if (op == BuiltinOp::EQ) {
+    return lhs == rhs;
+  }
+  if (op == BuiltinOp::NE) {
+    return lhs != rhs;
+  }
+  if (!is_number(lhs) || !is_number(rhs)) {
+    return false;
+  }
+  // Ids of integers are ordered as the integers
+  switch (op) {
+    case BuiltinOp::LT:
+      return lhs < rhs;
+    case BuiltinOp::LE:
+      return lhs <= rhs;
+    case BuiltinOp::GT:
+      return lhs > rhs;
+    case BuiltinOp::GE:
+      return lhs >= rhs;
+    default:
+      return false;
+  }
+}
+
+/**
+ * @brief Apply an arithmetic operation to two integers
+ * @returns false when the operation is undefined: on symbols, on division
+ * by zero, or out of the range of integers
+ */
+bool
+compute_value(BuiltinOp op, SymbolId lhs, SymbolId rhs, SymbolId &result) {
+  if (!is_number(lhs) || !is_number(rhs)) {
+    return false;
+  }
+  int64_t a = number_value(lhs);
+  int64_t b = number_value(rhs);
+  int64_t value = 0;
+  switch (op) {
+    case BuiltinOp::ADD:
+      value = a + b;
+      break;
+    case BuiltinOp::SUB:
+      value = a - b;
+      break;
+    case BuiltinOp::MUL:
+      value = a * b;
+      break;
+    case BuiltinOp::DIV:
+    case BuiltinOp::MOD:
+      if (b == 0) {
+        return false;
+      }
+      value = op == BuiltinOp::DIV ? a / b : a % b;
+      break;
+    default:
+      return false;
+  }
+  return make_number(value, result);
+}
+
+static inline SymbolId
+column_value(const CompiledColumn &column, const SymbolId *binding) {
+  return column.kind == ColumnKind::CONSTANT ? column.value
+                                             : binding[column.value];
+}
+
+/**
+ * @brief Evaluate built-in predicates in order, binding the results of
+ * assignments
+ * @returns false as soon as one of them does not hold
+ */
+static bool
+apply_builtins(const std::vector<CompiledBuiltin> &builtins,
+               SymbolId *binding) {
+  for (const CompiledBuiltin &builtin : builtins) {
+    SymbolId lhs = column_value(builtin.operands[0], binding);
+    SymbolId rhs = column_value(builtin.operands[1], binding);
+    if (builtin.op < BuiltinOp::ASSIGN) {
+      if (!compare_values(builtin.op, lhs, rhs)) {
+        return false;
+      }
+      continue;
+    }
+    SymbolId value = lhs;
+    if (builtin.op != BuiltinOp::ASSIGN
+        && !compute_value(builtin.op, lhs, rhs, value)) {
+      return false;
+    }
+    if (builtin.result.kind == ColumnKind::FREE) {
+      binding[builtin.result.value] = value;
+    }
+    else if (column_value(builtin.result, binding) != value) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Plan merge joins between consecutive body atoms: the first must
+ * have a single free column, binding a variable that the second, whose
+ * columns are otherwise all known, only uses once. The values of that
+ * variable are then the intersection of two sorted index ranges.
+ */
+static void
+plan_merge_joins(CompiledRule &rule) {
+  for (size_t pos = 0; pos + 1 < rule.body.size(); ++pos) {
+    CompiledAtom &atom = rule.body[pos];
+    CompiledAtom &next = rule.body[pos + 1];
+    if (atom.relation->get_classes() != nullptr
+        || next.relation->get_classes() != nullptr) {
+      continue;
+    }
+    std::vector<size_t> order;
+    size_t free_column = atom.columns.size();
+    for (size_t i = 0; i < atom.columns.size(); ++i) {
+      if (atom.bound_mask & (1ULL << i)) {
+        order.push_back(i);
+      }
+      else if (atom.columns[i].kind == ColumnKind::FREE
+               && free_column == atom.columns.size()) {
+        free_column = i;
+      }
+      else {
+        free_column = atom.columns.size() + 1;
+      }
+    }
+    if (free_column >= atom.columns.size()) {
+      continue;
+    }
+    order.push_back(free_column);
+    uint32_t slot = atom.columns[free_column].value;
+    std::vector<size_t> next_order;
+    size_t shared_column = next.columns.size();
+    bool known = true;
+    for (size_t i = 0; i < next.columns.size(); ++i) {
+      known = known && (next.bound_mask & (1ULL << i));
+      if (next.columns[i].kind != ColumnKind::BOUND
+          || next.columns[i].value != slot) {
+        next_order.push_back(i);
+      }
+      else if (shared_column == next.columns.size()) {
+        shared_column = i;
+      }
+      else {
+        known = false;
+      }
+    }
+    if (!known || shared_column == next.columns.size()) {
+      continue;
+    }
+    next_order.push_back(shared_column);
+    atom.merge_order = order;
+    atom.next_merge_order = next_order;
+  }
+}
+
+/**
+ * @brief Plan range scans: a free column of an atom that comparisons bound
+ * by constants, or by variables bound before the atom, is read from the
+ * range of a sorted index instead of being filtered after a full scan. The
+ * comparisons are tested all the same.
+ */
+static void
+plan_range_scans(CompiledRule &rule) {
+  for (CompiledAtom &atom : rule.body) {
+    if (atom.relation->get_classes() != nullptr) {
+      continue;
+    }
+    // Slots are numbered in binding order: lower ones are bound before
+    uint32_t first_free = UINT32_MAX;
+    for (const CompiledColumn &column : atom.columns) {
+      if (column.kind == ColumnKind::FREE) {
+        first_free = std::min(first_free, column.value);
+      }
+    }
+    auto known = [&](const CompiledColumn &column) {
+      return column.kind == ColumnKind::CONSTANT
+             || (column.kind == ColumnKind::BOUND && column.value < first_free);
+    };
+    for (size_t c = 0; c < atom.columns.size() && atom.range_order.empty();
+         ++c) {
+      const CompiledColumn &column = atom.columns[c];
+      if (column.kind != ColumnKind::FREE) {
+        continue;
+      }
+      std::vector<CompiledColumn> low;
+      std::vector<CompiledColumn> high;
+      for (const CompiledBuiltin &builtin : atom.builtins) {
+        if (builtin.op < BuiltinOp::LT || builtin.op > BuiltinOp::GE) {
+          continue;
+        }
+        const CompiledColumn *operands = builtin.operands;
+        bool left = operands[0].kind == ColumnKind::BOUND
+                    && operands[0].value == column.value && known(operands[1]);
+        bool right = operands[1].kind == ColumnKind::BOUND
+                     && operands[1].value == column.value
+                     && known(operands[0]);
+        if (!left && !right) {
+          continue;
+        }
+        // X < Y bounds X from above and Y from below
+        bool less = builtin.op == BuiltinOp::LT || builtin.op == BuiltinOp::LE;
+        (less == left ? high : low).push_back(operands[left ? 1 : 0]);
+      }
+      if (low.empty() && high.empty()) {
+        continue;
+      }
+      for (size_t i = 0; i < atom.columns.size(); ++i) {
+        if (atom.bound_mask & (1ULL << i)) {
+          atom.range_order.push_back(i);
+        }
+      }
+      atom.range_order.push_back(c);
+      for (size_t i = 0; i < atom.columns.size(); ++i) {
+        if (!(atom.bound_mask & (1ULL << i)) && i != c) {
+          atom.range_order.push_back(i);
+        }
+      }
+      atom.range_low = low;
+      atom.range_high = high;
+    }
+  }
+}
+
+// Binding rows per batch in batched evaluation
+static const size_t BATCH_SIZE = 1024;
+// Join inputs beyond this no longer fit in the cache, see join_radix()
+static const size_t RADIX_JOIN_BYTES = 4 << 20;
+// Tuples of a radix join partition, of both inputs, are meant to fit in
+// the L2 cache with the hash table
+static const size_t PARTITION_BYTES = 256 << 10;
+// Partitions are split at most this many ways per pass, so that the
+// partitions written to at once stay within the reach of the TLB
+static const unsigned RADIX_BITS_PER_PASS = 8;
+static const unsigned MAX_RADIX_BITS = 16;
+
+BindingBatch::
+BindingBatch(size_t nvars, size_t capacity)
+  : values(nvars * capacity), capacity(capacity), size(0), selection() {
+  selection.reserve(capacity);
+}
+
+void
+BindingBatch::clear(void) {
+  size = 0;
+  selection.clear();
+}
+
+void
+BindingBatch::append(const std::vector<SymbolId> &binding) {
+  for (size_t s = 0; s < binding.size(); ++s) {
+    values[s * capacity + size] = binding[s];
+  }
+  selection.push_back(static_cast<uint32_t>(size++));
+}
+
+Evaluator::
+Evaluator(Database &db, Program &program)
+  : db(db), rules(), strata(), batched(false), known(), pool(nullptr),
+    radix_min_bytes(RADIX_JOIN_BYTES), partition_bytes(PARTITION_BYTES) {
+  // Atoms of equivalence relations are planned differently
+  for (Atom directive : program.get_directives()) {
+    db.get_relation(directive.get_terms()[0].get_name(), 2).make_equivalence();
+  }
+  for (Rule rule : program.get_rules()) {
+    if (is_fact(rule)) {
+      continue;
+    }
+    std::vector<std::string> vars;
+    std::vector<CompiledAtom> body;
+    std::vector<CompiledBuiltin> builtins;
+    std::vector<Atom> goals = rule.get_goals();
+    std::vector<Atom> pending;
+    for (Atom &goal : goals) {
+      if (goal.is_builtin()) {
+        pending.push_back(goal);
+      }
+    }
+    // Built-in predicates are pushed down to the first atom after which
+    // their operands are bound
+    attach_builtins(pending, vars, builtins);
+    for (Atom &goal : goals) {
+      if (!goal.is_builtin()) {
+        body.push_back(compile_atom(goal, vars, false));
+        attach_builtins(pending, vars, body.back().builtins);
+      }
+    }
+    Atom head = rule.get_head();
+    CompiledAtom chead = compile_atom(head, vars, true);
+    bool safe = pending.empty();
+    for (CompiledColumn &col : chead.columns) {
+      safe = safe && col.kind != ColumnKind::FREE;
+    }
+    if (!safe) {
+      AstPrinter printer;
+      std::cerr << "Skipping unsafe rule " << printer.visit(rule);
+      continue;
+    }
+    rules.push_back(CompiledRule{chead, body, vars.size(), builtins});
+    plan_merge_joins(rules.back());
+    plan_range_scans(rules.back());
+  }
+  plan_strata(program);
+}
+
+static bool
+is_variable(const CompiledColumn &column, ColumnKind kind, uint32_t slot) {
+  return column.kind == kind && column.value == slot;
+}
+
+/**
+ * @brief The edges E when the rules of stratum derive P as the transitive
+ * closure of E, as P(X, Y) :- E(X, Y) and P(X, Z) :- A(X, Y), B(Y, Z) where
+ * A and B are each E or P, at least one of them P. Whichever the recursion,
+ * left, right or both, P is E+ when it starts empty.
+ * @returns nullptr for other rules
+ */
+static Relation *
+find_closure_edges(const std::vector<CompiledRule> &rules,
+                   const Stratum &stratum) {
+  if (stratum.rules.size() != 2 || stratum.relations.size() != 1) {
+    return nullptr;
+  }
+  const CompiledRule *base = nullptr;
+  const CompiledRule *step = nullptr;
+  for (size_t r : stratum.rules) {
+    const CompiledRule &rule = rules[r];
+    (rule.body.size() == 1 ? base : step) = &rule;
+    bool filtered = !rule.builtins.empty();
+    for (const CompiledAtom &atom : rule.body) {
+      filtered = filtered || !atom.builtins.empty();
+    }
+    if (filtered || rule.head.columns.size() != 2) {
+      return nullptr;
+    }
+  }
+  if (base == nullptr || step == nullptr || step->body.size() != 2) {
+    return nullptr;
+  }
+  Relation *closure = stratum.relations[0];
+  Relation *edges = base->body[0].relation;
+  if (edges == closure || closure->get_classes() != nullptr
+      || edges->get_classes() != nullptr) {
+    return nullptr;
+  }
+  // Slots are numbered in order of first occurrence in the body
+  const std::vector<CompiledColumn> &e = base->body[0].columns;
+  const std::vector<CompiledColumn> &a = step->body[0].columns;
+  const std::vector<CompiledColumn> &b = step->body[1].columns;
+  const std::vector<CompiledColumn> &head = base->head.columns;
+  const std::vector<CompiledColumn> &step_head = step->head.columns;
+  bool shaped = is_variable(e[0], ColumnKind::FREE, 0)
+                && is_variable(e[1], ColumnKind::FREE, 1)
+                && is_variable(head[0], ColumnKind::BOUND, 0)
+                && is_variable(head[1], ColumnKind::BOUND, 1)
+                && is_variable(a[0], ColumnKind::FREE, 0)
+                && is_variable(a[1], ColumnKind::FREE, 1)
+                && is_variable(b[0], ColumnKind::BOUND, 1)
+                && is_variable(b[1], ColumnKind::FREE, 2)
+                && is_variable(step_head[0], ColumnKind::BOUND, 0)
+                && is_variable(step_head[1], ColumnKind::BOUND, 2);
+  // Without P in the step the rules are not recursive: P is E ∪ E∘E
+  bool recursive = false;
+  for (const CompiledAtom &atom : step->body) {
+    shaped = shaped && (atom.relation == edges || atom.relation == closure);
+    recursive = recursive || atom.relation == closure;
+  }
+  return shaped && recursive ? edges : nullptr;
+}
+
+/**
+ * @brief Group the rules by strongly connected component of the head
+ * predicates. Components without rules only hold facts and need no stratum.
+ */
+void
+Evaluator::plan_strata(Program &program) {
+  DependencyGraph graph(program);
+  std::vector<size_t> stratum_of(graph.size(), SIZE_MAX);
+  std::vector<std::vector<size_t>> rules_of(graph.size());
+  for (size_t r = 0; r < rules.size(); ++r) {
+    rules_of[graph.get_component(rules[r].head.predicate)].push_back(r);
+  }
+  for (size_t c = 0; c < graph.size(); ++c) {
+    if (rules_of[c].empty()) {
+      continue;
+    }
+    stratum_of[c] = strata.size();
+    Stratum stratum;
+    stratum.rules = rules_of[c];
+    for (size_t input : graph.get_inputs(c)) {
+      if (stratum_of[input] != SIZE_MAX) {
+        stratum.inputs.push_back(stratum_of[input]);
+        strata[stratum_of[input]].dependents.push_back(strata.size());
+      }
+    }
+    for (size_t r : stratum.rules) {
+      Relation *head = rules[r].head.relation;
+      if (std::find(stratum.relations.begin(), stratum.relations.end(), head)
+          == stratum.relations.end()) {
+        stratum.relations.push_back(head);
+      }
+    }
+    stratum.closure_edges = find_closure_edges(rules, stratum);
+    strata.push_back(stratum);
+  }
+}
+
+/**
+ * @brief Resolve the relation and the column kinds of atom.
+ * Variables are numbered in order of first occurrence in vars.
+ */
+CompiledAtom
+Evaluator::compile_atom(Atom &atom, std::vector<std::string> &vars,
+                        bool is_head) {
+  std::vector<Term> terms = atom.get_terms();
+  if (terms.size() > 64) {
+    throw std::runtime_error("Atoms of more than 64 terms are not supported");
+  }
+  CompiledAtom catom{atom.get_predicate(), nullptr, {}, 0, nullptr, nullptr,
+                     {}, {}, {}, {}, {}, {}};
+  catom.relation = &db.get_relation(catom.predicate, terms.size());
+  catom.match = select_match(
+    terms.size(), std::make_index_sequence<MAX_FIXED_ARITY + 1>());
+  for (size_t i = 0; i < terms.size(); ++i) {
+    std::string name = terms[i].get_name();
+    if (terms[i].get_term_type() != TermType::VARIABLE) {
+      SymbolId id = db.get_symbols().intern(name);
+      catom.columns.push_back(CompiledColumn{ColumnKind::CONSTANT, id});
+      catom.bound_mask |= 1ULL << i;
+      continue;
+    }
+    auto var = std::find(vars.begin(), vars.end(), name);
+    uint32_t slot = static_cast<uint32_t>(var - vars.begin());
+    // Every occurrence of _ is a fresh variable
+    if (var == vars.end() || name == "_") {
+      slot = static_cast<uint32_t>(vars.size());
+      if (is_head) {
+        catom.columns.push_back(CompiledColumn{ColumnKind::FREE, slot});
+        continue;
+      }
+      vars.push_back(name);
+      catom.columns.push_back(CompiledColumn{ColumnKind::FREE, slot});
+      continue;
+    }
+    // Repeated variables within the same atom are checked, not probed
+    bool bound_before = true;
+    for (size_t j = 0; j < i; ++j) {
+      if (catom.columns[j].kind == ColumnKind::FREE
+          && catom.columns[j].value == slot) {
+        bound_before = false;
+      }
+    }
+    catom.columns.push_back(CompiledColumn{ColumnKind::BOUND, slot});
+    if (bound_before) {
+      catom.bound_mask |= 1ULL << i;
+    }
+  }
+  return catom;
+}
+
+/**
+ * @brief Compile the built-in predicate atom if its operands are bound by
+ * vars. An equality with one unbound variable is an assignment to it, as
+ * is an arithmetic operation whose result is unbound.
+ * @returns false, leaving builtin undefined, when they are not
+ */
+bool
+Evaluator::compile_builtin(Atom &atom, std::vector<std::string> &vars,
+                           CompiledBuiltin &builtin) {
+  std::vector<Term> terms = atom.get_terms();
+  auto compile_term = [&](Term &term, CompiledColumn &column) {
+    std::string name = term.get_name();
+    if (term.get_term_type() != TermType::VARIABLE) {
+      column = CompiledColumn{ColumnKind::CONSTANT,
+                              db.get_symbols().intern(name)};
+      return true;
+    }
+    auto var = std::find(vars.begin(), vars.end(), name);
+    column = CompiledColumn{ColumnKind::BOUND,
+                            static_cast<uint32_t>(var - vars.begin())};
+    return var != vars.end() && name != "_";
+  };
+  auto bind_term = [&](Term &term, CompiledColumn &column) {
+    column = CompiledColumn{ColumnKind::FREE,
+                            static_cast<uint32_t>(vars.size())};
+    vars.push_back(term.get_name());
+  };
+  builtin.op = get_builtin_op(atom.get_predicate());
+  builtin.result = CompiledColumn{ColumnKind::CONSTANT, 0};
+  if (terms.size() == 3) {
+    if (!compile_term(terms[1], builtin.operands[0])
+        || !compile_term(terms[2], builtin.operands[1])) {
+      return false;
+    }
+    if (!compile_term(terms[0], builtin.result)) {
+      bind_term(terms[0], builtin.result);
+    }
+    return true;
+  }
+  bool left = compile_term(terms[0], builtin.operands[0]);
+  bool right = compile_term(terms[1], builtin.operands[1]);
+  if (left && right) {
+    return true;
+  }
+  if (builtin.op != BuiltinOp::EQ || (!left && !right)) {
+    return false;
+  }
+  builtin.op = BuiltinOp::ASSIGN;
+  if (!left) {
+    builtin.operands[0] = builtin.operands[1];
+  }
+  builtin.operands[1] = builtin.operands[0];
+  bind_term(terms[left ? 1 : 0], builtin.result);
+  return true;
+}
+
+/**
+ * @brief Move to builtins the built-in predicates of pending whose operands
+ * are bound by vars, including by the assignments among them
+ */
+void
+Evaluator::attach_builtins(std::vector<Atom> &pending,
+                           std::vector<std::string> &vars,
+                           std::vector<CompiledBuiltin> &builtins) {
+  bool attached = true;
+  while (attached) {
+    attached = false;
+    for (size_t i = 0; i < pending.size() && !attached; ++i) {
+      CompiledBuiltin builtin;
+      if (compile_builtin(pending[i], vars, builtin)) {
+        builtins.push_back(builtin);
+        pending.erase(pending.begin() + i);
+        attached = true;
+      }
+    }
+  }
+}
+
+/**
+ * @brief Rows of the atom at pos that are visible when the atom at delta_pos
+ * scans the delta
+ */
+static std::pair<size_t, size_t>
+visible_rows(const CompiledAtom &atom, size_t pos, size_t delta_pos) {
+  size_t lo = pos == delta_pos ? atom.round->first : 0;
+  size_t hi = pos < delta_pos ? atom.round->first : atom.round->second;
+  return std::make_pair(lo, hi);
+}
+
+static bool
+sees_all_rows(const CompiledAtom &atom, size_t pos, size_t delta_pos) {
+  std::pair<size_t, size_t> rows = visible_rows(atom, pos, delta_pos);
+  return rows.first == 0 && rows.second == atom.relation->size();
+}
+
+/**
+ * @brief Bind the free variable of the unary atom at pos to the members of
+ * its relation that are also members of the unary atoms right after it on
+ * the same variable, intersecting their bitmaps instead of probing each
+ * value.
+ * @returns false, having done nothing, when no such atom follows
+ */
+bool
+Evaluator::join_members(CompiledRule &rule, size_t pos, size_t delta_pos,
+                        std::vector<SymbolId> &binding,
+                        std::vector<SymbolId> &derived) {
+  uint32_t slot = rule.body[pos].columns[0].value;
+  const RoaringBitmap *members = rule.body[pos].relation->get_members();
+  RoaringBitmap intersection;
+  size_t next = pos + 1;
+  for (; next < rule.body.size(); ++next) {
+    CompiledAtom &filter = rule.body[next];
+    if (filter.columns.size() != 1
+        || filter.columns[0].kind != ColumnKind::BOUND
+        || filter.columns[0].value != slot
+        || !sees_all_rows(filter, next, delta_pos)) {
+      break;
+    }
+    intersection = members->intersect(*filter.relation->get_members());
+    members = &intersection;
+  }
+  if (next == pos + 1) {
+    return false;
+  }
+  std::vector<SymbolId> values;
+  members->to_vector(values);
+  for (SymbolId value : values) {
+    binding[slot] = value;
+    if (apply_builtins(rule.body[pos].builtins, binding.data())) {
+      join(rule, next, delta_pos, binding, derived);
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Append to out the last column, in the sorted index of order, of the
+ * rows of atom that match its other, known, columns
+ */
+static void
+sorted_values(const CompiledAtom &atom, const std::vector<size_t> &order,
+              const std::vector<SymbolId> &binding,
+              std::vector<SymbolId> &out) {
+  SymbolId key[64];
+  size_t nkey = order.size() - 1;
+  for (size_t i = 0; i < nkey; ++i) {
+    const CompiledColumn &col = atom.columns[order[i]];
+    key[i] = col.kind == ColumnKind::CONSTANT ? col.value : binding[col.value];
+  }
+  const BTreeIndex &tree = atom.relation->get_sorted_index(order).get_tree();
+  BTreeIndex::Iterator end = tree.upper_bound(key, nkey);
+  for (BTreeIndex::Iterator it = tree.lower_bound(key, nkey); it != end;
+       ++it) {
+    out.push_back((*it)[nkey]);
+  }
+}
+
+/**
+ * @brief Merge join of the atom at pos with the next one, as planned by
+ * plan_merge_joins(): the values of their shared variable are the
+ * intersection of the two sorted index ranges.
+ * @returns false, having done nothing, when either atom must only see part
+ * of its relation's rows
+ */
+bool
+Evaluator::join_sorted(CompiledRule &rule, size_t pos, size_t delta_pos,
+                       std::vector<SymbolId> &binding,
+                       std::vector<SymbolId> &derived) {
+  CompiledAtom &atom = rule.body[pos];
+  CompiledAtom &next = rule.body[pos + 1];
+  if (!sees_all_rows(atom, pos, delta_pos)
+      || !sees_all_rows(next, pos + 1, delta_pos)) {
+    return false;
+  }
+  std::vector<SymbolId> left;
+  std::vector<SymbolId> right;
+  sorted_values(atom, atom.merge_order, binding, left);
+  sorted_values(next, atom.next_merge_order, binding, right);
+  std::vector<SymbolId> values(std::min(left.size(), right.size()));
+  values.resize(intersect_sorted(left.data(), left.size(), right.data(),
+                                 right.size(), values.data()));
+  uint32_t slot = atom.columns[atom.merge_order.back()].value;
+  for (SymbolId value : values) {
+    binding[slot] = value;
+    if (apply_builtins(atom.builtins, binding.data())
+        && apply_builtins(next.builtins, binding.data())) {
+      join(rule, pos + 2, delta_pos, binding, derived);
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Scan the atom at pos over the range of a sorted index, as planned
+ * by plan_range_scans(): its known columns are the prefix of the index, its
+ * bounded column is between the tightest of its bounds
+ * @returns false, having done nothing, when the atom must only see part of
+ * its relation's rows
+ */
+bool
+Evaluator::join_range(CompiledRule &rule, size_t pos, size_t delta_pos,
+                      std::vector<SymbolId> &binding,
+                      std::vector<SymbolId> &derived) {
+  CompiledAtom &atom = rule.body[pos];
+  if (!sees_all_rows(atom, pos, delta_pos)) {
+    return false;
+  }
+  size_t arity = atom.columns.size();
+  SymbolId low[64];
+  SymbolId high[64];
+  size_t nkey = 0;
+  for (; atom.bound_mask & (1ULL << atom.range_order[nkey]); ++nkey) {
+    low[nkey] = column_value(atom.columns[atom.range_order[nkey]],
+                             binding.data());
+    high[nkey] = low[nkey];
+  }
+  // Only integers are ordered, and their ids sort after those of symbols
+  low[nkey] = NUMBER_TAG;
+  high[nkey] = UINT32_MAX;
+  for (const CompiledColumn &column : atom.range_low) {
+    SymbolId value = column_value(column, binding.data());
+    if (!is_number(value)) {
+      return true;
+    }
+    low[nkey] = std::max(low[nkey], value);
+  }
+  for (const CompiledColumn &column : atom.range_high) {
+    SymbolId value = column_value(column, binding.data());
+    if (!is_number(value)) {
+      return true;
+    }
+    high[nkey] = std::min(high[nkey], value);
+  }
+  if (low[nkey] > high[nkey]) {
+    return true;
+  }
+  const BTreeIndex &tree
+    = atom.relation->get_sorted_index(atom.range_order).get_tree();
+  SymbolId row[64];
+  BTreeIndex::Iterator end = tree.upper_bound(high, nkey + 1);
+  for (BTreeIndex::Iterator it = tree.lower_bound(low, nkey + 1); it != end;
+       ++it) {
+    for (size_t i = 0; i < arity; ++i) {
+      row[atom.range_order[i]] = (*it)[i];
+    }
+    if (atom.match(atom.columns.data(), arity, row, binding.data())
+        && apply_builtins(atom.builtins, binding.data())) {
+      join(rule, pos + 1, delta_pos, binding, derived);
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Call f on each pair of the equivalence relation of atom that has
+ * the values of its known columns. Pairs are enumerated from the classes:
+ * those of a known value are its class, the others those of every class.
+ */
+template <class F>
+static void
+for_each_equivalent(const CompiledAtom &atom, const SymbolId *binding, F f) {
+  const EquivalenceClasses *classes = atom.relation->get_classes();
+  bool known[2];
+  SymbolId row[2];
+  for (size_t i = 0; i < 2; ++i) {
+    known[i] = atom.bound_mask & (1ULL << i);
+    row[i] = known[i] ? column_value(atom.columns[i], binding) : 0;
+  }
+  if (known[0] && known[1]) {
+    if (classes->same(row[0], row[1])) {
+      f(row);
+    }
+    return;
+  }
+  if (known[0] || known[1]) {
+    size_t free = known[0] ? 1 : 0;
+    classes->for_each_member(row[1 - free], [&](SymbolId member) {
+      row[free] = member;
+      f(row);
+    });
+    return;
+  }
+  classes->for_each_class([&](SymbolId representative) {
+    classes->for_each_member(representative, [&](SymbolId first) {
+      row[0] = first;
+      classes->for_each_member(representative, [&](SymbolId second) {
+        row[1] = second;
+        f(row);
+      });
+    });
+  });
+}
+
+/**
+ * @brief Enumerate the bindings of the body atoms from pos onwards.
+ * Atoms before delta_pos only see the rows known before the last round, the
+ * atom at delta_pos only the rows derived in the last round. Atoms of
+ * equivalence relations see every pair as soon as they see any new one,
+ * which derives some tuples again but none that does not hold.
+ */
+void
+Evaluator::join(CompiledRule &rule, size_t pos, size_t delta_pos,
+                std::vector<SymbolId> &binding,
+                std::vector<SymbolId> &derived) {
+  if (pos == rule.body.size()) {
+    if (rule.head.columns.empty()) {
+      derived.push_back(0);
+    }
+    for (CompiledColumn &col : rule.head.columns) {
+      derived.push_back(col.kind == ColumnKind::CONSTANT ? col.value
+                                                         : binding[col.value]);
+    }
+    return;
+  }
+  CompiledAtom &atom = rule.body[pos];
+  Relation *rel = atom.relation;
+  std::pair<size_t, size_t> visible = visible_rows(atom, pos, delta_pos);
+  size_t lo = visible.first;
+  size_t hi = visible.second;
+  if (lo >= hi) {
+    return;
+  }
+  if (rel->get_classes() != nullptr) {
+    for_each_equivalent(atom, binding.data(), [&](const SymbolId *row) {
+      if (atom.match(atom.columns.data(), 2, row, binding.data())
+          && apply_builtins(atom.builtins, binding.data())) {
+        join(rule, pos + 1, delta_pos, binding, derived);
+      }
+    });
+    return;
+  }
+  size_t arity = atom.columns.size();
+  SymbolId key[64];
+  // Rows of compressed relations are decoded here
+  SymbolId row_buffer[64];
+  size_t nkey = 0;
+  for (size_t i = 0; i < arity; ++i) {
+    if (atom.bound_mask & (1ULL << i)) {
+      key[nkey++] = atom.columns[i].kind == ColumnKind::CONSTANT
+                      ? atom.columns[i].value
+                      : binding[atom.columns[i].value];
+    }
+  }
+  // A unary atom that sees every row of its relation is a test on its bitmap
+  if (arity == 1 && lo == 0 && hi == rel->size()) {
+    if (atom.bound_mask != 0) {
+      if (rel->get_members()->contains(key[0])
+          && apply_builtins(atom.builtins, binding.data())) {
+        join(rule, pos + 1, delta_pos, binding, derived);
+      }
+      return;
+    }
+    if (join_members(rule, pos, delta_pos, binding, derived)) {
+      return;
+    }
+  }
+  if (!atom.merge_order.empty()
+      && join_sorted(rule, pos, delta_pos, binding, derived)) {
+    return;
+  }
+  if (!atom.range_order.empty()
+      && join_range(rule, pos, delta_pos, binding, derived)) {
+    return;
+  }
+  const std::vector<uint32_t> *candidates = nullptr;
+  if (atom.bound_mask != 0) {
+    candidates = rel->probe(atom.bound_mask, key);
+    if (candidates == nullptr) {
+      return;
+    }
+  }
+  size_t idx = 0;
+  size_t end = hi - lo;
+  if (candidates != nullptr) {
+    idx = std::lower_bound(candidates->begin(), candidates->end(), lo)
+          - candidates->begin();
+    end = candidates->size();
+  }
+  for (; idx < end; ++idx) {
+    size_t row_idx = candidates != nullptr ? (*candidates)[idx] : lo + idx;
+    if (row_idx >= hi) {
+      break;
+    }
+    const SymbolId *row = rel->get_row(row_idx, row_buffer);
+    if (atom.match(atom.columns.data(), arity, row, binding.data())
+        && apply_builtins(atom.builtins, binding.data())) {
+      join(rule, pos + 1, delta_pos, binding, derived);
+    }
+  }
+}
+
+/**
+ * @brief Batched counterpart of join(): the atom at pos consumes the live
+ * rows of in and passes full batches of extended bindings on in
+ * outputs[pos]. An atom whose columns are all known is a filter and only
+ * narrows the selection vector of in. Recursion is per batch rather than per
+ * binding, so the loops over rows run without interruption.
+ */
+void
+Evaluator::join_batch(CompiledRule &rule, size_t pos, size_t delta_pos,
+                      BindingBatch &in, std::vector<BindingBatch> &outputs,
+                      std::vector<SymbolId> &derived) {
+  if (in.selection.empty()) {
+    return;
+  }
+  if (pos == rule.body.size()) {
+    for (uint32_t r : in.selection) {
+      if (rule.head.columns.empty()) {
+        derived.push_back(0);
+      }
+      for (CompiledColumn &col : rule.head.columns) {
+        derived.push_back(col.kind == ColumnKind::CONSTANT
+                            ? col.value
+                            : in.values[col.value * in.capacity + r]);
+      }
+    }
+    return;
+  }
+  CompiledAtom &atom = rule.body[pos];
+  Relation *rel = atom.relation;
+  std::pair<size_t, size_t> visible = visible_rows(atom, pos, delta_pos);
+  size_t lo = visible.first;
+  size_t hi = visible.second;
+  if (lo >= hi) {
+    return;
+  }
+  size_t arity = atom.columns.size();
+  SymbolId key[64];
+  SymbolId row_buffer[64];
+  std::vector<SymbolId> binding(rule.nvars);
+  bool all_known = arity == 64 || atom.bound_mask == (1ULL << arity) - 1;
+  bool all_rows = lo == 0 && hi == rel->size();
+
+  if (all_known && all_rows && atom.builtins.empty()) {
+    // Filter: a membership test per live row, without copying rows
+    size_t nselected = 0;
+    for (uint32_t r : in.selection) {
+      for (size_t i = 0; i < arity; ++i) {
+        const CompiledColumn &col = atom.columns[i];
+        key[i] = col.kind == ColumnKind::CONSTANT
+                   ? col.value
+                   : in.values[col.value * in.capacity + r];
+      }
+      in.selection[nselected] = r;
+      nselected += rel->contains(key) ? 1 : 0;
+    }
+    in.selection.resize(nselected);
+    join_batch(rule, pos + 1, delta_pos, in, outputs, derived);
+    return;
+  }
+
+  BindingBatch &out = outputs[pos];
+  out.clear();
+  // Extend the binding with a matching row, passing on full batches
+  auto extend = [&](const SymbolId *row) {
+    if (!atom.match(atom.columns.data(), arity, row, binding.data())
+        || !apply_builtins(atom.builtins, binding.data())) {
+      return;
+    }
+    out.append(binding);
+    if (out.size == out.capacity) {
+      join_batch(rule, pos + 1, delta_pos, out, outputs, derived);
+      out.clear();
+    }
+  };
+  for (uint32_t r : in.selection) {
+    for (size_t s = 0; s < rule.nvars; ++s) {
+      binding[s] = in.values[s * in.capacity + r];
+    }
+    if (rel->get_classes() != nullptr) {
+      for_each_equivalent(atom, binding.data(), extend);
+      continue;
+    }
+    size_t nkey = 0;
+    for (size_t i = 0; i < arity; ++i) {
+      if (atom.bound_mask & (1ULL << i)) {
+        key[nkey++] = atom.columns[i].kind == ColumnKind::CONSTANT
+                        ? atom.columns[i].value
+                        : binding[atom.columns[i].value];
+      }
+    }
+    const std::vector<uint32_t> *candidates = nullptr;
+    if (atom.bound_mask != 0) {
+      candidates = rel->probe(atom.bound_mask, key);
+      if (candidates == nullptr) {
+        continue;
+      }
+    }
+    size_t idx = 0;
+    size_t end = hi - lo;
+    if (candidates != nullptr) {
+      idx = std::lower_bound(candidates->begin(), candidates->end(), lo)
+            - candidates->begin();
+      end = candidates->size();
+    }
+    for (; idx < end; ++idx) {
+      size_t row_idx = candidates != nullptr ? (*candidates)[idx] : lo + idx;
+      if (row_idx >= hi) {
+        break;
+      }
+      extend(rel->get_row(row_idx, row_buffer));
+    }
+  }
+  join_batch(rule, pos + 1, delta_pos, out, outputs, derived);
+  out.clear();
+}
+
+/**
+ * @brief Tuples of one input of a radix join: the hash of the join key of
+ * each and its width values, grouped in partitions by the top bits of the
+ * hash
+ */
+struct RadixInput {
+  size_t width;
+  std::vector<uint64_t> hashes;
+  std::vector<SymbolId> values;
+  // Partition p holds tuples [bounds[p], bounds[p + 1])
+  std::vector<size_t> bounds;
+};
+
+/**
+ * @brief Split each partition of input 2^bits ways by the bits of the
+ * hashes from shift up, keeping the tuples of a partition in their order
+ */
+static void
+radix_pass(RadixInput &input, unsigned shift, unsigned bits) {
+  size_t fanout = size_t(1) << bits;
+  size_t width = input.width;
+  std::vector<uint64_t> hashes(input.hashes.size());
+  std::vector<SymbolId> values(input.values.size());
+  std::vector<size_t> bounds;
+  bounds.reserve((input.bounds.size() - 1) * fanout + 1);
+  std::vector<size_t> next(fanout);
+  for (size_t p = 0; p + 1 < input.bounds.size(); ++p) {
+    size_t begin = input.bounds[p];
+    size_t end = input.bounds[p + 1];
+    std::fill(next.begin(), next.end(), 0);
+    for (size_t i = begin; i < end; ++i) {
+      ++next[(input.hashes[i] >> shift) & (fanout - 1)];
+    }
+    size_t offset = begin;
+    for (size_t f = 0; f < fanout; ++f) {
+      bounds.push_back(offset);
+      size_t count = next[f];
+      next[f] = offset;
+      offset += count;
+    }
+    for (size_t i = begin; i < end; ++i) {
+      size_t to = next[(input.hashes[i] >> shift) & (fanout - 1)]++;
+      hashes[to] = input.hashes[i];
+      std::copy(input.values.begin() + i * width,
+                input.values.begin() + (i + 1) * width,
+                values.begin() + to * width);
+    }
+  }
+  bounds.push_back(input.hashes.size());
+  input.hashes.swap(hashes);
+  input.values.swap(values);
+  input.bounds.swap(bounds);
+}
+
+/**
+ * @brief Join partition p of the bindings of the first atom of rule with
+ * the same partition of the rows of the second, through a hash table of the
+ * rows, and append the head tuples to derived
+ */
+static void
+join_partition(const CompiledRule &rule, const RadixInput &outer,
+               const RadixInput &inner, size_t p,
+               std::vector<uint32_t> &table, std::vector<SymbolId> &binding,
+               std::vector<SymbolId> &derived) {
+  const CompiledAtom &atom = rule.body[1];
+  size_t begin = inner.bounds[p];
+  size_t count = inner.bounds[p + 1] - begin;
+  if (count == 0 || outer.bounds[p] == outer.bounds[p + 1]) {
+    return;
+  }
+  size_t nslots = 16;
+  while (nslots < 2 * count) {
+    nslots *= 2;
+  }
+  size_t mask = nslots - 1;
+  // Slots hold the rows of the partition plus one, 0 when empty
+  table.assign(nslots, 0);
+  for (size_t i = 0; i < count; ++i) {
+    size_t slot = inner.hashes[begin + i] & mask;
+    while (table[slot] != 0) {
+      slot = (slot + 1) & mask;
+    }
+    table[slot] = static_cast<uint32_t>(i + 1);
+  }
+  for (size_t o = outer.bounds[p]; o < outer.bounds[p + 1]; ++o) {
+    uint64_t hash = outer.hashes[o];
+    std::copy(outer.values.begin() + o * outer.width,
+              outer.values.begin() + (o + 1) * outer.width, binding.begin());
+    for (size_t slot = hash & mask; table[slot] != 0;
+         slot = (slot + 1) & mask) {
+      size_t i = begin + table[slot] - 1;
+      if (inner.hashes[i] != hash
+          || !atom.match(atom.columns.data(), inner.width,
+                         inner.values.data() + i * inner.width,
+                         binding.data())
+          || !apply_builtins(atom.builtins, binding.data())) {
+        continue;
+      }
+      if (rule.head.columns.empty()) {
+        derived.push_back(0);
+      }
+      for (const CompiledColumn &col : rule.head.columns) {
+        derived.push_back(col.kind == ColumnKind::CONSTANT ? col.value
+                                                           : binding[col.value]);
+      }
+    }
+  }
+}
+
+/**
+ * @brief Radix join of the two atoms of rule, when the visible rows of both
+ * exceed radix_min_bytes. The bindings of the first atom and the rows of the
+ * second are partitioned on the hash of the join key, in passes of at most
+ * RADIX_BITS_PER_PASS bits, until partitions are of about partition_bytes;
+ * each partition is then joined through its own small hash table, in place
+ * of probes all over the index of the second atom. Partitions are joined
+ * concurrently on the pool of run(ThreadPool &), serially outside of it.
+ * @returns false, having done nothing, when the rule is not a join of two
+ * atoms of this size on some columns
+ */
+bool
+Evaluator::join_radix(CompiledRule &rule, size_t delta_pos,
+                      const std::vector<SymbolId> &start,
+                      std::vector<SymbolId> &derived) {
+  if (rule.body.size() != 2) {
+    return false;
+  }
+  CompiledAtom &first = rule.body[0];
+  CompiledAtom &second = rule.body[1];
+  size_t arity = second.columns.size();
+  if (first.bound_mask != 0 || second.bound_mask == 0 || arity < 2
+      || first.columns.size() < 2 || !first.merge_order.empty()
+      || !first.range_order.empty() || !second.range_order.empty()
+      || first.relation->get_classes() != nullptr
+      || second.relation->get_classes() != nullptr) {
+    return false;
+  }
+  std::pair<size_t, size_t> outer_rows = visible_rows(first, 0, delta_pos);
+  std::pair<size_t, size_t> inner_rows = visible_rows(second, 1, delta_pos);
+  size_t outer_bytes = (outer_rows.second - outer_rows.first)
+                       * first.columns.size() * sizeof(SymbolId);
+  size_t inner_bytes
+    = (inner_rows.second - inner_rows.first) * arity * sizeof(SymbolId);
+  if (outer_bytes <= radix_min_bytes || inner_bytes <= radix_min_bytes) {
+    return false;
+  }
+  std::vector<size_t> key_columns;
+  for (size_t i = 0; i < arity; ++i) {
+    if (second.bound_mask & (1ULL << i)) {
+      key_columns.push_back(i);
+    }
+  }
+  SymbolId key[64];
+  SymbolId row_buffer[64];
+  std::vector<SymbolId> binding(start);
+
+  RadixInput outer{rule.nvars, {}, {}, {}};
+  for (size_t r = outer_rows.first; r < outer_rows.second; ++r) {
+    const SymbolId *row = first.relation->get_row(r, row_buffer);
+    if (!first.match(first.columns.data(), first.columns.size(), row,
+                     binding.data())
+        || !apply_builtins(first.builtins, binding.data())) {
+      continue;
+    }
+    for (size_t k = 0; k < key_columns.size(); ++k) {
+      key[k] = column_value(second.columns[key_columns[k]], binding.data());
+    }
+    outer.hashes.push_back(hash_values(key, key_columns.size()));
+    outer.values.insert(outer.values.end(), binding.begin(), binding.end());
+  }
+  RadixInput inner{arity, {}, {}, {}};
+  for (size_t r = inner_rows.first; r < inner_rows.second; ++r) {
+    const SymbolId *row = second.relation->get_row(r, row_buffer);
+    for (size_t k = 0; k < key_columns.size(); ++k) {
+      key[k] = row[key_columns[k]];
+    }
+    inner.hashes.push_back(hash_values(key, key_columns.size()));
+    inner.values.insert(inner.values.end(), row, row + arity);
+  }
+
+  unsigned bits = 0;
+  while (bits < MAX_RADIX_BITS
+         && ((outer_bytes + inner_bytes) >> bits) > partition_bytes) {
+    ++bits;
+  }
+  outer.bounds = {0, outer.hashes.size()};
+  inner.bounds = {0, inner.hashes.size()};
+  for (unsigned done = 0; done < bits; done += RADIX_BITS_PER_PASS) {
+    unsigned pass = std::min(bits - done, RADIX_BITS_PER_PASS);
+    radix_pass(outer, 64 - done - pass, pass);
+    radix_pass(inner, 64 - done - pass, pass);
+  }
+
+  size_t npartitions = size_t(1) << bits;
+  ThreadPool serial(1);
+  ThreadPool &workers = pool != nullptr ? *pool : serial;
+  size_t ntasks = std::min(npartitions, 4 * workers.size());
+  std::vector<std::vector<SymbolId>> parts(ntasks);
+  workers.parallel_for(ntasks, [&](size_t t) {
+    std::vector<uint32_t> table;
+    std::vector<SymbolId> task_binding(rule.nvars);
+    for (size_t p = t * npartitions / ntasks;
+         p < (t + 1) * npartitions / ntasks; ++p) {
+      join_partition(rule, outer, inner, p, table, task_binding, parts[t]);
+    }
+  });
+  for (std::vector<SymbolId> &part : parts) {
+    derived.insert(derived.end(), part.begin(), part.end());
+  }
+  return true;
+}
+
+/**
+ * @brief Join two atoms by radix partitioning, see join_radix(), when both
+ * hold more than min_bytes of visible rows, in partitions of about
+ * partition_bytes
+ */
+void
+Evaluator::set_radix_join(size_t min_bytes, size_t partition_bytes) {
+  radix_min_bytes = min_bytes;
+  this->partition_bytes = partition_bytes;
+}
+
+/**
+ * @brief Derive the head tuples of rule with the atom at delta_pos reading
+ * the delta, one binding or one batch of bindings at a time
+ */
+void
+Evaluator::evaluate(CompiledRule &rule, size_t delta_pos,
+                    std::vector<SymbolId> &derived) {
+  std::vector<SymbolId> binding(rule.nvars, 0);
+  if (!apply_builtins(rule.builtins, binding.data())) {
+    return;
+  }
+  if (join_radix(rule, delta_pos, binding, derived)) {
+    return;
+  }
+  if (!batched) {
+    join(rule, 0, delta_pos, binding, derived);
+    return;
+  }
+  // A single binding, of the constant assignments only, to start from
+  BindingBatch start(rule.nvars, 1);
+  start.append(binding);
+  std::vector<BindingBatch> outputs(rule.body.size(),
+                                    BindingBatch(rule.nvars, BATCH_SIZE));
+  join_batch(rule, 0, delta_pos, start, outputs, derived);
+}
+
+/**
+ * @brief Evaluate rules one batch of bindings at a time rather than one
+ * binding at a time; both derive the same tuples
+ */
+void
+Evaluator::set_batched(bool batched) {
+  this->batched = batched;
+}
+
+/**
+ * @brief Declare the first nrows rows of relation already closed under the
+ * rules, as after an earlier run over the same rules, so that run() only
+ * joins the rows added since with the others
+ */
+void
+Evaluator::set_known(const Relation *relation, size_t nrows) {
+  known[relation] = nrows;
+}
+
+/**
+ * @brief Compute the fixpoint of the rules of stratum, whose inputs must be
+ * complete. With spill, relations may spill to disk between rounds.
+ * @returns The number of tuples derived
+ */
+size_t
+Evaluator::run_stratum(Stratum &stratum, bool spill) {
+  // Rows already known would need the rules to be joined with them
+  if (stratum.closure_edges != nullptr && stratum.relations[0]->size() == 0) {
+    Relation *closure = stratum.relations[0];
+    AdjacencyGraph graph(*stratum.closure_edges);
+    ThreadPool serial(1);
+    std::vector<SymbolId> pairs;
+    graph.closure(pool != nullptr ? *pool : serial, pairs);
+    closure->reserve(pairs.size() / 2);
+    size_t nderived = 0;
+    for (size_t i = 0; i < pairs.size(); i += 2) {
+      nderived += closure->insert(pairs.data() + i) ? 1 : 0;
+    }
+    if (spill) {
+      db.enforce_memory_budget();
+    }
+    return nderived;
+  }
+  // In the first round every stored tuple is new, but for the known ones
+  stratum.rounds.clear();
+  for (size_t r : stratum.rules) {
+    for (CompiledAtom &atom : rules[r].body) {
+      auto it = known.find(atom.relation);
+      size_t old = it != known.end() ? it->second : 0;
+      stratum.rounds[atom.relation]
+        = std::make_pair(old, atom.relation->size());
+    }
+  }
+  for (size_t r : stratum.rules) {
+    for (CompiledAtom &atom : rules[r].body) {
+      atom.round = &stratum.rounds[atom.relation];
+    }
+  }
+  size_t nderived = 0;
+  bool changed = true;
+  std::vector<SymbolId> derived;
+  // Rules without atoms only depend on their built-in predicates
+  for (size_t r : stratum.rules) {
+    CompiledRule &rule = rules[r];
+    size_t arity = rule.head.columns.size();
+    if (rule.body.empty()) {
+      derived.clear();
+      evaluate(rule, 0, derived);
+      for (size_t i = 0; i < derived.size(); i += std::max<size_t>(arity, 1)) {
+        nderived += rule.head.relation->insert(derived.data() + i) ? 1 : 0;
+      }
+    }
+  }
+  while (changed) {
+    for (size_t r : stratum.rules) {
+      CompiledRule &rule = rules[r];
+      size_t arity = rule.head.columns.size();
+      for (size_t d = 0; d < rule.body.size(); ++d) {
+        std::pair<size_t, size_t> *round = rule.body[d].round;
+        if (round->first == round->second) {
+          continue;
+        }
+        derived.clear();
+        evaluate(rule, d, derived);
+        for (size_t i = 0; i < derived.size(); i += std::max<size_t>(arity, 1)) {
+          nderived += rule.head.relation->insert(derived.data() + i) ? 1 : 0;
+        }
+      }
+    }
+    changed = false;
+    for (auto &entry : stratum.rounds) {
+      entry.second.first = entry.second.second;
+      entry.second.second = entry.first->size();
+      changed = changed || entry.second.first != entry.second.second;
+    }
+    // Between rounds no rows are being read, so relations may spill
+    if (spill) {
+      db.enforce_memory_budget();
+    }
+  }
+  return nderived;
+}
+
+/**
+ * @brief Compute the fixpoint of the rules over the database, one stratum
+ * after the other
+ * @returns The number of tuples derived
+ */
+size_t
+Evaluator::run(void) {
+  size_t nderived = 0;
+  for (Stratum &stratum : strata) {
+    nderived += run_stratum(stratum, true);
+  }
+  return nderived;
+}
+
+/**
+ * @brief Build the indexes and the duplicate table of relation that the
+ * rules read it through, so that concurrent readers find them up to date
+ * and never modify the relation
+ */
+void
+Evaluator::prepare_reads(Relation *relation) {
+  // Equivalence relations are read through their classes only
+  if (relation->get_classes() != nullptr) {
+    return;
+  }
+  std::vector<SymbolId> zero(relation->get_arity(), 0);
+  relation->contains(zero.data());
+  for (CompiledRule &rule : rules) {
+    for (size_t pos = 0; pos < rule.body.size(); ++pos) {
+      CompiledAtom &atom = rule.body[pos];
+      if (atom.relation == relation && atom.bound_mask != 0) {
+        relation->probe(atom.bound_mask, zero.data());
+      }
+      if (atom.relation == relation && !atom.range_order.empty()) {
+        relation->get_sorted_index(atom.range_order);
+      }
+      if (atom.merge_order.empty()) {
+        continue;
+      }
+      if (atom.relation == relation) {
+        relation->get_sorted_index(atom.merge_order);
+      }
+      if (rule.body[pos + 1].relation == relation) {
+        relation->get_sorted_index(atom.next_merge_order);
+      }
+    }
+  }
+}
+
+/**
+ * @brief Compute the fixpoint of the rules over the database, running each
+ * stratum on pool as soon as the strata it reads are complete. Strata that
+ * do not depend on each other run concurrently; each relation is only
+ * written by the stratum that derives it. Relations spill to disk, if at
+ * all, once every stratum is complete. Transitive closures are searched
+ * and radix joins partitioned on pool too.
+ * @returns The number of tuples derived
+ */
+size_t
+Evaluator::run(ThreadPool &pool) {
+  if (pool.size() == 1) {
+    return run();
+  }
+  this->pool = &pool;
+  for (auto &entry : db.get_relations()) {
+    bool is_derived = false;
+    for (Stratum &stratum : strata) {
+      is_derived = is_derived
+                   || std::find(stratum.relations.begin(),
+                                stratum.relations.end(), entry.second.get())
+                        != stratum.relations.end();
+    }
+    if (!is_derived) {
+      prepare_reads(entry.second.get());
+    }
+  }
+  std::mutex mutex;
+  size_t nderived = 0;
+  std::vector<size_t> waiting(strata.size());
+  std::vector<size_t> ready;
+  for (size_t s = 0; s < strata.size(); ++s) {
+    waiting[s] = strata[s].inputs.size();
+    if (waiting[s] == 0) {
+      ready.push_back(s);
+    }
+  }
+  std::function<void(size_t)> launch = [&](size_t s) {
+    pool.submit([&, s]() {
+      size_t n = run_stratum(strata[s], false);
+      for (Relation *relation : strata[s].relations) {
+        prepare_reads(relation);
+      }
+      std::vector<size_t> next;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        nderived += n;
+        for (size_t d : strata[s].dependents) {
+          if (--waiting[d] == 0) {
+            next.push_back(d);
+          }
+        }
+      }
+      for (size_t d : next) {
+        launch(d);
+      }
+    });
+  };
+  for (size_t s : ready) {
+    launch(s);
+  }
+  try {
+    pool.wait();
+  }
+  catch (...) {
+    this->pool = nullptr;
+    throw;
+  }
+  this->pool = nullptr;
+  db.enforce_memory_budget();
+  return nderived;
+}
+
+const std::vector<CompiledRule> &
+Evaluator::get_rules(void) const {
+  return rules;
+}
+
+const std::vector<Stratum> &
+Evaluator::get_strata(void) const {
+  return strata;
+}
+
+/**
+ * @brief Find the stored tuples matching atom
+ */
+std::vector<Tuple>
+Evaluator::query(Atom &atom) {
+  return match(atom, true);
+}
+
+/**
+ * @brief Find the stored tuples matching atom, as query(), by reading every
+ * row of its relation rather than through an index: the database is only
+ * read, even if the index of its constant columns is missing
+ */
+std::vector<Tuple>
+Evaluator::scan(Atom &atom) {
+  return match(atom, false);
+}
+
+/**
+ * @brief Stored tuples matching atom, through the index of its constant
+ * columns if indexed
+ */
+std::vector<Tuple>
+Evaluator::match(Atom &atom, bool indexed) {
+  Relation *rel = db.find_relation(atom.get_predicate());
+  std::vector<Term> terms = atom.get_terms();
+  if (rel == nullptr || rel->get_arity() != terms.size()) {
+    return {};
+  }
+  // A query of an unknown constant has no answer
+  for (Term &term : terms) {
+    SymbolId id;
+    if (term.get_term_type() != TermType::VARIABLE
+        && !db.get_symbols().lookup(term.get_name(), id)) {
+      return {};
+    }
+  }
+  CompiledRule rule = compile_query(atom);
+  // Members and classes are read without an index
+  if (!indexed && rel->get_arity() > 1 && rel->get_classes() == nullptr) {
+    rule.body[0].bound_mask = 0;
+  }
+  return answer(rule, rel);
+}
+
+/**
+ * @brief Whether query(atom) only reads the database, and so may run
+ * concurrently with other such queries: the index of its constant columns,
+ * if it probes one, is built and current
+ */
+bool
+Evaluator::is_prepared(Atom &atom) {
+  Relation *rel = db.find_relation(atom.get_predicate());
+  std::vector<Term> terms = atom.get_terms();
+  if (rel == nullptr || rel->get_arity() != terms.size() || terms.size() == 1
+      || rel->get_classes() != nullptr) {
+    return true;
+  }
+  uint64_t mask = 0;
+  for (size_t i = 0; i < terms.size(); ++i) {
+    SymbolId id;
+    if (terms[i].get_term_type() == TermType::VARIABLE) {
+      continue;
+    }
+    if (!db.get_symbols().lookup(terms[i].get_name(), id)) {
+      return true;
+    }
+    mask |= 1ULL << i;
+  }
+  return mask == 0 || rel->has_index(mask);
+}
+
+/**
+ * @brief Compile atom as the body of a rule whose head lists the atom's own
+ * columns
+ */
+CompiledRule
+Evaluator::compile_query(Atom &atom) {
+  std::vector<std::string> vars;
+  CompiledAtom catom = compile_atom(atom, vars, false);
+  CompiledRule rule{catom, {catom}, vars.size(), {}};
+  for (size_t i = 0; i < rule.head.columns.size(); ++i) {
+    if (rule.head.columns[i].kind == ColumnKind::FREE) {
+      rule.head.columns[i].kind = ColumnKind::BOUND;
+    }
+  }
+  return rule;
+}
+
+/**
+ * @brief Rows of relation matching the query compiled by compile_query()
+ */
+std::vector<Tuple>
+Evaluator::answer(CompiledRule &rule, Relation *relation) {
+  std::vector<Tuple> answers;
+  std::pair<size_t, size_t> all(relation->size(), relation->size());
+  rule.body[0].round = &all;
+  std::vector<SymbolId> binding(rule.nvars, 0);
+  std::vector<SymbolId> derived;
+  join(rule, 0, rule.body.size(), binding, derived);
+  rule.body[0].round = nullptr;
+  size_t arity = relation->get_arity();
+  if (arity == 0) {
+    answers.resize(derived.size());
+    return answers;
+  }
+  for (size_t i = 0; i < derived.size(); i += arity) {
+    answers.push_back(Tuple(derived.begin() + i, derived.begin() + i + arity));
+  }
+  return answers;
+}
+
+/**
+ * @brief Answers of each of atoms, in order.
+ * Queries of the same predicate and binding pattern, that is differing only
+ * by their constants and the names of their variables, are compiled once
+ * and joined in turn through the index of the bound columns into the same
+ * buffers, so that each costs a probe and its answers; identical queries
+ * are answered once.
+ */
+std::vector<std::vector<Tuple>>
+Evaluator::query(std::vector<Atom> &atoms) {
+  struct Pattern {
+    // Query compiled for the pattern
+    size_t first;
+    // Values of the constants, to the queries that have them
+    std::map<Tuple, std::vector<size_t>> keys;
+  };
+  std::vector<std::vector<Tuple>> answers(atoms.size());
+  std::map<std::string, Pattern> patterns;
+  SymbolTable &symbols = db.get_symbols();
+  for (size_t q = 0; q < atoms.size(); ++q) {
+    std::string pattern = atoms[q].get_predicate() + "(";
+    std::vector<std::string> vars;
+    Tuple key;
+    bool known = true;
+    std::vector<Term> terms = atoms[q].get_terms();
+    for (Term &term : terms) {
+      std::string name = term.get_name();
+      if (term.get_term_type() != TermType::VARIABLE) {
+        SymbolId id = 0;
+        // A query of an unknown constant has no answer
+        known = symbols.lookup(name, id) && known;
+        key.push_back(id);
+        pattern += "#,";
+        continue;
+      }
+      size_t var = std::find(vars.begin(), vars.end(), name) - vars.begin();
+      if (var == vars.size() || name == "_") {
+        var = vars.size();
+        vars.push_back(name);
+      }
+      pattern += std::to_string(var) + ",";
+    }
+    if (known) {
+      auto it = patterns.try_emplace(std::move(pattern), Pattern{q, {}}).first;
+      it->second.keys[std::move(key)].push_back(q);
+    }
+  }
+  for (auto &entry : patterns) {
+    Pattern &pattern = entry.second;
+    Atom &atom = atoms[pattern.first];
+    Relation *rel = db.find_relation(atom.get_predicate());
+    if (rel == nullptr || rel->get_arity() != atom.get_terms().size()) {
+      continue;
+    }
+    // The keys take turns in the constants of the one compiled query,
+    // joined into the same buffers
+    CompiledRule rule = compile_query(atom);
+    std::pair<size_t, size_t> all(rel->size(), rel->size());
+    rule.body[0].round = &all;
+    std::vector<SymbolId> binding(rule.nvars, 0);
+    std::vector<SymbolId> derived;
+    size_t arity = rel->get_arity();
+    for (auto &key : pattern.keys) {
+      for (CompiledAtom *catom : {&rule.head, &rule.body[0]}) {
+        size_t k = 0;
+        for (CompiledColumn &column : catom->columns) {
+          if (column.kind == ColumnKind::CONSTANT) {
+            column.value = key.first[k++];
+          }
+        }
+      }
+      derived.clear();
+      join(rule, 0, rule.body.size(), binding, derived);
+      std::vector<Tuple> &tuples = answers[key.second.back()];
+      if (arity == 0) {
+        tuples.resize(derived.size());
+      }
+      else {
+        tuples.reserve(derived.size() / arity);
+        for (size_t i = 0; i < derived.size(); i += arity) {
+          tuples.emplace_back(derived.begin() + i,
+                              derived.begin() + i + arity);
+        }
+      }
+      for (size_t i = 0; i + 1 < key.second.size(); ++i) {
+        answers[key.second[i]] = tuples;
+      }
+    }
+  }
+  return answers;
+}
@@ -0,0 +1,204 @@
+#ifndef EVALUATOR_HH_INCLUDED
+#define EVALUATOR_HH_INCLUDED
+
+#include "parser.hh"
+#include "relation.hh"
+#include "thread_pool.hh"
+
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * @brief How a column of a body atom is matched, given the variables bound
+ * by the atoms to its left
+ */
+enum class ColumnKind { CONSTANT, BOUND, FREE };
+
+struct CompiledColumn {
+  ColumnKind kind;
+  // SymbolId of a constant, variable slot otherwise
+  uint32_t value;
+};
+
+/**
+ * @brief Built-in predicates, see Atom::is_builtin(). ASSIGN binds a
+ * variable to the other side of an equality.
+ */
+enum class BuiltinOp {
+  EQ,
+  NE,
+  LT,
+  LE,
+  GT,
+  GE,
+  ASSIGN,
+  ADD,
+  SUB,
+  MUL,
+  DIV,
+  MOD
+};
+
+/**
+ * @brief A built-in predicate, evaluated as soon as its operands are bound.
+ * The result of ASSIGN and of arithmetic operations is bound by them when
+ * FREE and compared otherwise; comparisons have no result.
+ */
+struct CompiledBuiltin {
+  BuiltinOp op;
+  CompiledColumn operands[2];
+  CompiledColumn result;
+};
+
+BuiltinOp get_builtin_op(const std::string &predicate);
+bool compare_values(BuiltinOp op, SymbolId lhs, SymbolId rhs);
+bool compute_value(BuiltinOp op, SymbolId lhs, SymbolId rhs,
+                   SymbolId &result);
+
+/**
+ * @brief Match a row against the columns of an atom, binding its free
+ * variables
+ */
+typedef bool (*MatchFn)(const CompiledColumn *columns, size_t arity,
+                        const SymbolId *row, SymbolId *binding);
+
+struct CompiledAtom {
+  std::string predicate;
+  Relation *relation;
+  std::vector<CompiledColumn> columns;
+  // Columns that are known before the atom is scanned
+  uint64_t bound_mask;
+  // Old and delta row ranges of the relation, see Stratum::rounds
+  std::pair<size_t, size_t> *round;
+  // Specialised for the arity of the atom
+  MatchFn match;
+  // Set when the single free column of this atom is merge-joined with the
+  // next atom: the orders of their sorted indexes, with the shared variable
+  // last, see Evaluator::join_sorted()
+  std::vector<size_t> merge_order;
+  std::vector<size_t> next_merge_order;
+  // Built-in predicates whose operands are bound once the atom matched
+  std::vector<CompiledBuiltin> builtins;
+  // Set when comparisons bound a free column by values known before the
+  // atom is scanned: the order of the sorted index to scan, known columns
+  // first and the bounded one next, and the lower and upper bounds
+  std::vector<size_t> range_order;
+  std::vector<CompiledColumn> range_low;
+  std::vector<CompiledColumn> range_high;
+};
+
+struct CompiledRule {
+  CompiledAtom head;
+  std::vector<CompiledAtom> body;
+  size_t nvars;
+  // Built-in predicates of constants only, tested before the first atom
+  std::vector<CompiledBuiltin> builtins;
+};
+
+/**
+ * @brief Rules of one strongly connected component of the predicate
+ * dependency graph, evaluated to a fixpoint once the strata it reads are
+ */
+struct Stratum {
+  std::vector<size_t> rules;
+  std::vector<size_t> inputs;
+  std::vector<size_t> dependents;
+  // Relations derived by the rules
+  std::vector<Relation *> relations;
+  // Per relation read, end of the rows known before the last round (old)
+  // and end of the rows derived in the last round (delta)
+  std::map<Relation *, std::pair<size_t, size_t>> rounds;
+  // Set when the rules derive the transitive closure of these edges, which
+  // is then computed by breadth-first search, see \ref AdjacencyGraph
+  Relation *closure_edges;
+};
+
+/**
+ * @brief Bindings of the variables of a rule for up to a batch of rows,
+ * column by column: variable slot s of row r is values[s * capacity + r].
+ * Only the rows listed in the selection vector are live; filters narrow it
+ * instead of copying the rows that pass.
+ */
+struct BindingBatch {
+  std::vector<SymbolId> values;
+  size_t capacity;
+  size_t size;
+  std::vector<uint32_t> selection;
+
+  BindingBatch(size_t nvars, size_t capacity);
+  void clear(void);
+  void append(const std::vector<SymbolId> &binding);
+};
+
+/**
+ * @brief Bottom-up, semi-naive evaluation of the rules of a \ref Program over
+ * the facts stored in a \ref Database
+ */
+class Evaluator {
+private:
+  Database &db;
+  std::vector<CompiledRule> rules;
+  // In topological order: a stratum only reads the relations derived by
+  // strata before it
+  std::vector<Stratum> strata;
+  // Evaluate rules a batch of bindings at a time, see join_batch()
+  bool batched;
+  // Rows of relations that are a fixpoint of the rules, see set_known()
+  std::map<const Relation *, size_t> known;
+  // Pool of run(ThreadPool &), which transitive closures and radix joins
+  // run on while it runs; nullptr otherwise, when they run serially
+  ThreadPool *pool;
+  // Inputs both larger than this are radix joined, see join_radix()
+  size_t radix_min_bytes;
+  size_t partition_bytes;
+
+  CompiledAtom compile_atom(Atom &atom, std::vector<std::string> &vars,
+                            bool is_head);
+  bool compile_builtin(Atom &atom, std::vector<std::string> &vars,
+                       CompiledBuiltin &builtin);
+  void attach_builtins(std::vector<Atom> &pending,
+                       std::vector<std::string> &vars,
+                       std::vector<CompiledBuiltin> &builtins);
+  void join(CompiledRule &rule, size_t pos, size_t delta_pos,
+            std::vector<SymbolId> &binding, std::vector<SymbolId> &derived);
+  bool join_members(CompiledRule &rule, size_t pos, size_t delta_pos,
+                    std::vector<SymbolId> &binding,
+                    std::vector<SymbolId> &derived);
+  bool join_sorted(CompiledRule &rule, size_t pos, size_t delta_pos,
+                   std::vector<SymbolId> &binding,
+                   std::vector<SymbolId> &derived);
+  bool join_range(CompiledRule &rule, size_t pos, size_t delta_pos,
+                  std::vector<SymbolId> &binding,
+                  std::vector<SymbolId> &derived);
+  void join_batch(CompiledRule &rule, size_t pos, size_t delta_pos,
+                  BindingBatch &in, std::vector<BindingBatch> &outputs,
+                  std::vector<SymbolId> &derived);
+  bool join_radix(CompiledRule &rule, size_t delta_pos,
+                  const std::vector<SymbolId> &start,
+                  std::vector<SymbolId> &derived);
+  void evaluate(CompiledRule &rule, size_t delta_pos,
+                std::vector<SymbolId> &derived);
+  void plan_strata(Program &program);
+  size_t run_stratum(Stratum &stratum, bool spill);
+  CompiledRule compile_query(Atom &atom);
+  std::vector<Tuple> answer(CompiledRule &rule, Relation *relation);
+  std::vector<Tuple> match(Atom &atom, bool indexed);
+
+public:
+  Evaluator(Database &db, Program &program);
+  void set_batched(bool batched);
+  void set_radix_join(size_t min_bytes, size_t partition_bytes);
+  void set_known(const Relation *relation, size_t nrows);
+  void prepare_reads(Relation *relation);
+  size_t run(void);
+  size_t run(ThreadPool &pool);
+  std::vector<Tuple> query(Atom &atom);
+  std::vector<Tuple> scan(Atom &atom);
+  std::vector<std::vector<Tuple>> query(std::vector<Atom> &atoms);
+  bool is_prepared(Atom &atom);
+  const std::vector<CompiledRule> &get_rules(void) const;
+  const std::vector<Stratum> &get_strata(void) const;
+};
+
+#endif
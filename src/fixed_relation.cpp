@@ -0,0 +1,29 @@
+/**
+ * @file fixed_relation.cpp
+ *
+ * Arity-specialised tuple operations
+ */
+
+#include "fixed_relation.hh"
+
+#include <utility>
+
+template <size_t... Ns>
+static const RowOps *
+make_row_ops(std::index_sequence<Ns...>) {
+  // Entry N holds the operations on tuples of arity N
+  static const RowOps ops[] = {
+    RowOps{&TupleOps<Ns>::hash, &TupleOps<Ns>::equal}...};
+  return ops;
+}
+
+/**
+ * @brief Specialised operations for tuples of the given arity
+ * @returns nullptr if arity is above \ref MAX_FIXED_ARITY
+ */
+const RowOps *
+fixed_row_ops(size_t arity) {
+  static const RowOps *ops
+    = make_row_ops(std::make_index_sequence<MAX_FIXED_ARITY + 1>());
+  return arity <= MAX_FIXED_ARITY ? &ops[arity] : nullptr;
+}
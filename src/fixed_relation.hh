@@ -0,0 +1,58 @@
+#ifndef FIXED_RELATION_HH_INCLUDED
+#define FIXED_RELATION_HH_INCLUDED
+
+#include "relation.hh"
+
+#include <cstdint>
+
+/**
+ * @brief Largest arity with specialised tuple operations; wider relations
+ * use the generic, loop based ones
+ */
+const size_t MAX_FIXED_ARITY = 8;
+
+/**
+ * @brief Operations on tuples of N symbols. N is a compile-time constant, so
+ * the loops below are unrolled.
+ */
+template <size_t N> struct TupleOps {
+  static uint64_t hash(const SymbolId *values);
+  static bool equal(const SymbolId *t1, const SymbolId *t2);
+};
+
+/**
+ * @brief Tuple operations of a given arity, resolved once per relation and
+ * called by \ref Relation to hash and compare its rows
+ */
+struct RowOps {
+  uint64_t (*hash)(const SymbolId *values);
+  bool (*equal)(const SymbolId *t1, const SymbolId *t2);
+};
+
+const RowOps *fixed_row_ops(size_t arity);
+
+template <size_t N>
+uint64_t
+TupleOps<N>::hash(const SymbolId *values) {
+  // Same function as hash_values(), with a constant trip count
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < N; ++i) {
+    h = (h ^ values[i]) * 1099511628211ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+template <size_t N>
+bool
+TupleOps<N>::equal(const SymbolId *t1, const SymbolId *t2) {
+  bool equal = true;
+  for (size_t i = 0; i < N; ++i) {
+    equal &= t1[i] == t2[i];
+  }
+  return equal;
+}
+
+#endif
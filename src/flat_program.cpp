@@ -0,0 +1,203 @@
+/**
+ * @file flat_program.cpp
+ *
+ * Flat tables of the terms, atoms and rules of a program
+ */
+
+#include "parser.hh"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+FlatProgram::
+FlatProgram(void)
+  : names(), term_types(), term_names(), term_lengths(), atom_names(),
+    atom_lengths(), atom_terms(), rule_heads(), rule_ends(), directives() {
+}
+
+/**
+ * @brief Empty the tables, keeping their memory for the next program
+ */
+void
+FlatProgram::clear(void) {
+  names.clear();
+  term_types.clear();
+  term_names.clear();
+  term_lengths.clear();
+  atom_names.clear();
+  atom_lengths.clear();
+  atom_terms.clear();
+  rule_heads.clear();
+  rule_ends.clear();
+  directives.clear();
+}
+
+/**
+ * @brief Make room for a program of nliterals literal tokens, each a term
+ * or a predicate, nclauses clauses and nbytes bytes of names
+ */
+void
+FlatProgram::reserve(size_t nliterals, size_t nclauses, size_t nbytes) {
+  names.reserve(nbytes);
+  term_types.reserve(nliterals);
+  term_names.reserve(nliterals);
+  term_lengths.reserve(nliterals);
+  atom_names.reserve(nliterals);
+  atom_lengths.reserve(nliterals);
+  atom_terms.reserve(nliterals);
+  rule_heads.reserve(nclauses);
+  rule_ends.reserve(nclauses);
+}
+
+uint32_t
+FlatProgram::add_name(std::string_view name) {
+  uint32_t offset = static_cast<uint32_t>(names.size());
+  names.append(name.data(), name.size());
+  return offset;
+}
+
+uint32_t
+FlatProgram::add_term(TermType type, std::string_view name) {
+  term_types.push_back(type);
+  term_names.push_back(add_name(name));
+  term_lengths.push_back(static_cast<uint32_t>(name.size()));
+  return static_cast<uint32_t>(term_types.size() - 1);
+}
+
+/**
+ * @brief Add an atom whose terms are those added since first_term
+ */
+uint32_t
+FlatProgram::add_atom(std::string_view predicate, uint32_t first_term) {
+  atom_names.push_back(add_name(predicate));
+  atom_lengths.push_back(static_cast<uint32_t>(predicate.size()));
+  atom_terms.push_back(first_term);
+  return static_cast<uint32_t>(atom_names.size() - 1);
+}
+
+/**
+ * @brief Add a rule of the atom head and of the atoms added since, its
+ * goals
+ */
+void
+FlatProgram::add_rule(uint32_t head) {
+  rule_heads.push_back(head);
+  rule_ends.push_back(static_cast<uint32_t>(atom_names.size()));
+}
+
+void
+FlatProgram::add_directive(uint32_t atom) {
+  directives.push_back(atom);
+}
+
+size_t
+FlatProgram::get_nterms(void) const {
+  return term_types.size();
+}
+
+size_t
+FlatProgram::get_nrules(void) const {
+  return rule_heads.size();
+}
+
+uint32_t
+FlatProgram::get_head(size_t rule) const {
+  return rule_heads[rule];
+}
+
+/**
+ * @brief Whether rule has no goals and a ground head, see ::is_fact()
+ */
+bool
+FlatProgram::is_fact(size_t rule) const {
+  if (rule_ends[rule] != rule_heads[rule] + 1) {
+    return false;
+  }
+  std::pair<uint32_t, uint32_t> terms = get_terms(rule_heads[rule]);
+  for (uint32_t t = terms.first; t < terms.second; ++t) {
+    if (term_types[t] == TermType::VARIABLE) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string_view
+FlatProgram::get_predicate(uint32_t atom) const {
+  return std::string_view(names.data() + atom_names[atom],
+                          atom_lengths[atom]);
+}
+
+/**
+ * @returns The range of the terms of atom
+ */
+std::pair<uint32_t, uint32_t>
+FlatProgram::get_terms(uint32_t atom) const {
+  uint32_t end = atom + 1 < atom_terms.size()
+                   ? atom_terms[atom + 1]
+                   : static_cast<uint32_t>(term_types.size());
+  return std::make_pair(atom_terms[atom], end);
+}
+
+std::string_view
+FlatProgram::get_name(uint32_t term) const {
+  return std::string_view(names.data() + term_names[term],
+                          term_lengths[term]);
+}
+
+TermType
+FlatProgram::get_type(uint32_t term) const {
+  return term_types[term];
+}
+
+const std::vector<uint32_t> &
+FlatProgram::get_directives(void) const {
+  return directives;
+}
+
+Atom
+FlatProgram::to_atom(uint32_t atom) const {
+  std::string predicate(get_predicate(atom));
+  std::pair<uint32_t, uint32_t> range = get_terms(atom);
+  std::vector<Term> terms;
+  terms.reserve(range.second - range.first);
+  for (uint32_t t = range.first; t < range.second; ++t) {
+    std::string name(get_name(t));
+    terms.push_back(Term(name, term_types[t]));
+  }
+  return Atom(predicate, terms);
+}
+
+Rule
+FlatProgram::to_rule(size_t rule) const {
+  Atom head = to_atom(rule_heads[rule]);
+  std::vector<Atom> goals;
+  for (uint32_t a = rule_heads[rule] + 1; a < rule_ends[rule]; ++a) {
+    goals.push_back(to_atom(a));
+  }
+  if (goals.empty()) {
+    return Rule(head);
+  }
+  return Rule(head, goals);
+}
+
+/**
+ * @brief The tree of the program, see \ref Program
+ */
+Program
+FlatProgram::to_program(void) const {
+  std::vector<Rule> rules;
+  rules.reserve(rule_heads.size());
+  for (size_t r = 0; r < rule_heads.size(); ++r) {
+    rules.push_back(to_rule(r));
+  }
+  Program program(rules);
+  for (uint32_t atom : directives) {
+    Atom directive = to_atom(atom);
+    program.add_directive(directive);
+  }
+  return program;
+}
@@ -6,6 +6,7 @@
 
 #include "interpreter.hh"
 #include "ast.hh"
+#include "lexer.hh"
 #include "parser.hh"
 
 #include <algorithm>
@@ -44,8 +45,8 @@ can_unify(EvaluatedTerm &r_term, EvaluatedTerm &q_term) {
   if (r_term.get_name() == q_term.get_name()) {
     return true;
   }
-  if (r_term.get_term_type() == TermType::CONSTANT
-      && q_term.get_term_type() == TermType::CONSTANT) {
+  if (r_term.get_term_type() != TermType::VARIABLE
+      && q_term.get_term_type() != TermType::VARIABLE) {
     return false;
   }
   return true;
@@ -60,11 +61,11 @@ can_unify(EvaluatedTerm &r_term, EvaluatedTerm &q_term) {
 bool
 unify_term(EvaluatedTerm &t1, EvaluatedTerm &t2) {
   // Always have the possibly variable term as the first arg
-  if (t1.get_term_type() == TermType::CONSTANT
+  if (t1.get_term_type() != TermType::VARIABLE
       && t2.get_term_type() == TermType::VARIABLE) {
     return unify_term(t2, t1);
   }
-  else if (t1.get_term_type() == TermType::CONSTANT) {
+  else if (t1.get_term_type() != TermType::VARIABLE) {
     // both are constant
     return t1.get_name() == t2.get_name();
   }
@@ -82,7 +83,7 @@ unify_term(EvaluatedTerm &t1, EvaluatedTerm &t2) {
     EvaluatedTerm t2_chain = t2;
     // till the chain of bound terms for t2 bottoms out, try to find a matching
     // term in the chain for t1
-    while (t2_chain.get_term_type() != TermType::CONSTANT) {
+    while (t2_chain.get_term_type() == TermType::VARIABLE) {
       EvaluatedTerm bound_t1 = t1;
       while (bound_t1.is_bound()) {
         bound_t1 = *bound_t1.get_bound();
@@ -204,6 +205,123 @@ Interpreter::interpret(Program &program, Program &query) {
   return unify_rule(program, q_erule);
 }
 
+Interpreter::
+Interpreter(void)
+  : cache(nullptr) {
+}
+
+/**
+ * @brief Answer the queries through cache from now on, or directly when it
+ * is null
+ */
+void
+Interpreter::set_cache(QueryCache *cache) {
+  this->cache = cache;
+}
+
+/**
+ * @brief Print the answers of a query on predicate, one fact per line.
+ * The order in which facts are derived depends on how the rules were
+ * scheduled, so answers are sorted: the interpreter and the programs
+ * compiled by datalogc print the same lines in the same order.
+ */
+static void
+print_answers(std::ostream &out, Database &db, const std::string &predicate,
+              std::vector<Tuple> &answers) {
+  std::vector<std::string> lines;
+  lines.reserve(answers.size());
+  for (Tuple &tuple : answers) {
+    lines.push_back(db.to_string(predicate, tuple));
+  }
+  std::sort(lines.begin(), lines.end());
+  for (std::string &line : lines) {
+    out << line << "\n";
+  }
+}
+
+/**
+ * @brief Answer query from the relations materialised by evaluator
+ * @param out Stream where each matching fact is printed, in sorted order
+ * @returns true iff the query has at least one answer
+ */
+bool
+Interpreter::answer(Evaluator &evaluator, Database &db, Program &query,
+                    std::ostream &out) {
+  std::vector<Rule> rules = query.get_rules();
+  if (rules.empty()) {
+    return false;
+  }
+  Atom q_head = rules[0].get_head();
+  std::vector<Tuple> answers = cache != nullptr
+                                 ? cache->query(evaluator, db, q_head)
+                                 : evaluator.query(q_head);
+  print_answers(out, db, q_head.get_predicate(), answers);
+  return !answers.empty();
+}
+
+/**
+ * @brief Answer all the queries of a batch at once, see
+ * Evaluator::query(std::vector<Atom> &), printing each query followed by its
+ * answers or False
+ * @returns The number of queries with at least one answer
+ */
+size_t
+Interpreter::answer_all(Evaluator &evaluator, Database &db, Program &queries,
+                        std::ostream &out) {
+  std::vector<Atom> atoms;
+  for (Rule rule : queries.get_rules()) {
+    atoms.push_back(rule.get_head());
+  }
+  std::vector<std::vector<Tuple>> answers = evaluator.query(atoms);
+  size_t nanswered = 0;
+  for (size_t q = 0; q < atoms.size(); ++q) {
+    std::vector<Term> terms = atoms[q].get_terms();
+    out << "?- " << atoms[q].get_predicate() << "(";
+    for (size_t i = 0; i < terms.size(); ++i) {
+      out << (i > 0 ? ", " : "") << terms[i].get_name();
+    }
+    out << ")\n";
+    print_answers(out, db, atoms[q].get_predicate(), answers[q]);
+    if (answers[q].empty()) {
+      out << "False\n";
+    }
+    nanswered += answers[q].empty() ? 0 : 1;
+  }
+  return nanswered;
+}
+
+/**
+ * @brief Answer the queries read from in, one per line, until halt or the
+ * end of the input
+ */
+void
+Interpreter::run_queries(Evaluator &evaluator, Database &db, std::istream &in,
+                         std::ostream &out) {
+  std::string buf;
+  out << "? ";
+  Lexer lexer;
+  std::vector<Token> no_tokens;
+  Parser parser(no_tokens);
+  while (in.good()) {
+    std::getline(in, buf, '\n');
+    std::vector<Token> query_tokens = lexer.run(buf);
+    print_tokens(out, query_tokens);
+    Program query = parser.parse(query_tokens);
+    // print_ast(out, query);
+
+    // Do we need to halt?
+    if (do_halt(query)) {
+      out << "\nHalted.\n";
+      return;
+    }
+
+    if (!answer(evaluator, db, query, out)) {
+      out << "\nFalse\n";
+    }
+    out << "? ";
+  }
+}
+
 bool
 Interpreter::do_halt(Program &query) {
   std::vector<Rule> rules = query.get_rules();
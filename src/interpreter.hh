@@ -2,7 +2,10 @@
 #define INTERPRETER_HH_INCLUDED
 
 #include "ast.hh"
+#include "evaluator.hh"
 #include "parser.hh"
+#include "query_cache.hh"
+#include "relation.hh"
 
 #include <iostream>
 #include <memory>
@@ -75,8 +78,20 @@ public:
 };
 
 class Interpreter {
+private:
+  // Answers of earlier queries, if any
+  QueryCache *cache;
+
 public:
+  Interpreter(void);
+  void set_cache(QueryCache *cache);
   bool interpret(Program &program, Program &query);
+  bool answer(Evaluator &evaluator, Database &db, Program &query,
+              std::ostream &out);
+  size_t answer_all(Evaluator &evaluator, Database &db, Program &queries,
+                    std::ostream &out);
+  void run_queries(Evaluator &evaluator, Database &db, std::istream &in,
+                   std::ostream &out);
   bool do_halt(Program &query);
 };
 
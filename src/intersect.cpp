@@ -0,0 +1,161 @@
+/**
+ * @file intersect.cpp
+ *
+ * Intersection of sorted symbol arrays, the inner loop of merge joins
+ */
+
+#include "intersect.hh"
+
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define INTERSECT_AVX2 1
+#endif
+
+// Size ratio from which galloping beats a linear merge
+static const size_t GALLOP_RATIO = 32;
+
+size_t
+intersect_sorted_scalar(const SymbolId *a, size_t na, const SymbolId *b,
+                        size_t nb, SymbolId *out) {
+  size_t i = 0;
+  size_t j = 0;
+  size_t n = 0;
+  while (i < na && j < nb) {
+    // Branch-free step: both cursors advance past the smaller value
+    SymbolId x = a[i];
+    SymbolId y = b[j];
+    out[n] = x;
+    n += x == y;
+    i += x <= y;
+    j += y <= x;
+  }
+  return n;
+}
+
+/**
+ * @brief Find each symbol of a, the shorter array, in b by exponential then
+ * binary search from the position of the previous one
+ */
+size_t
+intersect_galloping(const SymbolId *a, size_t na, const SymbolId *b,
+                    size_t nb, SymbolId *out) {
+  size_t n = 0;
+  size_t lo = 0;
+  for (size_t i = 0; i < na && lo < nb; ++i) {
+    SymbolId x = a[i];
+    size_t step = 1;
+    size_t hi = lo;
+    while (hi < nb && b[hi] < x) {
+      lo = hi + 1;
+      hi += step;
+      step *= 2;
+    }
+    hi = std::min(hi + 1, nb);
+    lo = std::lower_bound(b + lo, b + hi, x) - b;
+    if (lo < nb && b[lo] == x) {
+      out[n++] = x;
+      ++lo;
+    }
+  }
+  return n;
+}
+
+#ifdef INTERSECT_AVX2
+
+/**
+ * @brief For each 8-bit mask of matching lanes, the lane indexes that move
+ * the matches to the front of a vector
+ */
+struct CompressTable {
+  uint32_t lanes[256][8];
+  CompressTable(void) : lanes() {
+    for (unsigned mask = 0; mask < 256; ++mask) {
+      size_t n = 0;
+      for (uint32_t lane = 0; lane < 8; ++lane) {
+        if (mask & (1U << lane)) {
+          lanes[mask][n++] = lane;
+        }
+      }
+    }
+  }
+};
+
+/**
+ * @brief Compare 8 symbols of a with 8 of b at once: each lane of a is
+ * compared with every lane of b through 7 rotations of b, and the block whose
+ * last symbol is smaller is consumed
+ */
+__attribute__((target("avx2"))) static size_t
+intersect_sorted_avx2(const SymbolId *a, size_t na, const SymbolId *b,
+                      size_t nb, SymbolId *out) {
+  size_t i = 0;
+  size_t j = 0;
+  size_t n = 0;
+  static const CompressTable compress;
+  const size_t capacity = std::min(na, nb);
+  const __m256i rotate = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+  while (i + 8 <= na && j + 8 <= nb) {
+    __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+    __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + j));
+    __m256i hits = _mm256_cmpeq_epi32(va, vb);
+    for (int r = 1; r < 8; ++r) {
+      vb = _mm256_permutevar8x32_epi32(vb, rotate);
+      hits = _mm256_or_si256(hits, _mm256_cmpeq_epi32(va, vb));
+    }
+    unsigned mask = static_cast<unsigned>(
+      _mm256_movemask_ps(_mm256_castsi256_ps(hits)));
+    // Near the end of out, where a full vector does not fit, store the
+    // matches one by one
+    if (n + 8 <= capacity) {
+      __m256i lanes = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(compress.lanes[mask]));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + n),
+                          _mm256_permutevar8x32_epi32(va, lanes));
+      n += __builtin_popcount(mask);
+    }
+    else {
+      for (; mask != 0; mask &= mask - 1) {
+        out[n++] = a[i + __builtin_ctz(mask)];
+      }
+    }
+    SymbolId amax = a[i + 7];
+    SymbolId bmax = b[j + 7];
+    i += amax <= bmax ? 8 : 0;
+    j += bmax <= amax ? 8 : 0;
+  }
+  return n + intersect_sorted_scalar(a + i, na - i, b + j, nb - j, out + n);
+}
+
+typedef size_t (*IntersectFunction)(const SymbolId *, size_t,
+                                    const SymbolId *, size_t, SymbolId *);
+
+static IntersectFunction
+select_intersect(void) {
+  if (__builtin_cpu_supports("avx2")) {
+    return intersect_sorted_avx2;
+  }
+  return intersect_sorted_scalar;
+}
+
+#endif
+
+size_t
+intersect_sorted(const SymbolId *a, size_t na, const SymbolId *b, size_t nb,
+                 SymbolId *out) {
+  if (na > nb) {
+    std::swap(a, b);
+    std::swap(na, nb);
+  }
+  if (na * GALLOP_RATIO < nb) {
+    return intersect_galloping(a, na, b, nb, out);
+  }
+#ifdef INTERSECT_AVX2
+  static const IntersectFunction intersect = select_intersect();
+  return intersect(a, na, b, nb, out);
+#else
+  return intersect_sorted_scalar(a, na, b, nb, out);
+#endif
+}
@@ -0,0 +1,23 @@
+#ifndef INTERSECT_HH_INCLUDED
+#define INTERSECT_HH_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+typedef uint32_t SymbolId;
+
+/**
+ * @brief Intersect the strictly increasing arrays a and b into out, which
+ * must hold min(na, nb) symbols.
+ * Gallops through the longer array when the sizes are skewed, and otherwise
+ * compares blocks of 8 symbols with AVX2 when the CPU supports it.
+ * @returns The number of symbols written to out, in increasing order
+ */
+size_t intersect_sorted(const SymbolId *a, size_t na, const SymbolId *b,
+                        size_t nb, SymbolId *out);
+size_t intersect_sorted_scalar(const SymbolId *a, size_t na,
+                               const SymbolId *b, size_t nb, SymbolId *out);
+size_t intersect_galloping(const SymbolId *a, size_t na, const SymbolId *b,
+                           size_t nb, SymbolId *out);
+
+#endif
@@ -1,10 +1,12 @@
 
 #include "lexer.hh"
+#include "scan.hh"
 
+#include <cstdint>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 #include <ostream>
-#include <sstream>
 
 std::string
 FilePos::to_string(void) const {
@@ -19,8 +21,10 @@ operator<<(std::ostream &stream, const FilePos &fpos) {
 }
 
 Token::
-Token(const TokenType tt, const std::string &lexeme, const FilePos &pos)
-  : type(tt), lexeme(lexeme), file_pos(pos) {
+Token(const TokenType tt, const char *text, uint32_t length, uint32_t line,
+      uint32_t column, uint32_t offset)
+  : text(text), length(length), line(line), column(column), offset(offset),
+    type(tt) {
 }
 
 std::ostream &
@@ -33,8 +37,8 @@ operator<<(std::ostream &stream, const Token &tok) {
   if (tok.type == TokenType::END_OF_FILE) {
     ttype = "EOF";
   }
-  stream << tok.file_pos << " Token(" << ttype << ","
-         << "\"" << tok.lexeme << "\")";
+  stream << tok.get_pos() << " Token(" << ttype << ","
+         << "\"" << tok.get_text() << "\")";
   return stream;
 }
 
@@ -51,7 +55,7 @@ Token::to_string(void) const {
     default:
       s += static_cast<char>(type);
   }
-  return s + ", \"" + lexeme + "\")";
+  return s + ", \"" + get_lexeme() + "\")";
 }
 
 TokenType
@@ -59,19 +63,31 @@ Token::get_type(void) const {
   return this->type;
 }
 
+std::string_view
+Token::get_text(void) const {
+  return std::string_view(text, length);
+}
+
 std::string
 Token::get_lexeme(void) const {
-  return this->lexeme;
+  return std::string(text, length);
 }
 
 FilePos
 Token::get_pos(void) const {
-  return this->file_pos;
+  std::streamoff off
+    = offset == UINT32_MAX ? -1 : static_cast<std::streamoff>(offset);
+  return FilePos(line, column, off);
+}
+
+Lexer::
+Lexer(void)
+  : istream(), input(), state(State::GOOD), tokens(), quiet(false) {
 }
 
 Lexer::
 Lexer(std::string &ifile)
-  : istream(ifile), state(State::GOOD), tokens() {
+  : istream(ifile), input(), state(State::GOOD), tokens(), quiet(false) {
   if (!istream.is_open()) {
     throw ifile;
   }
@@ -90,6 +106,15 @@ Lexer::set_stream(std::ifstream &new_stream) {
   istream = std::move(new_stream);
 }
 
+/**
+ * @brief Do not report how lexing terminated, as when lexing requests that
+ * are answered on their own
+ */
+void
+Lexer::set_quiet(bool quiet) {
+  this->quiet = quiet;
+}
+
 void
 Lexer::reset(void) {
   if (istream.is_open()) {
@@ -100,21 +125,19 @@ Lexer::reset(void) {
   tokens.clear();
 }
 
-State
-add_literal(std::vector<Token> &tokens, std::string &lexeme, FilePos &fpos) {
-  if (lexeme.empty()) {
-    return State::ERROR;
-  }
-  Token literal(TokenType::LITERAL, lexeme, fpos);
-  tokens.push_back(literal);
-  lexeme.clear();
-  return State::GOOD;
+std::vector<Token>
+Lexer::run(std::string &query) {
+  return runLexer(query.data(), query.size(), 1, 0);
 }
 
+/**
+ * @brief Lex a slice of a larger input, which starts at line first_line and
+ * byte offset base of the input
+ */
 std::vector<Token>
-Lexer::run(std::string &query) {
-  std::istringstream stream(query);
-  return runLexer(stream);
+Lexer::run(const char *source, size_t size, size_t first_line,
+           std::streamoff base) {
+  return runLexer(source, size, first_line, base);
 }
 
 std::vector<Token>
@@ -125,69 +148,90 @@ Lexer::run(void) {
 
 std::vector<Token>
 Lexer::runLexer(std::istream &stream) {
+  input.assign(std::istreambuf_iterator<char>(stream),
+               std::istreambuf_iterator<char>());
+  return runLexer(input.data(), input.size(), 1, 0);
+}
+
+/**
+ * @brief Lex source into tokens pointing into it. A literal is the run of
+ * bytes up to the next delimiter, so that it is a slice of source.
+ */
+std::vector<Token>
+Lexer::runLexer(const char *source, size_t size, size_t first_line,
+                std::streamoff base) {
   std::vector<Token> lexer_tokens;
-  char c;
-  size_t line = 1;
-  size_t column = 0;
-  std::string buffer("");
-  stream.get(c);
-  while (stream.good() && !stream.eof()) {
-    FilePos fpos(line, column, stream.tellg());
+  uint32_t line = static_cast<uint32_t>(first_line);
+  uint32_t column = 0;
+  size_t pos = 0;
+  while (pos < size) {
+    // Jump over the identifier bytes up to the next token boundary
+    size_t next = pos + find_delimiter(source + pos, size - pos);
+    uint32_t length = static_cast<uint32_t>(next - pos);
+    const char *literal = source + pos;
+    column += length;
+    if (next == size) {
+      break;
+    }
+    char c = source[next];
+    pos = next + 1;
+    // offsets point past the current character, as tellg() did
+    uint32_t offset = static_cast<uint32_t>(base + pos);
     switch (c) {
       case TokenType::LPAREN:
       case TokenType::RPAREN:
       case TokenType::COMMA:
       case TokenType::MINUS:
-      case TokenType::COLON: {
-        FilePos bufpos(line, column - buffer.length() + 1, stream.tellg());
-        if (buffer.length() > 0
-            && add_literal(lexer_tokens, buffer, bufpos) == State::ERROR) {
-          std::cerr << "[" << line << ":" << column - buffer.length()
-                    << "] Expected literal, found \"\"\n";
-          return lexer_tokens;
+      case TokenType::COLON:
+      case TokenType::LESS:
+      case TokenType::GREATER:
+      case TokenType::EQUAL:
+      case TokenType::BANG:
+      case TokenType::PLUS:
+      case TokenType::STAR:
+      case TokenType::SLASH:
+      case TokenType::PERCENT:
+        if (length > 0) {
+          lexer_tokens.emplace_back(TokenType::LITERAL, literal, length, line,
+                                    column - length + 1, offset);
         }
-        buffer = "";
-        Token tok(static_cast<TokenType>(c), buffer, fpos);
-        lexer_tokens.push_back(tok);
+        lexer_tokens.emplace_back(static_cast<TokenType>(c), source + next, 0,
+                                  line, column, offset);
         ++column;
         break;
-      }
-      case TokenType::DOT: {
-        if (buffer.length() > 0) {
-          Token fact(TokenType::LITERAL, buffer, fpos);
-          lexer_tokens.push_back(fact);
+      case TokenType::DOT:
+        if (length > 0) {
+          lexer_tokens.emplace_back(TokenType::LITERAL, literal, length, line,
+                                    column, offset);
         }
-        buffer = "";
-        Token tok(static_cast<TokenType>(c), ".", fpos);
-        lexer_tokens.push_back(tok);
+        lexer_tokens.emplace_back(TokenType::DOT, source + next, 1, line,
+                                  column, offset);
         ++column;
         break;
-      }
-      case '\n': {
-        if (buffer.length() > 0) {
-          add_literal(lexer_tokens, buffer, fpos);
+      case '\n':
+        if (length > 0) {
+          lexer_tokens.emplace_back(TokenType::LITERAL, literal, length, line,
+                                    column, offset);
         }
         ++line;
         column = 0;
         break;
-      }
       case ' ':
-      case '\r': {
+      case '\r':
+        if (length > 0) {
+          lexer_tokens.emplace_back(TokenType::LITERAL, literal, length, line,
+                                    column, offset);
+        }
         ++column;
         break;
-      }
-      default: {
-        // update the buffer
-        buffer += c;
-        ++column;
-      }
     }
-    stream.get(c);
   }
-  FilePos endPos(line, column, stream.tellg());
-  std::string lexeme("");
-  Token eof(TokenType::END_OF_FILE, lexeme, endPos);
-  lexer_tokens.push_back(eof);
+  // Like a failed tellg(), the end of input has no offset
+  lexer_tokens.emplace_back(TokenType::END_OF_FILE, source + size, 0, line,
+                            column, UINT32_MAX);
+  if (quiet) {
+    return lexer_tokens;
+  }
   if (lexer_tokens.size() == 0 || state == State::ERROR) {
     std::cerr << "Lexing terminated with error\n";
   }
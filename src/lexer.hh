@@ -1,8 +1,11 @@
 #ifndef LEXER_HH_INCLUDED
 #define LEXER_HH_INCLUDED
 
+#include <cstdint>
 #include <fstream>
 #include <ostream>
+#include <string>
+#include <string_view>
 #include <vector>
 
 class FilePos {
@@ -32,19 +35,37 @@ enum TokenType {
   DOT = '.',
   COLON = ':',
   MINUS = '-',
-  COMMA = ','
+  COMMA = ',',
+  LESS = '<',
+  GREATER = '>',
+  EQUAL = '=',
+  BANG = '!',
+  PLUS = '+',
+  STAR = '*',
+  SLASH = '/',
+  PERCENT = '%'
 };
 
+/**
+ * @brief A token, as a slice of the source it was lexed from: the source
+ * must outlive it. Positions are 32-bit; the offset of the end of input is
+ * UINT32_MAX, which \ref FilePos reports as -1.
+ */
 class Token {
 private:
+  const char *text;
+  uint32_t length;
+  uint32_t line;
+  uint32_t column;
+  uint32_t offset;
   TokenType type;
-  std::string lexeme;
-  FilePos file_pos;
 
 public:
-  Token(const TokenType tt, const std::string &lexeme, const FilePos &pos);
+  Token(const TokenType tt, const char *text, uint32_t length, uint32_t line,
+        uint32_t column, uint32_t offset);
   friend std::ostream &operator<<(std::ostream &stream, const Token &tok);
   TokenType get_type(void) const;
+  std::string_view get_text(void) const;
   std::string get_lexeme(void) const;
   FilePos get_pos(void) const;
   std::string to_string(void) const;
@@ -53,17 +74,27 @@ public:
 class Lexer {
 private:
   std::ifstream istream;
+  // Contents of istream, which the tokens of run() point into
+  std::string input;
   State state;
   std::vector<Token> tokens;
+  // Whether how lexing terminated goes unreported
+  bool quiet;
   std::vector<Token> runLexer(std::istream &stream);
+  std::vector<Token> runLexer(const char *source, size_t size,
+                              size_t first_line, std::streamoff base);
   void reset(void);
 
 public:
+  Lexer(void);
   Lexer(std::string &ifile);
   ~Lexer();
   void set_stream(std::ifstream &new_stream);
+  void set_quiet(bool quiet);
   std::vector<Token> run(void);
   std::vector<Token> run(std::string &query);
+  std::vector<Token> run(const char *source, size_t size, size_t first_line,
+                         std::streamoff base);
 };
 
 void print_tokens(std::ostream &stream, const std::vector<Token> tokens);
@@ -0,0 +1,288 @@
+/**
+ * @file loader.cpp
+ *
+ * Parallel loading of knowledge bases
+ */
+
+#include "loader.hh"
+#include "lexer.hh"
+#include "parser.hh"
+#include "relation.hh"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <glob.h>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Inputs smaller than this are not worth splitting
+static const size_t MIN_CHUNK_SIZE = 1 << 16;
+// Chunks per thread, to even out the work between threads
+static const size_t CHUNKS_PER_THREAD = 4;
+
+/**
+ * @brief A slice of the input, parsed into its own rules and database
+ */
+struct Chunk {
+  const std::string *source;
+  size_t begin;
+  size_t end;
+  size_t first_line;
+  std::vector<Rule> rules;
+  std::vector<Atom> directives;
+  Database db;
+};
+
+Loader::
+Loader(size_t nthreads)
+  : pool(nthreads) {
+}
+
+std::string
+read_file(const std::string &path) {
+  std::ifstream ifs(path, std::ios::binary);
+  if (!ifs.is_open()) {
+    throw std::runtime_error("Cannot open " + path);
+  }
+  std::ostringstream contents;
+  contents << ifs.rdbuf();
+  return contents.str();
+}
+
+/**
+ * @brief Split source in about nchunks slices of at least min_size bytes.
+ * Every slice but the last ends just after a ".", which always terminates a
+ * clause.
+ */
+std::vector<std::pair<size_t, size_t>>
+split_clauses(const std::string &source, size_t nchunks, size_t min_size) {
+  std::vector<std::pair<size_t, size_t>> bounds;
+  size_t target = std::max(source.size() / std::max<size_t>(nchunks, 1),
+                           std::max<size_t>(min_size, 1));
+  size_t begin = 0;
+  while (begin < source.size()) {
+    size_t end = source.size();
+    if (source.size() - begin > target) {
+      size_t dot = source.find('.', begin + target);
+      end = dot == std::string::npos ? source.size() : dot + 1;
+    }
+    bounds.emplace_back(begin, end);
+    begin = end;
+  }
+  return bounds;
+}
+
+/**
+ * @brief Expand command line arguments into the files to load.
+ * Directories are searched recursively for .pl files and arguments with
+ * wildcards are expanded with glob(3); both expand in lexicographic order.
+ */
+std::vector<std::string>
+expand_paths(const std::vector<std::string> &args) {
+  std::vector<std::string> paths;
+  for (const std::string &arg : args) {
+    if (std::filesystem::is_directory(arg)) {
+      std::vector<std::string> found;
+      for (auto &entry :
+           std::filesystem::recursive_directory_iterator(arg)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".pl") {
+          found.push_back(entry.path().string());
+        }
+      }
+      std::sort(found.begin(), found.end());
+      paths.insert(paths.end(), found.begin(), found.end());
+    }
+    else if (arg.find_first_of("*?[") != std::string::npos) {
+      glob_t matches;
+      if (glob(arg.c_str(), 0, nullptr, &matches) == 0) {
+        for (size_t i = 0; i < matches.gl_pathc; ++i) {
+          paths.push_back(matches.gl_pathv[i]);
+        }
+      }
+      else {
+        std::cerr << "No file matches " << arg << "\n";
+      }
+      globfree(&matches);
+    }
+    else {
+      paths.push_back(arg);
+    }
+  }
+  return paths;
+}
+
+size_t
+Loader::load(const std::string &path, Program &program, Database &db) {
+  return load_source(read_file(path), program, db);
+}
+
+std::vector<std::string>
+Loader::read_files(const std::vector<std::string> &paths) {
+  std::vector<std::string> sources(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    pool.submit([&sources, &paths, i]() { sources[i] = read_file(paths[i]); });
+  }
+  pool.wait();
+  return sources;
+}
+
+/**
+ * @brief Read, lex and parse all of paths concurrently. The program and the
+ * database are as if the files were concatenated in order.
+ * @returns The number of new facts
+ */
+size_t
+Loader::load(const std::vector<std::string> &paths, Program &program,
+             Database &db) {
+  std::vector<std::string> sources = read_files(paths);
+  std::vector<const std::string *> inputs;
+  for (std::string &source : sources) {
+    inputs.push_back(&source);
+  }
+  return load_sources(inputs, program, db);
+}
+
+size_t
+Loader::load_source(const std::string &source, Program &program,
+                    Database &db) {
+  return load_sources({&source}, program, db);
+}
+
+/**
+ * @brief Load source followed by the files in paths, exactly as if source
+ * were the first of the files
+ * @returns The number of new facts
+ */
+size_t
+Loader::load_source(const std::string &source,
+                    const std::vector<std::string> &paths, Program &program,
+                    Database &db) {
+  std::vector<std::string> sources = read_files(paths);
+  std::vector<const std::string *> inputs{&source};
+  for (std::string &file_source : sources) {
+    inputs.push_back(&file_source);
+  }
+  return load_sources(inputs, program, db);
+}
+
+/**
+ * @brief Parse the sources, adding their rules to program and their facts
+ * to db
+ * @returns The number of new facts
+ */
+size_t
+Loader::load_sources(const std::vector<const std::string *> &sources,
+                     Program &program, Database &db) {
+  size_t total_size = 0;
+  for (const std::string *source : sources) {
+    total_size += source->size();
+  }
+  size_t target = std::max(total_size / (pool.size() * CHUNKS_PER_THREAD),
+                           MIN_CHUNK_SIZE);
+  std::vector<Chunk> chunks;
+  for (const std::string *source : sources) {
+    std::vector<std::pair<size_t, size_t>> bounds
+      = split_clauses(*source, source->size() / target + 1, MIN_CHUNK_SIZE);
+    size_t line = 1;
+    for (std::pair<size_t, size_t> &bound : bounds) {
+      chunks.emplace_back();
+      chunks.back().source = source;
+      chunks.back().begin = bound.first;
+      chunks.back().end = bound.second;
+      chunks.back().first_line = line;
+      line += std::count(source->begin() + bound.first,
+                         source->begin() + bound.second, '\n');
+    }
+  }
+
+  // Lex and parse each chunk into its own symbol table and relations
+  for (Chunk &chunk : chunks) {
+    pool.submit([&chunk]() {
+      Lexer lexer;
+      std::vector<Token> tokens
+        = lexer.run(chunk.source->data() + chunk.begin,
+                    chunk.end - chunk.begin, chunk.first_line,
+                    static_cast<std::streamoff>(chunk.begin));
+      Parser parser(tokens);
+      FlatProgram prog = parser.parse_flat();
+      // Facts go straight from the tables to the relations, without
+      // building their tree; consecutive facts mostly share a predicate
+      std::string name;
+      std::string_view predicate;
+      Relation *relation = nullptr;
+      Tuple tuple;
+      for (size_t r = 0; r < prog.get_nrules(); ++r) {
+        if (!prog.is_fact(r)) {
+          chunk.rules.push_back(prog.to_rule(r));
+          continue;
+        }
+        uint32_t head = prog.get_head(r);
+        std::pair<uint32_t, uint32_t> terms = prog.get_terms(head);
+        tuple.clear();
+        for (uint32_t t = terms.first; t < terms.second; ++t) {
+          name.assign(prog.get_name(t));
+          tuple.push_back(chunk.db.get_symbols().intern(name));
+        }
+        if (relation == nullptr || prog.get_predicate(head) != predicate
+            || relation->get_arity() != tuple.size()) {
+          predicate = prog.get_predicate(head);
+          name.assign(predicate);
+          relation = &chunk.db.get_relation(name, tuple.size());
+        }
+        relation->insert(tuple);
+      }
+      for (uint32_t directive : prog.get_directives()) {
+        chunk.directives.push_back(prog.to_atom(directive));
+      }
+    });
+  }
+  pool.wait();
+
+  // Intern in chunk order, so that symbols are numbered by first occurrence
+  // as in a sequential load
+  size_t nfacts = db.size();
+  std::vector<std::vector<SymbolId>> remaps(chunks.size());
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    SymbolTable &symbols = chunks[i].db.get_symbols();
+    for (SymbolId id = 0; id < symbols.size(); ++id) {
+      remaps[i].push_back(db.get_symbols().intern(symbols.get_name(id)));
+    }
+    for (auto &entry : chunks[i].db.get_relations()) {
+      db.get_relation(entry.first, entry.second->get_arity());
+    }
+    for (Rule &rule : chunks[i].rules) {
+      program.add_rule(rule);
+    }
+    for (Atom &directive : chunks[i].directives) {
+      program.add_directive(directive);
+    }
+  }
+
+  // Relations are independent: merge each one on its own thread
+  for (auto &entry : db.get_relations()) {
+    const std::string &predicate = entry.first;
+    Relation &relation = *entry.second;
+    pool.submit([&chunks, &remaps, &predicate, &relation]() {
+      std::vector<SymbolId> row(relation.get_arity());
+      std::vector<SymbolId> buffer(relation.get_arity());
+      for (size_t i = 0; i < chunks.size(); ++i) {
+        Relation *part = chunks[i].db.find_relation(predicate);
+        for (size_t r = 0; part != nullptr && r < part->size(); ++r) {
+          const SymbolId *values = part->get_row(r, buffer.data());
+          for (size_t c = 0; c < row.size(); ++c) {
+            row[c] = is_number(values[c]) ? values[c] : remaps[i][values[c]];
+          }
+          relation.insert(row.data());
+        }
+      }
+    });
+  }
+  pool.wait();
+  return db.size() - nfacts;
+}
@@ -0,0 +1,44 @@
+#ifndef LOADER_HH_INCLUDED
+#define LOADER_HH_INCLUDED
+
+#include "parser.hh"
+#include "relation.hh"
+#include "thread_pool.hh"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Loads knowledge bases into a \ref Database (the facts) and a
+ * \ref Program (the rules).
+ * Files are read concurrently and split at clause boundaries into chunks
+ * that are lexed and parsed concurrently, each into its own symbol table and
+ * relations, which are then merged into the shared database.
+ */
+class Loader {
+private:
+  ThreadPool pool;
+
+  size_t load_sources(const std::vector<const std::string *> &sources,
+                      Program &program, Database &db);
+  std::vector<std::string> read_files(const std::vector<std::string> &paths);
+
+public:
+  Loader(size_t nthreads);
+  size_t load(const std::string &path, Program &program, Database &db);
+  size_t load(const std::vector<std::string> &paths, Program &program,
+              Database &db);
+  size_t load_source(const std::string &source, Program &program,
+                     Database &db);
+  size_t load_source(const std::string &source,
+                     const std::vector<std::string> &paths, Program &program,
+                     Database &db);
+};
+
+std::vector<std::pair<size_t, size_t>>
+split_clauses(const std::string &source, size_t nchunks, size_t min_size);
+std::string read_file(const std::string &path);
+std::vector<std::string> expand_paths(const std::vector<std::string> &args);
+
+#endif
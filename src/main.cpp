@@ -1,12 +1,44 @@
 #include "datalog.hh"
+#include "dependency_graph.hh"
+#include "evaluator.hh"
+#include "loader.hh"
+#include "optimiser.hh"
+#include "query_cache.hh"
+#include "relation.hh"
+#include "server.hh"
+#include "snapshot.hh"
+#include "wal.hh"
 
+#include <cstdlib>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
 #include <vector>
 
 void
 usage(char **argv) {
-  std::cout << "Usage: " << argv[0] << " <FILE>...\n";
+  std::cout << "Usage: " << argv[0]
+            << " [-j THREADS] [-z] [-b] [-m MEGABYTES] [-O] [-o PREDICATE]..."
+               " [-d]\n    [-c MEGABYTES] [-q QUERIES] [-s SOCKET] [-w LOG]"
+               " <FILE|DIR|GLOB>...\n"
+            << "  -j  threads loading files and evaluating independent rules\n"
+            << "  -z  hold the loaded facts in compressed columns\n"
+            << "  -b  evaluate rules a batch of bindings at a time\n"
+            << "  -m  spill relations to temporary files beyond MEGABYTES\n"
+            << "  -O  optimise the rules before evaluating them\n"
+            << "  -o  only evaluate the rules PREDICATE reads, implies -O\n"
+            << "  -d  print the optimised rules, implies -O\n"
+            << "  -c  cache query answers in up to MEGABYTES\n"
+            << "  -q  answer the queries of the file QUERIES as a batch and "
+               "exit\n"
+            << "  -s  serve queries on the Unix domain socket SOCKET, "
+               "THREADS requests\n      at a time, until halt\n"
+            << "  -w  also load the facts logged to LOG and its snapshot, "
+               "and log\n      the facts inserted through -s to LOG\n";
 }
 
 int
@@ -15,35 +47,157 @@ main(int argc, char **argv) {
     usage(argv);
     return 0;
   }
-  // read input file(s)
-  std::string ifile(argv[1]);
-  Lexer lexer = Lexer(ifile);
-  std::vector<Token> tokens = lexer.run();
-  print_tokens(std::cout, tokens);
-  Parser parser(tokens);
-  Program prog = parser.parse();
-  // print_ast(std::cout, prog);
-  //  make a query
-  std::string buf;
-  std::cout << "? ";
+  size_t nthreads = default_concurrency();
+  bool compress = false;
+  bool batched = false;
+  size_t budget_mb = 0;
+  bool optimise = false;
+  bool dump = false;
+  size_t cache_mb = 0;
+  std::string batch;
+  std::string socket_path;
+  std::string log_path;
+  std::vector<std::string> outputs;
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if (arg == "-j" && i + 1 < argc) {
+      nthreads = std::strtoul(argv[++i], nullptr, 10);
+    }
+    else if (arg == "-z") {
+      compress = true;
+    }
+    else if (arg == "-b") {
+      batched = true;
+    }
+    else if (arg == "-m" && i + 1 < argc) {
+      budget_mb = std::strtoul(argv[++i], nullptr, 10);
+    }
+    else if (arg == "-O") {
+      optimise = true;
+    }
+    else if (arg == "-o" && i + 1 < argc) {
+      outputs.push_back(argv[++i]);
+      optimise = true;
+    }
+    else if (arg == "-d") {
+      dump = true;
+      optimise = true;
+    }
+    else if (arg == "-c" && i + 1 < argc) {
+      cache_mb = std::strtoul(argv[++i], nullptr, 10);
+    }
+    else if (arg == "-q" && i + 1 < argc) {
+      batch = argv[++i];
+    }
+    else if (arg == "-s" && i + 1 < argc) {
+      socket_path = argv[++i];
+    }
+    else if (arg == "-w" && i + 1 < argc) {
+      log_path = argv[++i];
+    }
+    else {
+      args.push_back(arg);
+    }
+  }
+  // read input file(s) into one program
+  std::vector<std::string> files = expand_paths(args);
+  if (files.empty()) {
+    usage(argv);
+    return 1;
+  }
+  std::unique_ptr<WriteAheadLog> log;
+  if (!log_path.empty()) {
+    log.reset(new WriteAheadLog(log_path));
+    if (std::filesystem::exists(log->get_snapshot_path())) {
+      files.push_back(log->get_snapshot_path());
+    }
+  }
+  Program prog;
+  Database db;
+  Loader loader(nthreads);
+  size_t nfacts = loader.load(files, prog, db);
+  if (log) {
+    // A record that cannot be loaded is dropped rather than aborting, which
+    // would leave the log unusable
+    log->replay([&](const std::string &record) {
+      try {
+        nfacts += loader.load_source(record, prog, db);
+        return true;
+      }
+      catch (std::runtime_error &error) {
+        std::cerr << "Dropping logged facts: " << error.what() << "\n";
+        return false;
+      }
+    });
+  }
+  if (optimise) {
+    Optimiser optimiser(db);
+    for (const std::string &output : outputs) {
+      optimiser.add_output(output);
+    }
+    prog = optimiser.optimise(prog);
+    if (dump) {
+      print_ast(std::cout, prog);
+    }
+  }
+  if (compress) {
+    for (auto &entry : db.get_relations()) {
+      entry.second->compress();
+    }
+  }
+  if (budget_mb > 0) {
+    db.set_memory_budget(budget_mb << 20,
+                         std::filesystem::temp_directory_path().string());
+    db.enforce_memory_budget();
+  }
+  Evaluator evaluator(db, prog);
+  evaluator.set_batched(batched);
+  ThreadPool pool(nthreads);
+  size_t nderived = evaluator.run(pool);
+  std::cout << "Loaded " << nfacts << " facts and "
+            << prog.get_rules().size() << " rules from " << files.size()
+            << " file(s), derived " << nderived << " facts\n";
   Interpreter interpreter;
-  while (std::cin.good()) {
-    std::getline(std::cin, buf, '\n');
-    std::vector<Token> query_tokens = lexer.run(buf);
-    print_tokens(std::cout, query_tokens);
-    Program query = parser.parse(query_tokens);
-    // print_ast(std::cout, query);
-
-    // Do we need to halt?
-    if (interpreter.do_halt(query)) {
-      std::cout << "\nHalted.\n";
-      return 0;
+  if (!batch.empty()) {
+    Lexer lexer(batch);
+    std::vector<Token> tokens = lexer.run();
+    Parser parser(tokens);
+    Program queries = parser.parse();
+    interpreter.answer_all(evaluator, db, queries, std::cout);
+    return 0;
+  }
+  QueryCache cache(cache_mb << 20);
+  if (!socket_path.empty()) {
+    VersionedDatabase versions(std::move(db), prog);
+    versions.set_log(log.get());
+    QueryServer server(versions, pool);
+    DependencyGraph graph(prog);
+    if (cache_mb > 0) {
+      server.set_cache(&cache, &graph);
     }
-
-    if (!interpreter.interpret(prog, query)) {
-      std::cout << "\nFalse\n";
+    server.serve(socket_path);
+    LatencyStats stats = server.get_stats();
+    std::cout << "Served " << stats.requests << " requests ("
+              << stats.errors << " errors), latency mean "
+              << (stats.requests > 0 ? stats.total_us / stats.requests : 0)
+              << " us, p50 " << stats.percentile(0.5) << " us, p99 "
+              << stats.percentile(0.99) << " us, max " << stats.max_us
+              << " us\n";
+    if (cache_mb > 0) {
+      std::cout << "Query cache: " << cache.get_hits() << " hits, "
+                << cache.get_misses() << " misses\n";
     }
-    std::cout << "? ";
+    return 0;
+  }
+  //  make a query
+  if (cache_mb > 0) {
+    interpreter.set_cache(&cache);
+  }
+  interpreter.run_queries(evaluator, db, std::cin, std::cout);
+  if (cache_mb > 0) {
+    std::cout << "Query cache: " << cache.get_hits() << " hits, "
+              << cache.get_misses() << " misses\n";
   }
   return 0;
 }
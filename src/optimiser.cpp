@@ -0,0 +1,359 @@
+/**
+ * @file optimiser.cpp
+ *
+ * Rewriting of the rules of a program before its evaluation
+ */
+
+#include "optimiser.hh"
+#include "dependency_graph.hh"
+#include "evaluator.hh"
+#include "parser.hh"
+#include "relation.hh"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+typedef std::map<std::string, Term> Substitution;
+
+static bool
+is_named_var(Term &term) {
+  return term.get_term_type() == TermType::VARIABLE && term.get_name() != "_";
+}
+
+static Atom
+substitute(Atom &atom, const Substitution &subst) {
+  std::vector<Term> terms;
+  for (Term term : atom.get_terms()) {
+    auto it = is_named_var(term) ? subst.find(term.get_name()) : subst.end();
+    terms.push_back(it == subst.end() ? term : it->second);
+  }
+  std::string predicate = atom.get_predicate();
+  return Atom(predicate, terms);
+}
+
+static void
+substitute(Atom &head, std::vector<Atom> &goals, const Substitution &subst) {
+  head = substitute(head, subst);
+  for (Atom &goal : goals) {
+    goal = substitute(goal, subst);
+  }
+}
+
+static std::map<std::string, size_t>
+count_variables(Atom &head, std::vector<Atom> &goals) {
+  std::map<std::string, size_t> uses;
+  for (Term term : head.get_terms()) {
+    uses[term.get_name()] += is_named_var(term) ? 1 : 0;
+  }
+  for (Atom &goal : goals) {
+    for (Term term : goal.get_terms()) {
+      uses[term.get_name()] += is_named_var(term) ? 1 : 0;
+    }
+  }
+  return uses;
+}
+
+/**
+ * @brief Whether atom holds whenever other does: they are the same, or atom
+ * only differs by variables that occur nowhere else in the rule
+ */
+static bool
+subsumes(Atom &other, Atom &atom, std::map<std::string, size_t> &uses) {
+  std::vector<Term> terms = atom.get_terms();
+  std::vector<Term> other_terms = other.get_terms();
+  if (other.get_predicate() != atom.get_predicate()
+      || other_terms.size() != terms.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < terms.size(); ++i) {
+    bool singleton = terms[i].get_term_type() == TermType::VARIABLE
+                     && !atom.is_builtin()
+                     && (!is_named_var(terms[i])
+                         || uses[terms[i].get_name()] == 1);
+    if (!(terms[i] == other_terms[i]) && !singleton) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Optimiser::
+Optimiser(Database &db)
+  : db(db), outputs(), facts(), equivalences() {
+}
+
+/**
+ * @brief Keep the rules that predicate reads, and only those. May be called
+ * for several predicates.
+ */
+void
+Optimiser::add_output(const std::string &predicate) {
+  outputs.insert(predicate);
+}
+
+/**
+ * @brief Fold the built-in predicates of constants, substitute the variables
+ * that equalities bind, and remove the body atoms implied by another
+ * @returns false when the rule can never hold
+ */
+bool
+Optimiser::simplify(Rule &rule) {
+  Atom head = rule.get_head();
+  std::vector<Atom> goals = rule.get_goals();
+  SymbolTable symbols;
+  bool folded = true;
+  while (folded) {
+    folded = false;
+    for (size_t i = 0; i < goals.size() && !folded; ++i) {
+      if (!goals[i].is_builtin()) {
+        continue;
+      }
+      std::vector<Term> terms = goals[i].get_terms();
+      BuiltinOp op = get_builtin_op(goals[i].get_predicate());
+      // An operation of constants is an equality of its result
+      if (terms.size() == 3) {
+        if (terms[1].get_term_type() == TermType::VARIABLE
+            || terms[2].get_term_type() == TermType::VARIABLE) {
+          continue;
+        }
+        SymbolId value;
+        if (!compute_value(op, symbols.intern(terms[1].get_name()),
+                           symbols.intern(terms[2].get_name()), value)) {
+          return false;
+        }
+        std::string name = symbols.get_name(value);
+        terms = {terms[0], Term(name, TermType::NUMBER)};
+        op = BuiltinOp::EQ;
+      }
+      Substitution subst;
+      if (terms[0].get_term_type() != TermType::VARIABLE
+          && terms[1].get_term_type() != TermType::VARIABLE) {
+        if (!compare_values(op, symbols.intern(terms[0].get_name()),
+                            symbols.intern(terms[1].get_name()))) {
+          return false;
+        }
+      }
+      else if (op != BuiltinOp::EQ) {
+        continue;
+      }
+      else if (is_named_var(terms[0])) {
+        subst.emplace(terms[0].get_name(), terms[1]);
+      }
+      else if (is_named_var(terms[1])) {
+        subst.emplace(terms[1].get_name(), terms[0]);
+      }
+      else {
+        continue;
+      }
+      goals.erase(goals.begin() + i);
+      substitute(head, goals, subst);
+      folded = true;
+    }
+  }
+  // Later duplicates go first, so that the join order is kept
+  for (size_t i = goals.size(); i-- > 0;) {
+    std::map<std::string, size_t> uses = count_variables(head, goals);
+    for (size_t j = 0; j < goals.size(); ++j) {
+      if (j != i && subsumes(goals[j], goals[i], uses)) {
+        goals.erase(goals.begin() + i);
+        break;
+      }
+    }
+  }
+  rule = Rule(head, goals);
+  return true;
+}
+
+/**
+ * @brief Drop the rules that derive predicates no output reads
+ */
+void
+Optimiser::drop_dead_rules(std::vector<Rule> &rules) {
+  if (outputs.empty()) {
+    return;
+  }
+  std::set<std::string> live(outputs);
+  bool grown = true;
+  while (grown) {
+    grown = false;
+    for (Rule &rule : rules) {
+      if (live.count(rule.get_head().get_predicate()) == 0) {
+        continue;
+      }
+      for (Atom goal : rule.get_goals()) {
+        if (!goal.is_builtin()) {
+          grown = live.insert(goal.get_predicate()).second || grown;
+        }
+      }
+    }
+  }
+  rules.erase(std::remove_if(rules.begin(), rules.end(),
+                             [&](Rule &rule) {
+                               return live.count(
+                                        rule.get_head().get_predicate())
+                                      == 0;
+                             }),
+              rules.end());
+}
+
+/**
+ * @brief Replace the single atom that reads the goal at pos of rule by the
+ * body of definition, whose variables are renamed apart. Head terms that
+ * are constants or repeated variables become equalities, folded by
+ * simplify().
+ */
+static Rule
+unfold(Rule &rule, size_t pos, Rule &definition) {
+  Atom head = rule.get_head();
+  std::vector<Atom> goals = rule.get_goals();
+  Atom def_head = definition.get_head();
+  std::vector<Atom> body = definition.get_goals();
+  std::map<std::string, size_t> names = count_variables(head, goals);
+  std::map<std::string, size_t> def_names = count_variables(def_head, body);
+  names.insert(def_names.begin(), def_names.end());
+  auto fresh = [&](const std::string &base) {
+    for (size_t k = 1;; ++k) {
+      std::string name = base + "_" + std::to_string(k);
+      if (names.emplace(name, 0).second) {
+        return Term(name, TermType::VARIABLE);
+      }
+    }
+  };
+  Substitution rename;
+  for (auto &entry : def_names) {
+    if (entry.second > 0) {
+      rename.emplace(entry.first, fresh(entry.first));
+    }
+  }
+  substitute(def_head, body, rename);
+
+  std::vector<Term> args = goals[pos].get_terms();
+  std::vector<Term> params = def_head.get_terms();
+  Substitution bind;
+  for (size_t i = 0; i < params.size(); ++i) {
+    // Every _ is a distinct variable
+    Term arg = args[i];
+    if (arg.get_term_type() == TermType::VARIABLE && !is_named_var(arg)) {
+      arg = fresh("_");
+    }
+    if (is_named_var(params[i]) && bind.count(params[i].get_name()) == 0) {
+      bind.emplace(params[i].get_name(), arg);
+      continue;
+    }
+    Term value = is_named_var(params[i]) ? bind.at(params[i].get_name())
+                                         : params[i];
+    std::string eq("=");
+    std::vector<Term> terms{arg, value};
+    body.push_back(Atom(eq, terms));
+  }
+  for (Atom &goal : body) {
+    goal = substitute(goal, bind);
+  }
+  goals.erase(goals.begin() + pos);
+  goals.insert(goals.begin() + pos, body.begin(), body.end());
+  return Rule(head, goals);
+}
+
+/**
+ * @brief Inline one predicate that is not an output, has no facts, is
+ * derived by a single non-recursive rule and read by a single body atom
+ * @returns false when there is none
+ */
+bool
+Optimiser::inline_predicate(std::vector<Rule> &rules) {
+  if (outputs.empty()) {
+    return false;
+  }
+  std::vector<Rule> definitions(rules);
+  Program program(definitions);
+  DependencyGraph graph(program);
+  std::map<std::string, size_t> ndefinitions;
+  std::map<std::string, size_t> nreads;
+  for (Rule &rule : rules) {
+    ++ndefinitions[rule.get_head().get_predicate()];
+    for (Atom goal : rule.get_goals()) {
+      nreads[goal.get_predicate()] += goal.is_builtin() ? 0 : 1;
+    }
+  }
+  for (size_t d = 0; d < rules.size(); ++d) {
+    Atom def_head = rules[d].get_head();
+    std::string predicate = def_head.get_predicate();
+    Relation *relation = db.find_relation(predicate);
+    if (outputs.count(predicate) > 0 || facts.count(predicate) > 0
+        || equivalences.count(predicate) > 0
+        || (relation != nullptr && relation->size() > 0)
+        || ndefinitions[predicate] != 1 || nreads[predicate] != 1
+        || graph.is_recursive(graph.get_component(predicate))) {
+      continue;
+    }
+    std::vector<Term> params = def_head.get_terms();
+    if (std::any_of(params.begin(), params.end(), [](Term &term) {
+          return term.get_term_type() == TermType::VARIABLE
+                 && !is_named_var(term);
+        })) {
+      continue;
+    }
+    for (size_t r = 0; r < rules.size(); ++r) {
+      std::vector<Atom> goals = rules[r].get_goals();
+      for (size_t pos = 0; pos < goals.size(); ++pos) {
+        if (goals[pos].get_predicate() != predicate || goals[pos].is_builtin()
+            || goals[pos].get_terms().size() != params.size()) {
+          continue;
+        }
+        rules[r] = unfold(rules[r], pos, rules[d]);
+        rules.erase(rules.begin() + d);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief The rules of program, rewritten. Facts are kept; rules that fold
+ * into facts are stored in the database.
+ */
+Program
+Optimiser::optimise(Program &program) {
+  Program optimised;
+  for (Atom directive : program.get_directives()) {
+    equivalences.insert(directive.get_terms()[0].get_name());
+    optimised.add_directive(directive);
+  }
+  std::vector<Rule> rules;
+  for (Rule rule : program.get_rules()) {
+    if (is_fact(rule)) {
+      facts.insert(rule.get_head().get_predicate());
+      optimised.add_rule(rule);
+    }
+    else {
+      rules.push_back(rule);
+    }
+  }
+  bool changed = true;
+  while (changed) {
+    for (size_t r = 0; r < rules.size();) {
+      if (simplify(rules[r])) {
+        ++r;
+      }
+      else {
+        rules.erase(rules.begin() + r);
+      }
+    }
+    drop_dead_rules(rules);
+    changed = inline_predicate(rules);
+  }
+  for (Rule &rule : rules) {
+    if (is_fact(rule)) {
+      Atom head = rule.get_head();
+      db.add_fact(head);
+    }
+    else {
+      optimised.add_rule(rule);
+    }
+  }
+  return optimised;
+}
@@ -0,0 +1,38 @@
+#ifndef OPTIMISER_HH_INCLUDED
+#define OPTIMISER_HH_INCLUDED
+
+#include "parser.hh"
+#include "relation.hh"
+
+#include <set>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Static rewriting of the rules of a \ref Program before evaluation.
+ * Constants are propagated through the built-in predicates, duplicate and
+ * subsumed body atoms removed, rules that no output predicate reads dropped
+ * and non-recursive predicates of a single rule, read once, inlined.
+ * Without output predicates every predicate is an output: no rule is dead
+ * and none is inlined.
+ */
+class Optimiser {
+private:
+  Database &db;
+  std::set<std::string> outputs;
+  // Predicates with facts in the program
+  std::set<std::string> facts;
+  // Predicates declared equivalence relations, whose rules are not closed
+  std::set<std::string> equivalences;
+
+  bool simplify(Rule &rule);
+  void drop_dead_rules(std::vector<Rule> &rules);
+  bool inline_predicate(std::vector<Rule> &rules);
+
+public:
+  Optimiser(Database &db);
+  void add_output(const std::string &predicate);
+  Program optimise(Program &program);
+};
+
+#endif
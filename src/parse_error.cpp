@@ -9,7 +9,9 @@
 
 ParseError::
 ParseError(const std::string &cause, const Token &current)
-  : std::runtime_error(cause), cause(cause), token(current) {
+  : std::runtime_error(cause), cause(cause), token(current),
+    message(current.get_pos().to_string() + cause + "\ttok = "
+            + current.to_string()) {
   std::cout << current.get_pos().to_string() << cause << "\t"
             << current.to_string() << "\n";
 }
@@ -17,13 +19,13 @@ ParseError(const std::string &cause, const Token &current)
 ParseError::
 ParseError(const std::string &cause)
   : std::runtime_error(cause), cause(cause),
-    token(TokenType::END_OF_FILE, "", FilePos(0, 0, 0)) {
+    token(TokenType::END_OF_FILE, "", 0, 0, 0, 0),
+    message(token.get_pos().to_string() + cause + "\ttok = "
+            + token.to_string()) {
   std::cout << cause << "\n";
 }
 
 const char *
 ParseError::what(void) {
-  std::string text
-    = token.get_pos().to_string() + cause + "\ttok = " + token.to_string();
-  return text.c_str();
+  return message.c_str();
 }
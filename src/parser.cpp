@@ -1,10 +1,16 @@
 #include "parser.hh"
 #include "lexer.hh"
 #include "interpreter.hh"
+#include "relation.hh"
 
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 
@@ -51,7 +57,9 @@ Program
 Parser::parse(std::vector<Token> &tokens) {
   try {
     reset(tokens, 0);
-    return parse_program();
+    flat.clear();
+    parse_program();
+    return flat.to_program();
   }
   catch (ParseError &error) {
     std::cout /*<< "\033[31m"*/ << error.what() /*<< "\033[0m"*/ << std::endl;
@@ -62,7 +70,9 @@ Parser::parse(std::vector<Token> &tokens) {
 Program
 Parser::parse(void) {
   try {
-    return parse_program();
+    flat.clear();
+    parse_program();
+    return flat.to_program();
   }
   catch (ParseError &error) {
     std::cout /*<< "\033[31m"*/ << error.what() /*<< "\033[0m"*/ << std::endl;
@@ -70,41 +80,100 @@ Parser::parse(void) {
   return Program();
 }
 
-Program
+/**
+ * @brief Parse into the tables of a \ref FlatProgram, without building the
+ * tree of the program; on error the tables are empty
+ */
+FlatProgram
+Parser::parse_flat(void) {
+  try {
+    flat.clear();
+    // Size the tables once: names are the literals, and the operators and
+    // signs that make up built-in predicates and negative numbers
+    size_t nliterals = 0;
+    size_t nclauses = 0;
+    size_t nbytes = 0;
+    for (size_t t = current; t < tokens.size(); ++t) {
+      nliterals += tokens[t].get_type() == TokenType::LITERAL;
+      nclauses += tokens[t].get_type() == TokenType::DOT;
+      nbytes += tokens[t].get_text().size() + 1;
+    }
+    flat.reserve(nliterals, nclauses, nbytes);
+    parse_program();
+    return std::move(flat);
+  }
+  catch (ParseError &error) {
+    std::cout /*<< "\033[31m"*/ << error.what() /*<< "\033[0m"*/ << std::endl;
+  }
+  flat.clear();
+  return FlatProgram();
+}
+
+FlatProgram
+Parser::parse_flat(std::vector<Token> &tokens) {
+  reset(tokens, 0);
+  return parse_flat();
+}
+
+void
 Parser::parse_program(void) {
-  Program prog; // the empty program
-  std::vector<Rule> rules;
   while (!is_eof(peek())) {
-    Rule rule = parse_rule();
+    if (peek().get_type() == TokenType::COLON) {
+      flat.add_directive(parse_directive());
+      continue;
+    }
+    parse_rule();
     // at the start of the new rule's token or EOF
-    rules.push_back(rule);
   }
-  prog = Program(rules);
-  return prog;
 }
 
-Rule
+/**
+ * @brief A directive, at its ":-": only eqrel(p), which stores the binary
+ * predicate p as an equivalence relation
+ */
+uint32_t
+Parser::parse_directive(void) {
+  advance(); // skip the ":"
+  Token next = advance();
+  if (next.get_type() != TokenType::MINUS) {
+    throw ParseError("Expected :- at ", next);
+  }
+  Token start = peek();
+  uint32_t directive = parse_atom();
+  std::pair<uint32_t, uint32_t> terms = flat.get_terms(directive);
+  if (flat.get_predicate(directive) != "eqrel"
+      || terms.second - terms.first != 1
+      || flat.get_type(terms.first) != TermType::CONSTANT) {
+    throw ParseError("Expected eqrel(predicate) at ", start);
+  }
+  next = advance();
+  if (next.get_type() != TokenType::DOT) {
+    throw ParseError("Expected dot at ", next);
+  }
+  return directive;
+}
+
+void
 Parser::parse_rule(void) {
-  Atom head = parse_atom();
+  uint32_t head = parse_atom();
   // either at "." or at ":-"
   Token next = advance();
   if (next.get_type() == TokenType::DOT) {
     // then we're parsing a fact => we are done
-    std::vector<Term> terms = head.get_terms();
-    return Rule(head);
+    flat.add_rule(head);
+    return;
   }
   else if (next.get_type() == TokenType::COLON
            && peek().get_type() == TokenType::MINUS) {
     // then we're parsing a rule: more atoms to follow
-    std::vector<Atom> goals;
     advance(); // skip the "-" or the ","
     do {
-      Atom goal = parse_atom();
-      goals.push_back(goal);
+      parse_goal();
       next = advance();
     } while (next.get_type() == TokenType::COMMA);
     if (next.get_type() == TokenType::DOT) {
-      return Rule(head, goals);
+      flat.add_rule(head);
+      return;
     }
     else {
       throw ParseError("Expected dot at ", next);
@@ -113,30 +182,29 @@ Parser::parse_rule(void) {
   throw ParseError("Expected dot or :- at ", next);
 }
 
-Atom
+uint32_t
 Parser::parse_atom(void) {
   Token relation = advance();
   if (relation.get_type() == TokenType::LITERAL) {
-    std::string lexeme = relation.get_lexeme();
+    std::string_view lexeme = relation.get_text();
+    uint32_t first_term = static_cast<uint32_t>(flat.get_nterms());
 
     // Just a fact (no parentheses)
     if (peek().get_type() == TokenType::DOT) {
-      return Atom(lexeme);
+      return flat.add_atom(lexeme, first_term);
     }
 
     Token next = advance(); // skip and save the lparen
     if (next.get_type() == TokenType::LPAREN) {
       // parsing a term list
-      Term term = parse_term();
-      std::vector<Term> terms{term};
+      parse_term();
       next = advance(); // skip and save the rparen or comma
       while (next.get_type() == TokenType::COMMA) {
-        Term term = parse_term();
-        terms.push_back(term);
+        parse_term();
         next = advance();
       }
       if (next.get_type() == TokenType::RPAREN) {
-        return Atom(lexeme, terms);
+        return flat.add_atom(lexeme, first_term);
       }
       else {
         throw ParseError("Expected ) at ", next);
@@ -149,24 +217,118 @@ Parser::parse_atom(void) {
   throw ParseError("Expected a predicate at ", relation);
 }
 
+/**
+ * @brief A goal of a rule body: an atom, or a built-in predicate when its
+ * first term is followed by a comparison
+ */
+uint32_t
+Parser::parse_goal(void) {
+  TokenType after = current + 1 < tokens.size()
+                      ? tokens[current + 1].get_type()
+                      : TokenType::END_OF_FILE;
+  if (peek().get_type() == TokenType::MINUS || after == TokenType::LESS
+      || after == TokenType::GREATER || after == TokenType::EQUAL
+      || after == TokenType::BANG) {
+    return parse_builtin();
+  }
+  return parse_atom();
+}
+
+/**
+ * @brief A comparison of two terms, or the assignment of an arithmetic
+ * operation to a term. Operators of two characters are lexed as two tokens.
+ */
+uint32_t
+Parser::parse_builtin(void) {
+  uint32_t first_term = parse_term();
+  Token op = advance();
+  char comparison[2] = {static_cast<char>(op.get_type()), '='};
+  size_t length = 1;
+  switch (op.get_type()) {
+    case TokenType::LESS:
+    case TokenType::GREATER:
+      if (peek().get_type() == TokenType::EQUAL) {
+        advance();
+        length = 2;
+      }
+      break;
+    case TokenType::EQUAL:
+      break;
+    case TokenType::BANG:
+      if (advance().get_type() != TokenType::EQUAL) {
+        throw ParseError("Expected = at ", previous());
+      }
+      length = 2;
+      break;
+    default:
+      throw ParseError("Expected a comparison at ", op);
+  }
+  parse_term();
+  TokenType next = peek().get_type();
+  if (op.get_type() == TokenType::EQUAL
+      && (next == TokenType::PLUS || next == TokenType::MINUS
+          || next == TokenType::STAR || next == TokenType::SLASH
+          || next == TokenType::PERCENT)) {
+    char operation = static_cast<char>(advance().get_type());
+    parse_term();
+    return flat.add_atom(std::string_view(&operation, 1), first_term);
+  }
+  return flat.add_atom(std::string_view(comparison, length), first_term);
+}
+
 bool
-is_var(std::string &lexeme) {
+is_var(std::string_view lexeme) {
   return (!lexeme.empty()
           && (lexeme[0] == '_' || (lexeme[0] >= 'A' && lexeme[0] <= 'Z')));
 }
 
-Term
+static bool
+is_digits(std::string_view lexeme) {
+  return !lexeme.empty()
+         && std::all_of(lexeme.begin(), lexeme.end(),
+                        [](char c) { return c >= '0' && c <= '9'; });
+}
+
+uint32_t
 Parser::parse_term(void) {
   Token tok = advance();
+  bool negative = false;
+  if (tok.get_type() == TokenType::MINUS
+      && peek().get_type() == TokenType::LITERAL) {
+    negative = true;
+    tok = advance();
+  }
   if (tok.get_type() == TokenType::LITERAL) {
-    std::string lexeme = tok.get_lexeme();
+    std::string_view lexeme = tok.get_text();
+    if (is_digits(lexeme)) {
+      // Integers are spelt as std::to_string() would, see parse_number()
+      size_t start = lexeme.find_first_not_of('0');
+      std::string_view digits
+        = start == std::string_view::npos ? "0" : lexeme.substr(start);
+      int64_t value = INT64_MAX;
+      if (digits.size() <= 10) {
+        std::from_chars(digits.data(), digits.data() + digits.size(), value);
+      }
+      value = negative ? -value : value;
+      SymbolId id;
+      if (!make_number(value, id)) {
+        throw ParseError("Integer out of range at ", tok);
+      }
+      char name[24];
+      char *end = std::to_chars(name, name + sizeof(name), value).ptr;
+      return flat.add_term(TermType::NUMBER,
+                           std::string_view(name, end - name));
+    }
+    if (negative) {
+      throw ParseError("Expected an integer at ", tok);
+    }
     // FIXME: we actually need to check if it's valid identifier,
     // unless we do that at the lexer level
     if (is_var(lexeme)) {
       // then it's a variable
-      return Term(lexeme, TermType::VARIABLE);
+      return flat.add_term(TermType::VARIABLE, lexeme);
     }
-    return Term(lexeme, TermType::CONSTANT);
+    return flat.add_term(TermType::CONSTANT, lexeme);
   }
   throw ParseError("Expected a variable or constant at ", previous());
 }
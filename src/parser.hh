@@ -4,17 +4,25 @@
 #include "ast.hh"
 #include "lexer.hh"
 
+#include <cstdint>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 /* Parser grammar
-<program> ::= <fact> <program> | <rule> <program> | ɛ
+<program> ::= <fact> <program> | <rule> <program> | <directive> <program> | ɛ
 <fact> ::=  <relation> "(" <constant-list> "). | halt."
-<rule> ::= <atom> ":-" <atom-list> "."
+<rule> ::= <atom> ":-" <goal-list> "."
+<directive> ::= ":-" "eqrel" "(" <relation> ")" "."
 <atom> ::= <relation> "(" <term-list> ")"
-<atom-list> ::= <atom> | <atom> "," <atom-list>
-<term> ::= <constant> | <variable>
+<goal> ::= <atom> | <term> <comparison> <term>
+         | <term> "=" <term> <arithmetic> <term>
+<goal-list> ::= <goal> | <goal> "," <goal-list>
+<comparison> ::= "<" | "<=" | ">" | ">=" | "=" | "!="
+<arithmetic> ::= "+" | "-" | "*" | "/" | "%"
+<term> ::= <constant> | <variable> | <number>
 <term-list> ::= <term> | <term> "," <term-list>
 <constant-list> ::= <constant> | <constant> "," <constant-list>
 */
@@ -23,6 +31,8 @@ class ParseError : std::runtime_error {
 private:
   std::string cause;
   Token token;
+  // Returned by what()
+  std::string message;
 
 public:
   ParseError(const std::string &cause);
@@ -30,7 +40,7 @@ public:
   const char *what(void);
 };
 
-enum class TermType { CONSTANT, VARIABLE };
+enum class TermType { CONSTANT, VARIABLE, NUMBER };
 
 // ABC for AST grammar nodes
 class AstNode {
@@ -65,6 +75,7 @@ public:
   Atom(std::string &pred);
   std::string get_predicate(void);
   std::vector<Term> get_terms(void);
+  bool is_builtin(void);
 
   template <class T>
   T accept(AstVisitor<T> &visitor) {
@@ -92,12 +103,16 @@ public:
 class Program : AstNode {
 private:
   std::vector<Rule> rules;
+  // Declarations of how predicates are stored, such as eqrel(same)
+  std::vector<Atom> directives;
   //	Program& operator=(const Program &prog);
 public:
   Program(void);
   Program(std::vector<Rule> &rules);
   std::vector<Rule> get_rules(void);
   void add_rule(Rule &rule);
+  std::vector<Atom> get_directives(void);
+  void add_directive(Atom &directive);
 
   template <class T>
   T accept(AstVisitor<T> &visitor) {
@@ -105,15 +120,65 @@ public:
   }
 };
 
+/**
+ * @brief A program as flat tables, rather than the tree of \ref Program:
+ * terms, atoms and rules are numbered in order of appearance and refer to
+ * each other by 32-bit indices. The terms of an atom run up to the first
+ * term of the next atom, the atoms of a rule from its head to its end; the
+ * names of terms and predicates are slices of a single buffer. Building it
+ * only allocates as the tables grow, not for every term.
+ */
+class FlatProgram {
+private:
+  std::string names;
+  std::vector<TermType> term_types;
+  std::vector<uint32_t> term_names;
+  std::vector<uint32_t> term_lengths;
+  std::vector<uint32_t> atom_names;
+  std::vector<uint32_t> atom_lengths;
+  std::vector<uint32_t> atom_terms;
+  std::vector<uint32_t> rule_heads;
+  std::vector<uint32_t> rule_ends;
+  std::vector<uint32_t> directives;
+
+  uint32_t add_name(std::string_view name);
+
+public:
+  FlatProgram(void);
+  void clear(void);
+  void reserve(size_t nliterals, size_t nclauses, size_t nbytes);
+  uint32_t add_term(TermType type, std::string_view name);
+  uint32_t add_atom(std::string_view predicate, uint32_t first_term);
+  void add_rule(uint32_t head);
+  void add_directive(uint32_t atom);
+  size_t get_nterms(void) const;
+  size_t get_nrules(void) const;
+  uint32_t get_head(size_t rule) const;
+  bool is_fact(size_t rule) const;
+  std::string_view get_predicate(uint32_t atom) const;
+  std::pair<uint32_t, uint32_t> get_terms(uint32_t atom) const;
+  std::string_view get_name(uint32_t term) const;
+  TermType get_type(uint32_t term) const;
+  const std::vector<uint32_t> &get_directives(void) const;
+  Atom to_atom(uint32_t atom) const;
+  Rule to_rule(size_t rule) const;
+  Program to_program(void) const;
+};
+
 class Parser {
 private:
   size_t current;
   std::vector<Token> tokens;
+  // Tables of the program being parsed
+  FlatProgram flat;
 
-  Program parse_program(void);
-  Rule parse_rule(void);
-  Atom parse_atom(void);
-  Term parse_term(void);
+  void parse_program(void);
+  void parse_rule(void);
+  uint32_t parse_directive(void);
+  uint32_t parse_atom(void);
+  uint32_t parse_goal(void);
+  uint32_t parse_builtin(void);
+  uint32_t parse_term(void);
 
   // void synchronize(void);
   Token &peek(void);
@@ -127,6 +192,8 @@ public:
   ~Parser();
   Program parse(void);
   Program parse(std::vector<Token> &tokens);
+  FlatProgram parse_flat(void);
+  FlatProgram parse_flat(std::vector<Token> &tokens);
 };
 
 void print_ast(std::ostream &stream, Program &ast);
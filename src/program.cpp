@@ -25,3 +25,13 @@ void
 Program::add_rule(Rule &rule) {
   rules.push_back(rule);
 }
+
+std::vector<Atom>
+Program::get_directives(void) {
+  return directives;
+}
+
+void
+Program::add_directive(Atom &directive) {
+  directives.push_back(directive);
+}
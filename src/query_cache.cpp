@@ -0,0 +1,208 @@
+/**
+ * @file query_cache.cpp
+ *
+ * Cache of query answers with LRU eviction
+ */
+
+#include "query_cache.hh"
+
+#include <algorithm>
+#include <iterator>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+QueryCache::
+QueryCache(size_t capacity)
+  : capacity(capacity), used(0), entries(), index(), generations(), hits(0),
+    misses(0), mutex() {
+}
+
+/**
+ * @brief The cache key of query: variables are numbered by first
+ * occurrence, each _ being a variable of its own
+ */
+std::string
+QueryCache::normalise(Atom &query) {
+  std::vector<std::string> vars;
+  std::string key = query.get_predicate() + "(";
+  std::vector<Term> terms = query.get_terms();
+  for (size_t i = 0; i < terms.size(); ++i) {
+    key += i > 0 ? "," : "";
+    std::string name = terms[i].get_name();
+    if (terms[i].get_term_type() != TermType::VARIABLE) {
+      key += name;
+      continue;
+    }
+    size_t var = std::find(vars.begin(), vars.end(), name) - vars.begin();
+    if (var == vars.size() || name == "_") {
+      var = vars.size();
+      vars.push_back(name);
+    }
+    key += "?" + std::to_string(var);
+  }
+  return key + ")";
+}
+
+void
+QueryCache::erase(std::list<Entry>::iterator entry) {
+  used -= entry->bytes;
+  index.erase(entry->key);
+  entries.erase(entry);
+}
+
+uint64_t
+QueryCache::get_generation(const std::string &predicate) const {
+  auto it = generations.find(predicate);
+  return it != generations.end() ? it->second : 0;
+}
+
+/**
+ * @brief Copy to answers those cached for key, unless they are stale, in
+ * which case they are dropped
+ * @returns Whether they were found
+ */
+bool
+QueryCache::find(const std::string &key, size_t nrows, uint64_t generation,
+                 std::vector<Tuple> &answers) {
+  auto it = index.find(key);
+  if (it != index.end()) {
+    if (it->second->nrows == nrows && it->second->generation == generation) {
+      ++hits;
+      entries.splice(entries.begin(), entries, it->second);
+      answers = it->second->answers;
+      return true;
+    }
+    erase(it->second);
+  }
+  ++misses;
+  return false;
+}
+
+void
+QueryCache::store(const std::string &key, const std::string &predicate,
+                  size_t nrows, uint64_t generation,
+                  const std::vector<Tuple> &answers) {
+  size_t bytes = sizeof(Entry) + 2 * key.size();
+  for (const Tuple &tuple : answers) {
+    bytes += sizeof(Tuple) + tuple.size() * sizeof(SymbolId);
+  }
+  // Another thread may have cached the same answers meanwhile
+  if (bytes > capacity || index.count(key) > 0) {
+    return;
+  }
+  while (used + bytes > capacity) {
+    erase(std::prev(entries.end()));
+  }
+  entries.push_front(Entry{key, predicate, nrows, generation, answers, bytes});
+  index.emplace(key, entries.begin());
+  used += bytes;
+}
+
+/**
+ * @brief The answers of query, as Evaluator::query() finds them, from the
+ * cache unless its relation grew since they were cached
+ */
+std::vector<Tuple>
+QueryCache::query(Evaluator &evaluator, Database &db, Atom &query) {
+  std::string key = normalise(query);
+  std::string predicate = query.get_predicate();
+  Relation *relation = db.find_relation(predicate);
+  size_t nrows = relation != nullptr ? relation->size() : 0;
+  std::vector<Tuple> answers;
+  std::unique_lock<std::mutex> lock(mutex);
+  uint64_t generation = get_generation(predicate);
+  if (find(key, nrows, generation, answers)) {
+    return answers;
+  }
+  lock.unlock();
+  answers = evaluator.query(query);
+  lock.lock();
+  store(key, predicate, nrows, generation, answers);
+  return answers;
+}
+
+/**
+ * @brief The answers of query on the current version of versions, from the
+ * cache unless predicate was invalidated since they were cached. The
+ * generation is read before the version is pinned, so that answers of a
+ * version older than the last invalidation are never stored as current.
+ */
+std::vector<Tuple>
+QueryCache::query(VersionedDatabase &versions, Atom &query) {
+  std::string key = normalise(query);
+  std::string predicate = query.get_predicate();
+  std::vector<Tuple> answers;
+  std::unique_lock<std::mutex> lock(mutex);
+  uint64_t generation = get_generation(predicate);
+  // Versions are told apart by their generation only
+  if (find(key, 0, generation, answers)) {
+    return answers;
+  }
+  lock.unlock();
+  answers = versions.query(query);
+  lock.lock();
+  if (get_generation(predicate) == generation) {
+    store(key, predicate, 0, generation, answers);
+  }
+  return answers;
+}
+
+/**
+ * @brief Drop the entries of predicate and of the predicates that read it,
+ * following graph, after predicate changed
+ * @returns The number of entries dropped
+ */
+size_t
+QueryCache::invalidate(const std::string &predicate,
+                       const DependencyGraph &graph) {
+  std::vector<std::string> dependents = graph.get_dependents(predicate);
+  std::set<std::string> stale(dependents.begin(), dependents.end());
+  std::lock_guard<std::mutex> lock(mutex);
+  for (const std::string &name : stale) {
+    ++generations[name];
+  }
+  size_t ndropped = 0;
+  for (auto it = entries.begin(); it != entries.end();) {
+    auto next = std::next(it);
+    if (stale.count(it->predicate) > 0) {
+      erase(it);
+      ++ndropped;
+    }
+    it = next;
+  }
+  return ndropped;
+}
+
+void
+QueryCache::clear(void) {
+  std::lock_guard<std::mutex> lock(mutex);
+  entries.clear();
+  index.clear();
+  used = 0;
+}
+
+size_t
+QueryCache::size(void) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return entries.size();
+}
+
+size_t
+QueryCache::memory_usage(void) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return used;
+}
+
+size_t
+QueryCache::get_hits(void) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return hits;
+}
+
+size_t
+QueryCache::get_misses(void) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return misses;
+}
@@ -0,0 +1,72 @@
+#ifndef QUERY_CACHE_HH_INCLUDED
+#define QUERY_CACHE_HH_INCLUDED
+
+#include "dependency_graph.hh"
+#include "evaluator.hh"
+#include "parser.hh"
+#include "relation.hh"
+#include "snapshot.hh"
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Answers of recent queries, keyed by the query with its variables
+ * renamed in order of first occurrence, so that p(X, Y) and p(A, B) share an
+ * entry but p(X, X) does not.
+ * An entry is stale once the relation it was read from has grown; entries
+ * are also dropped explicitly, through the dependency graph, when a relation
+ * changes, which is how the entries of a \ref VersionedDatabase go stale.
+ * Beyond the memory capacity the least recently used entries are evicted.
+ * The cache may be used from several threads at once.
+ */
+class QueryCache {
+private:
+  struct Entry {
+    std::string key;
+    std::string predicate;
+    // Rows of the relation when the answers were read
+    size_t nrows;
+    // Of the predicate when the answers were read
+    uint64_t generation;
+    std::vector<Tuple> answers;
+    size_t bytes;
+  };
+  size_t capacity;
+  size_t used;
+  // Most recently used first
+  std::list<Entry> entries;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index;
+  // Times each predicate was invalidated
+  std::unordered_map<std::string, uint64_t> generations;
+  size_t hits;
+  size_t misses;
+  mutable std::mutex mutex;
+
+  void erase(std::list<Entry>::iterator entry);
+  uint64_t get_generation(const std::string &predicate) const;
+  bool find(const std::string &key, size_t nrows, uint64_t generation,
+            std::vector<Tuple> &answers);
+  void store(const std::string &key, const std::string &predicate,
+             size_t nrows, uint64_t generation,
+             const std::vector<Tuple> &answers);
+
+public:
+  QueryCache(size_t capacity);
+  static std::string normalise(Atom &query);
+  std::vector<Tuple> query(Evaluator &evaluator, Database &db, Atom &query);
+  std::vector<Tuple> query(VersionedDatabase &versions, Atom &query);
+  size_t invalidate(const std::string &predicate,
+                    const DependencyGraph &graph);
+  void clear(void);
+  size_t size(void) const;
+  size_t memory_usage(void) const;
+  size_t get_hits(void) const;
+  size_t get_misses(void) const;
+};
+
+#endif
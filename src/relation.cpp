@@ -0,0 +1,971 @@
+/**
+ * @file relation.cpp
+ *
+ * Tuple storage used by the bottom-up evaluator
+ */
+
+#include "relation.hh"
+#include "fixed_relation.hh"
+#include "parser.hh"
+
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Parse text if it is an integer written as std::to_string() would,
+ * so that every integer has a single spelling
+ */
+bool
+parse_number(const std::string &text, int64_t &value) {
+  size_t start = !text.empty() && text[0] == '-' ? 1 : 0;
+  size_t ndigits = text.size() - start;
+  if (ndigits == 0 || ndigits > 18
+      || (text[start] == '0' && (ndigits > 1 || start == 1))) {
+    return false;
+  }
+  value = 0;
+  for (size_t i = start; i < text.size(); ++i) {
+    if (text[i] < '0' || text[i] > '9') {
+      return false;
+    }
+    value = value * 10 + (text[i] - '0');
+  }
+  value = start == 1 ? -value : value;
+  return true;
+}
+
+// Empty slot of the table of ids
+static const SymbolId NO_SYMBOL = UINT32_MAX;
+// Names in the first chunk of a symbol table; the chunks double in size
+static const size_t FIRST_CHUNK = 1024;
+
+/**
+ * @returns The chunk holding the name of id, and in offset its position in
+ * the chunk
+ */
+static size_t
+chunk_of(size_t id, size_t &offset) {
+  size_t k = 63 - __builtin_clzll(id / FIRST_CHUNK + 1);
+  offset = id - FIRST_CHUNK * ((size_t(1) << k) - 1);
+  return k;
+}
+
+SymbolTable::
+SymbolTable(void)
+  : chunks(), nnames(0), table(nullptr), tables(), adding() {
+  for (std::atomic<std::string *> &chunk : chunks) {
+    chunk.store(nullptr, std::memory_order_relaxed);
+  }
+  table.store(add_table(16), std::memory_order_release);
+}
+
+SymbolTable::
+~SymbolTable(void) {
+  for (std::atomic<std::string *> &chunk : chunks) {
+    delete[] chunk.load(std::memory_order_relaxed);
+  }
+}
+
+/**
+ * @brief Name of id, which must have been added
+ */
+const std::string &
+SymbolTable::name_of(SymbolId id) const {
+  size_t offset;
+  size_t k = chunk_of(id, offset);
+  return chunks[k].load(std::memory_order_acquire)[offset];
+}
+
+/**
+ * @brief Look name up among the symbols added, not the integers
+ */
+bool
+SymbolTable::find(const std::string &name, SymbolId &id) const {
+  // An id is stored in its slot after its name, and a table published
+  // after its slots
+  const IdTable *current = table.load(std::memory_order_acquire);
+  size_t slot = std::hash<std::string>()(name) & current->mask;
+  while (true) {
+    SymbolId found = current->slots[slot].load(std::memory_order_acquire);
+    if (found == NO_SYMBOL) {
+      return false;
+    }
+    if (name_of(found) == name) {
+      id = found;
+      return true;
+    }
+    slot = (slot + 1) & current->mask;
+  }
+}
+
+/**
+ * @brief New empty table of ids, kept until the symbol table is destroyed
+ */
+SymbolTable::IdTable *
+SymbolTable::add_table(size_t nslots) {
+  tables.emplace_back(new IdTable{nslots - 1, nullptr});
+  IdTable *added = tables.back().get();
+  added->slots.reset(new std::atomic<SymbolId>[nslots]);
+  for (size_t i = 0; i < nslots; ++i) {
+    added->slots[i].store(NO_SYMBOL, std::memory_order_relaxed);
+  }
+  return added;
+}
+
+void
+SymbolTable::add_to(IdTable &into, SymbolId id) {
+  size_t slot = std::hash<std::string>()(name_of(id)) & into.mask;
+  while (into.slots[slot].load(std::memory_order_relaxed) != NO_SYMBOL) {
+    slot = (slot + 1) & into.mask;
+  }
+  into.slots[slot].store(id, std::memory_order_release);
+}
+
+/**
+ * @brief Id of name, interned on first use unless it is an integer
+ */
+SymbolId
+SymbolTable::intern(const std::string &name) {
+  SymbolId id;
+  int64_t value;
+  if (find(name, id)) {
+    return id;
+  }
+  if (parse_number(name, value) && make_number(value, id)) {
+    return id;
+  }
+  std::lock_guard<std::mutex> guard(adding);
+  if (find(name, id)) {
+    return id;
+  }
+  size_t n = nnames.load(std::memory_order_relaxed);
+  if (n >= NUMBER_TAG) {
+    throw std::runtime_error("Too many symbols");
+  }
+  id = static_cast<SymbolId>(n);
+  size_t offset;
+  size_t k = chunk_of(n, offset);
+  std::string *chunk = chunks[k].load(std::memory_order_relaxed);
+  if (chunk == nullptr) {
+    chunk = new std::string[FIRST_CHUNK << k];
+    chunks[k].store(chunk, std::memory_order_release);
+  }
+  chunk[offset] = name;
+  nnames.store(n + 1, std::memory_order_release);
+  // Keep the load factor under 1/2, in a new table filled before it is
+  // published
+  IdTable *current = table.load(std::memory_order_relaxed);
+  if (2 * (n + 1) <= current->mask + 1) {
+    add_to(*current, id);
+    return id;
+  }
+  IdTable *next = add_table(2 * (current->mask + 1));
+  for (SymbolId old = 0; old <= id; ++old) {
+    add_to(*next, old);
+  }
+  table.store(next, std::memory_order_release);
+  return id;
+}
+
+bool
+SymbolTable::lookup(const std::string &name, SymbolId &id) const {
+  if (find(name, id)) {
+    return true;
+  }
+  int64_t value;
+  return parse_number(name, value) && make_number(value, id);
+}
+
+/**
+ * @throws std::out_of_range if id is neither an integer nor added
+ */
+std::string
+SymbolTable::get_name(SymbolId id) const {
+  if (is_number(id)) {
+    return std::to_string(number_value(id));
+  }
+  if (id >= nnames.load(std::memory_order_acquire)) {
+    throw std::out_of_range("No symbol " + std::to_string(id));
+  }
+  return name_of(id);
+}
+
+size_t
+SymbolTable::size(void) const {
+  return nnames.load(std::memory_order_acquire);
+}
+
+uint64_t
+hash_values(const SymbolId *values, size_t n) {
+  // FNV-1a over whole symbols, then a final avalanche step
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < n; ++i) {
+    h = (h ^ values[i]) * 1099511628211ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+HashIndex::
+HashIndex(const std::vector<size_t> &columns)
+  : columns(columns), buckets(), indexed_rows(0), bucket_bytes(0) {
+}
+
+void
+HashIndex::update(const Relation &relation) {
+  size_t nrows = relation.size();
+  if (indexed_rows == nrows) {
+    return;
+  }
+  std::vector<SymbolId> buffer(relation.get_arity());
+  std::vector<SymbolId> key(columns.size());
+  for (; indexed_rows < nrows; ++indexed_rows) {
+    const SymbolId *row = relation.get_row(indexed_rows, buffer.data());
+    for (size_t i = 0; i < columns.size(); ++i) {
+      key[i] = row[columns[i]];
+    }
+    std::vector<uint32_t> &bucket
+      = buckets[hash_values(key.data(), key.size())];
+    size_t capacity = bucket.capacity();
+    bucket.push_back(static_cast<uint32_t>(indexed_rows));
+    bucket_bytes += (bucket.capacity() - capacity) * sizeof(uint32_t);
+  }
+}
+
+const std::vector<uint32_t> *
+HashIndex::probe(const SymbolId *key) const {
+  auto it = buckets.find(hash_values(key, columns.size()));
+  if (it == buckets.end()) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
+/**
+ * @brief Whether every row of relation is indexed
+ */
+bool
+HashIndex::is_current(const Relation &relation) const {
+  return indexed_rows == relation.size();
+}
+
+const std::vector<size_t> &
+HashIndex::get_columns(void) const {
+  return columns;
+}
+
+/**
+ * @brief Approximate heap usage of the buckets, in bytes
+ */
+size_t
+HashIndex::memory_usage(void) const {
+  // A node per key, holding its vector, and a pointer per hash bucket; two
+  // allocations of malloc's overhead per key
+  size_t node = sizeof(void *) + sizeof(uint64_t)
+                + sizeof(std::vector<uint32_t>) + 2 * 2 * sizeof(size_t);
+  return buckets.size() * node + buckets.bucket_count() * sizeof(void *)
+         + bucket_bytes;
+}
+
+SortedIndex::
+SortedIndex(const std::vector<size_t> &order)
+  : order(order), tree(order.size()), indexed_rows(0) {
+}
+
+/**
+ * @brief Add the rows inserted since the last update.
+ * The first time, the rows are sorted and the tree is built bottom-up;
+ * afterwards rows are inserted one by one, with the leaf of the previous
+ * insertion as a hint.
+ */
+void
+SortedIndex::update(const Relation &relation) {
+  size_t nrows = relation.size();
+  if (indexed_rows == nrows) {
+    return;
+  }
+  size_t width = order.size();
+  std::vector<SymbolId> buffer(relation.get_arity());
+  std::vector<SymbolId> key(width);
+  if (indexed_rows == 0) {
+    std::vector<SymbolId> keys(nrows * width);
+    for (size_t r = 0; r < nrows; ++r) {
+      const SymbolId *row = relation.get_row(r, buffer.data());
+      for (size_t i = 0; i < width; ++i) {
+        keys[r * width + i] = row[order[i]];
+      }
+    }
+    std::vector<uint32_t> rows(nrows);
+    for (size_t r = 0; r < nrows; ++r) {
+      rows[r] = static_cast<uint32_t>(r);
+    }
+    std::sort(rows.begin(), rows.end(), [&](uint32_t r1, uint32_t r2) {
+      return std::lexicographical_compare(
+        keys.begin() + r1 * width, keys.begin() + (r1 + 1) * width,
+        keys.begin() + r2 * width, keys.begin() + (r2 + 1) * width);
+    });
+    std::vector<SymbolId> sorted;
+    sorted.reserve(nrows * width);
+    for (uint32_t r : rows) {
+      sorted.insert(sorted.end(), keys.begin() + r * width,
+                    keys.begin() + (r + 1) * width);
+    }
+    tree.bulk_load(sorted);
+    indexed_rows = nrows;
+    return;
+  }
+  for (; indexed_rows < nrows; ++indexed_rows) {
+    const SymbolId *row = relation.get_row(indexed_rows, buffer.data());
+    for (size_t i = 0; i < width; ++i) {
+      key[i] = row[order[i]];
+    }
+    tree.insert_hint(key.data());
+  }
+}
+
+const BTreeIndex &
+SortedIndex::get_tree(void) const {
+  return tree;
+}
+
+const std::vector<size_t> &
+SortedIndex::get_order(void) const {
+  return order;
+}
+
+size_t
+SortedIndex::memory_usage(void) const {
+  return tree.memory_usage();
+}
+
+static const uint32_t EMPTY_SLOT = UINT32_MAX;
+// Spilled runs beyond this are merged, to bound the cost of a lookup
+static const size_t MAX_SPILLED_RUNS = 8;
+
+Relation::
+Relation(size_t arity)
+  : arity(arity), ops(fixed_row_ops(arity)), nrows(0), runs(), nspilled(0),
+    columns(), ncompressed(0), data(), slots(arity == 1 ? 0 : 16, EMPTY_SLOT),
+    members(), indexes(), sorted_indexes(), classes() {
+}
+
+/**
+ * @brief Copy of other, for another version of a database. Spilled runs are
+ * shared, as they are never modified; sorted indexes are not copied but
+ * rebuilt on first use.
+ */
+Relation::
+Relation(const Relation &other)
+  : arity(other.arity), ops(other.ops), nrows(other.nrows), runs(other.runs),
+    nspilled(other.nspilled), columns(other.columns),
+    ncompressed(other.ncompressed), data(other.data), slots(other.slots),
+    members(other.members), indexes(other.indexes), sorted_indexes(),
+    classes(other.classes != nullptr ? new EquivalenceClasses(*other.classes)
+                                     : nullptr) {
+}
+
+size_t
+Relation::get_arity(void) const {
+  return arity;
+}
+
+size_t
+Relation::size(void) const {
+  return nrows;
+}
+
+uint64_t
+Relation::hash_row(const SymbolId *values) const {
+  return ops != nullptr ? ops->hash(values) : hash_values(values, arity);
+}
+
+/**
+ * @brief Linear probing for values
+ * @returns The slot holding a row equal to values, or the empty slot where
+ * it would be inserted
+ */
+size_t
+Relation::find_slot(const SymbolId *values) const {
+  if (slots.empty()) {
+    rebuild_slots(0);
+  }
+  SymbolId buffer[64];
+  std::vector<SymbolId> wide_buffer(arity > 64 ? arity : 0);
+  SymbolId *row_buffer = arity > 64 ? wide_buffer.data() : buffer;
+  size_t mask = slots.size() - 1;
+  size_t slot = hash_row(values) & mask;
+  while (slots[slot] != EMPTY_SLOT) {
+    const SymbolId *row = get_row(slots[slot], row_buffer);
+    bool equal = ops != nullptr ? ops->equal(row, values)
+                                : std::equal(row, row + arity, values);
+    if (equal) {
+      return slot;
+    }
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+void
+Relation::grow(void) {
+  rebuild_slots(slots.size() * 2);
+}
+
+/**
+ * @brief Rehash every row in memory into a table of at least min_slots slots
+ */
+void
+Relation::rebuild_slots(size_t min_slots) const {
+  size_t nslots = 16;
+  while (nslots < min_slots || nslots < 2 * (nrows - nspilled)) {
+    nslots *= 2;
+  }
+  slots.assign(nslots, EMPTY_SLOT);
+  std::vector<SymbolId> buffer(arity);
+  size_t mask = nslots - 1;
+  for (size_t row = nspilled; row < nrows; ++row) {
+    size_t slot = hash_row(get_row(row, buffer.data())) & mask;
+    while (slots[slot] != EMPTY_SLOT) {
+      slot = (slot + 1) & mask;
+    }
+    slots[slot] = static_cast<uint32_t>(row);
+  }
+}
+
+bool
+Relation::is_spilled(const SymbolId *values) const {
+  for (const std::shared_ptr<SpilledRun> &run : runs) {
+    if (run->contains(values)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool
+Relation::insert(const SymbolId *values) {
+  if (arity == 1) {
+    if (!members.add(values[0])) {
+      return false;
+    }
+    data.push_back(values[0]);
+    ++nrows;
+    return true;
+  }
+  if (classes != nullptr) {
+    if (!classes->unite(values[0], values[1])) {
+      return false;
+    }
+    nrows = classes->size();
+    return true;
+  }
+  size_t slot = find_slot(values);
+  if (slots[slot] != EMPTY_SLOT || is_spilled(values)) {
+    return false;
+  }
+  data.insert(data.end(), values, values + arity);
+  slots[slot] = static_cast<uint32_t>(nrows++);
+  // Keep the load factor under 1/2
+  if (2 * (nrows - nspilled) > slots.size()) {
+    grow();
+  }
+  return true;
+}
+
+bool
+Relation::insert(const Tuple &tuple) {
+  if (tuple.size() != arity) {
+    throw std::runtime_error("Tuple arity does not match the relation's");
+  }
+  return insert(tuple.data());
+}
+
+/**
+ * @brief Make room for nrows more rows in memory, so that inserting them
+ * does not grow the rows or the duplicate table
+ */
+void
+Relation::reserve(size_t nrows) {
+  if (arity < 2 || classes != nullptr) {
+    return;
+  }
+  data.reserve(data.size() + nrows * arity);
+  size_t nmemory = this->nrows - nspilled + nrows;
+  if (2 * nmemory > slots.size()) {
+    rebuild_slots(2 * nmemory);
+  }
+}
+
+bool
+Relation::contains(const SymbolId *values) const {
+  if (arity == 1) {
+    return members.contains(values[0]);
+  }
+  if (classes != nullptr) {
+    return classes->same(values[0], values[1]);
+  }
+  return slots[find_slot(values)] != EMPTY_SLOT || is_spilled(values);
+}
+
+/**
+ * @brief Row idx: a pointer to the stored row, or to buffer, which must hold
+ * arity symbols, where a compressed row is decoded
+ */
+const SymbolId *
+Relation::get_row(size_t idx, SymbolId *buffer) const {
+  if (idx >= ncompressed) {
+    return data.data() + (idx - ncompressed) * arity;
+  }
+  if (idx >= nspilled) {
+    for (size_t c = 0; c < arity; ++c) {
+      buffer[c] = columns[c].get(idx - nspilled);
+    }
+    return buffer;
+  }
+  auto run = std::upper_bound(
+    runs.begin(), runs.end(), idx,
+    [](size_t row, const std::shared_ptr<SpilledRun> &r) {
+      return row < r->get_first_row();
+    });
+  --run;
+  return (*run)->get_row(idx - (*run)->get_first_row());
+}
+
+Tuple
+Relation::get_tuple(size_t idx) const {
+  Tuple tuple(arity);
+  const SymbolId *row = get_row(idx, tuple.data());
+  std::copy(row, row + arity, tuple.begin());
+  return tuple;
+}
+
+/**
+ * @brief Move every row to compressed columns and drop the indexes, which
+ * are rebuilt on demand. Suited to relations that are mostly read, such as
+ * those loaded from files.
+ */
+void
+Relation::compress(void) {
+  if (nrows == ncompressed || classes != nullptr) {
+    return;
+  }
+  std::vector<SymbolId> column(nrows - nspilled);
+  std::vector<CompressedColumn> compressed;
+  for (size_t c = 0; c < arity; ++c) {
+    if (c < columns.size()) {
+      columns[c].decode(0, ncompressed - nspilled, column.data(), 1);
+    }
+    for (size_t r = ncompressed; r < nrows; ++r) {
+      column[r - nspilled] = data[(r - ncompressed) * arity + c];
+    }
+    compressed.emplace_back(column.data(), 1, nrows - nspilled);
+  }
+  columns.swap(compressed);
+  ncompressed = nrows;
+  std::vector<SymbolId>().swap(data);
+  std::vector<uint32_t>().swap(slots);
+  drop_indexes();
+}
+
+bool
+Relation::is_compressed(void) const {
+  return ncompressed > nspilled;
+}
+
+/**
+ * @brief Move the rows in memory to a new run in a file of directory.
+ * Row numbers do not change, and neither do the indexes, which stay in
+ * memory until drop_indexes().
+ */
+void
+Relation::spill(const std::string &directory) {
+  if (arity == 0 || nrows == nspilled || classes != nullptr) {
+    return;
+  }
+  std::vector<SymbolId> rows;
+  rows.reserve((nrows - nspilled) * arity);
+  std::vector<SymbolId> buffer(arity);
+  for (size_t r = nspilled; r < nrows; ++r) {
+    const SymbolId *row = get_row(r, buffer.data());
+    rows.insert(rows.end(), row, row + arity);
+  }
+  runs.emplace_back(new SpilledRun(directory, arity, nspilled, rows));
+  nspilled = nrows;
+  ncompressed = nrows;
+  columns.clear();
+  std::vector<SymbolId>().swap(data);
+  std::vector<uint32_t>().swap(slots);
+  merge_runs(directory);
+}
+
+/**
+ * @brief Merge adjacent runs, smallest pair first, until there are at most
+ * MAX_SPILLED_RUNS. Runs then grow geometrically, as in a log-structured
+ * merge, so each row is rewritten a logarithmic number of times.
+ */
+void
+Relation::merge_runs(const std::string &directory) {
+  while (runs.size() > MAX_SPILLED_RUNS) {
+    size_t best = 0;
+    for (size_t i = 1; i + 1 < runs.size(); ++i) {
+      if (runs[i]->size() + runs[i + 1]->size()
+          < runs[best]->size() + runs[best + 1]->size()) {
+        best = i;
+      }
+    }
+    std::shared_ptr<SpilledRun> merged(
+      new SpilledRun(directory, {runs[best].get(), runs[best + 1].get()}));
+    runs[best] = std::move(merged);
+    runs.erase(runs.begin() + best + 1);
+  }
+}
+
+size_t
+Relation::get_spilled(void) const {
+  return nspilled;
+}
+
+/**
+ * @brief Free the hash and sorted indexes, which hold the values or numbers
+ * of every row, spilled or not. They are rebuilt, from the runs if need be,
+ * when next used.
+ */
+void
+Relation::drop_indexes(void) {
+  std::unordered_map<uint64_t, HashIndex>().swap(indexes);
+  sorted_indexes.clear();
+}
+
+/**
+ * @brief Members of a unary relation, nullptr for other arities
+ */
+const RoaringBitmap *
+Relation::get_members(void) const {
+  return arity == 1 ? &members : nullptr;
+}
+
+/**
+ * @brief Make this binary relation an equivalence relation: the reflexive,
+ * symmetric and transitive closure of the pairs inserted, stored as their
+ * classes. Its rows, if any, are moved to the classes; from then on it has
+ * no rows to read but only get_classes().
+ * @throws std::runtime_error if the relation is not binary
+ */
+void
+Relation::make_equivalence(void) {
+  if (arity != 2) {
+    throw std::runtime_error("Equivalence relations must be binary");
+  }
+  if (classes != nullptr) {
+    return;
+  }
+  classes.reset(new EquivalenceClasses());
+  SymbolId buffer[2];
+  for (size_t r = 0; r < nrows; ++r) {
+    const SymbolId *row = get_row(r, buffer);
+    classes->unite(row[0], row[1]);
+  }
+  runs.clear();
+  nspilled = 0;
+  columns.clear();
+  ncompressed = 0;
+  std::vector<SymbolId>().swap(data);
+  std::vector<uint32_t>().swap(slots);
+  drop_indexes();
+  nrows = classes->size();
+}
+
+/**
+ * @brief Classes of an equivalence relation, nullptr for other relations
+ */
+const EquivalenceClasses *
+Relation::get_classes(void) const {
+  return classes.get();
+}
+
+/**
+ * @brief Approximate heap usage of the rows, the duplicate table and the
+ * indexes, or of the classes, in bytes; spilled rows are not counted
+ */
+size_t
+Relation::memory_usage(void) const {
+  size_t bytes = data.capacity() * sizeof(SymbolId)
+                 + slots.capacity() * sizeof(uint32_t)
+                 + members.memory_usage();
+  if (classes != nullptr) {
+    bytes += classes->memory_usage();
+  }
+  for (const CompressedColumn &column : columns) {
+    bytes += column.memory_usage();
+  }
+  for (auto &entry : indexes) {
+    bytes += entry.second.memory_usage();
+  }
+  for (auto &entry : sorted_indexes) {
+    bytes += entry.second.memory_usage();
+  }
+  return bytes;
+}
+
+/**
+ * @brief Find the rows whose columns in column_mask hash like key.
+ * The index over column_mask is built on first use and extended lazily with
+ * the rows inserted since the last probe.
+ * @returns The candidate rows in insertion order, or nullptr if none
+ */
+const std::vector<uint32_t> *
+Relation::probe(uint64_t column_mask, const SymbolId *key) {
+  auto it = indexes.find(column_mask);
+  if (it == indexes.end()) {
+    std::vector<size_t> columns;
+    for (size_t i = 0; i < arity; ++i) {
+      if (column_mask & (1ULL << i)) {
+        columns.push_back(i);
+      }
+    }
+    it = indexes.emplace(column_mask, HashIndex(columns)).first;
+  }
+  it->second.update(*this);
+  return it->second.probe(key);
+}
+
+/**
+ * @brief Whether probe() of column_mask finds its index built and current,
+ * and so only reads the relation
+ */
+bool
+Relation::has_index(uint64_t column_mask) const {
+  auto it = indexes.find(column_mask);
+  return it != indexes.end() && it->second.is_current(*this);
+}
+
+/**
+ * @brief Extend every index with the rows inserted since it was last used,
+ * so that probe() and get_sorted_index() only read the relation until the
+ * next insertion
+ */
+void
+Relation::update_indexes(void) {
+  for (auto &entry : indexes) {
+    entry.second.update(*this);
+  }
+  for (auto &entry : sorted_indexes) {
+    entry.second.update(*this);
+  }
+}
+
+/**
+ * @brief Sorted index over the columns of the relation in the given order,
+ * which must be a permutation of all the columns. The index is built on
+ * first use and extended lazily with the rows inserted since the last call.
+ */
+const SortedIndex &
+Relation::get_sorted_index(const std::vector<size_t> &order) {
+  std::vector<bool> seen(arity, false);
+  for (size_t c : order) {
+    if (c >= arity || seen[c]) {
+      throw std::runtime_error("Index order is not a column permutation");
+    }
+    seen[c] = true;
+  }
+  if (order.size() != arity) {
+    throw std::runtime_error("Index order is not a column permutation");
+  }
+  auto it = sorted_indexes.find(order);
+  if (it == sorted_indexes.end()) {
+    it = sorted_indexes.emplace(order, SortedIndex(order)).first;
+  }
+  it->second.update(*this);
+  return it->second;
+}
+
+Database::
+Database(void)
+  : symbols(std::make_shared<SymbolTable>()), relations(), memory_budget(0),
+    spill_directory() {
+}
+
+/**
+ * @brief Next version of the database, to be modified in the relations of
+ * the predicates modified only: those are copied, the symbol table and the
+ * other relations are shared with this version. Symbols interned in either
+ * version are therefore known to both.
+ */
+Database
+Database::version(const std::set<std::string> &modified) const {
+  Database next;
+  next.symbols = symbols;
+  for (auto &entry : relations) {
+    next.relations.emplace(entry.first,
+                           modified.count(entry.first) != 0
+                             ? std::make_shared<Relation>(*entry.second)
+                             : entry.second);
+  }
+  next.memory_budget = memory_budget;
+  next.spill_directory = spill_directory;
+  return next;
+}
+
+SymbolTable &
+Database::get_symbols(void) {
+  return *symbols;
+}
+
+Relation &
+Database::get_relation(const std::string &predicate, size_t arity) {
+  auto it = relations.find(predicate);
+  if (it == relations.end()) {
+    it = relations.emplace(predicate, std::make_shared<Relation>(arity)).first;
+  }
+  else if (it->second->get_arity() != arity) {
+    throw std::runtime_error("Predicate " + predicate
+                             + " used with different arities");
+  }
+  return *it->second;
+}
+
+Relation *
+Database::find_relation(const std::string &predicate) {
+  auto it = relations.find(predicate);
+  if (it == relations.end()) {
+    return nullptr;
+  }
+  return it->second.get();
+}
+
+std::map<std::string, std::shared_ptr<Relation>> &
+Database::get_relations(void) {
+  return relations;
+}
+
+/**
+ * @brief Spill relations to files in directory when the rows they hold in
+ * memory exceed bytes, see \ref enforce_memory_budget
+ */
+void
+Database::set_memory_budget(size_t bytes, const std::string &directory) {
+  memory_budget = bytes;
+  spill_directory = directory;
+}
+
+/**
+ * @brief Spill the rows of the largest relations until their rows and
+ * indexes in memory fit in the budget, and if that is not enough drop their
+ * indexes too, which are costlier to get back. Relations shared with other
+ * versions are read concurrently and are left in memory.
+ * @returns The number of relations spilled
+ */
+size_t
+Database::enforce_memory_budget(void) {
+  if (memory_budget == 0) {
+    return 0;
+  }
+  size_t total = 0;
+  std::vector<Relation *> candidates;
+  for (auto &entry : relations) {
+    Relation &relation = *entry.second;
+    total += relation.memory_usage();
+    if (relation.get_arity() > 0 && relation.get_classes() == nullptr
+        && entry.second.use_count() == 1) {
+      candidates.push_back(&relation);
+    }
+  }
+  size_t nspilled = 0;
+  for (bool rows : {true, false}) {
+    std::vector<std::pair<size_t, Relation *>> largest;
+    for (Relation *relation : candidates) {
+      largest.emplace_back(relation->memory_usage(), relation);
+    }
+    std::sort(largest.begin(), largest.end(),
+              [](const std::pair<size_t, Relation *> &r1,
+                 const std::pair<size_t, Relation *> &r2) {
+                return r1.first > r2.first;
+              });
+    for (auto &entry : largest) {
+      if (total <= memory_budget) {
+        return nspilled;
+      }
+      Relation &relation = *entry.second;
+      if (rows && relation.size() > relation.get_spilled()) {
+        relation.spill(spill_directory);
+        ++nspilled;
+      }
+      else if (!rows) {
+        relation.drop_indexes();
+      }
+      total = total - entry.first + relation.memory_usage();
+    }
+  }
+  return nspilled;
+}
+
+bool
+is_fact(Rule &rule) {
+  if (!rule.get_goals().empty()) {
+    return false;
+  }
+  for (Term term : rule.get_head().get_terms()) {
+    if (term.get_term_type() == TermType::VARIABLE) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool
+Database::add_fact(Atom &fact) {
+  std::vector<Term> terms = fact.get_terms();
+  Tuple tuple;
+  tuple.reserve(terms.size());
+  for (Term term : terms) {
+    if (term.get_term_type() == TermType::VARIABLE) {
+      throw std::runtime_error("Facts must be ground");
+    }
+    tuple.push_back(symbols->intern(term.get_name()));
+  }
+  return get_relation(fact.get_predicate(), tuple.size()).insert(tuple);
+}
+
+/**
+ * @brief Store all the ground facts of program
+ * @returns The number of facts stored (duplicates excluded)
+ */
+size_t
+Database::load(Program &program) {
+  size_t nfacts = 0;
+  for (Rule rule : program.get_rules()) {
+    if (is_fact(rule)) {
+      Atom head = rule.get_head();
+      nfacts += add_fact(head) ? 1 : 0;
+    }
+  }
+  return nfacts;
+}
+
+size_t
+Database::size(void) const {
+  size_t ntuples = 0;
+  for (auto &entry : relations) {
+    ntuples += entry.second->size();
+  }
+  return ntuples;
+}
+
+std::string
+Database::to_string(const std::string &predicate, const Tuple &tuple) {
+  std::string s = predicate;
+  if (tuple.empty()) {
+    return s;
+  }
+  s += "(";
+  for (size_t i = 0; i < tuple.size(); ++i) {
+    s += (i > 0 ? ", " : "") + symbols->get_name(tuple[i]);
+  }
+  return s + ")";
+}
@@ -0,0 +1,258 @@
+#ifndef RELATION_HH_INCLUDED
+#define RELATION_HH_INCLUDED
+
+#include "bitmap.hh"
+#include "btree.hh"
+#include "column.hh"
+#include "equivalence.hh"
+#include "parser.hh"
+#include "spill.hh"
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Interned identifier of a constant symbol
+ */
+typedef uint32_t SymbolId;
+typedef std::vector<SymbolId> Tuple;
+
+/**
+ * @brief Integers are not interned but held in the id itself: the top bit
+ * is set and the value is offset, so that ids of integers compare as the
+ * integers do
+ */
+const SymbolId NUMBER_TAG = 0x80000000U;
+const int64_t MIN_NUMBER = -(INT64_C(1) << 30);
+const int64_t MAX_NUMBER = (INT64_C(1) << 30) - 1;
+
+inline bool
+is_number(SymbolId id) {
+  return (id & NUMBER_TAG) != 0;
+}
+
+inline int64_t
+number_value(SymbolId id) {
+  return static_cast<int64_t>(id & ~NUMBER_TAG) + MIN_NUMBER;
+}
+
+/**
+ * @returns false when value is out of the range of integers
+ */
+inline bool
+make_number(int64_t value, SymbolId &id) {
+  if (value < MIN_NUMBER || value > MAX_NUMBER) {
+    return false;
+  }
+  id = NUMBER_TAG | static_cast<SymbolId>(value - MIN_NUMBER);
+  return true;
+}
+
+bool parse_number(const std::string &text, int64_t &value);
+
+struct RowOps;
+class Relation;
+
+/**
+ * @brief Bidirectional mapping between constant names and \ref SymbolId.
+ * Symbols are only ever added: their names stay where they were first
+ * stored, and the table of ids by name is replaced, not resized, when it
+ * fills. So lookups and names are read without locking, concurrently with
+ * intern(), whose additions are serialised.
+ */
+class SymbolTable {
+private:
+  // Open addressing table of the ids, by hash of their names
+  struct IdTable {
+    size_t mask;
+    std::unique_ptr<std::atomic<SymbolId>[]> slots;
+  };
+
+  static const size_t NCHUNKS = 22;
+
+  // Chunk k holds the names of 2^k times as many ids as the first, after
+  // those of the chunks before it
+  std::atomic<std::string *> chunks[NCHUNKS];
+  std::atomic<size_t> nnames;
+  std::atomic<IdTable *> table;
+  // The current table and those it replaced, which readers may still probe
+  std::vector<std::unique_ptr<IdTable>> tables;
+  std::mutex adding;
+
+  const std::string &name_of(SymbolId id) const;
+  bool find(const std::string &name, SymbolId &id) const;
+  IdTable *add_table(size_t nslots);
+  void add_to(IdTable &into, SymbolId id);
+
+public:
+  SymbolTable(void);
+  ~SymbolTable(void);
+  SymbolTable(const SymbolTable &) = delete;
+  SymbolTable &operator=(const SymbolTable &) = delete;
+  SymbolId intern(const std::string &name);
+  bool lookup(const std::string &name, SymbolId &id) const;
+  std::string get_name(SymbolId id) const;
+  size_t size(void) const;
+};
+
+/**
+ * @brief Hash index over a subset of the columns of a relation.
+ * Buckets hold row numbers in insertion order and are keyed by the hash of
+ * the indexed columns only, so probes must still compare the values.
+ */
+class HashIndex {
+private:
+  std::vector<size_t> columns;
+  std::unordered_map<uint64_t, std::vector<uint32_t>> buckets;
+  size_t indexed_rows;
+  // Capacity of the buckets, in bytes
+  size_t bucket_bytes;
+
+public:
+  HashIndex(const std::vector<size_t> &columns);
+  void update(const Relation &relation);
+  const std::vector<uint32_t> *probe(const SymbolId *key) const;
+  const std::vector<size_t> &get_columns(void) const;
+  bool is_current(const Relation &relation) const;
+  size_t memory_usage(void) const;
+};
+
+uint64_t hash_values(const SymbolId *values, size_t n);
+
+/**
+ * @brief Sorted index over a permutation of the columns of a relation.
+ * Keys are the rows with their columns in that order, so that a prefix of
+ * the permutation can be bound and the matching rows scanned in order.
+ */
+class SortedIndex {
+private:
+  std::vector<size_t> order;
+  BTreeIndex tree;
+  size_t indexed_rows;
+
+public:
+  SortedIndex(const std::vector<size_t> &order);
+  void update(const Relation &relation);
+  const BTreeIndex &get_tree(void) const;
+  const std::vector<size_t> &get_order(void) const;
+  size_t memory_usage(void) const;
+};
+
+/**
+ * @brief Set of tuples of a fixed arity.
+ * Rows are stored flat, in insertion order, so that a row number is a stable
+ * handle and a range of row numbers identifies the tuples added in a round.
+ * The rows present when compress() is called move to compressed columns,
+ * decoded on access; rows inserted afterwards are stored flat again. The
+ * rows present when spill() is called move to a file, read through mmap.
+ * The indexes stay in memory until drop_indexes(), then are rebuilt when
+ * next used.
+ * Unary relations also keep their members in a bitmap, which replaces the
+ * duplicate table and lets the evaluator test membership directly.
+ * Equivalence relations, see make_equivalence(), hold no rows but the
+ * classes of their members.
+ */
+class Relation {
+private:
+  size_t arity;
+  // Specialised tuple operations for the arity, nullptr if there are none
+  const RowOps *ops;
+  size_t nrows;
+  // Rows [0, nspilled), in runs of consecutive rows, shared by the copies
+  // of the relation
+  std::vector<std::shared_ptr<SpilledRun>> runs;
+  size_t nspilled;
+  // Rows [nspilled, ncompressed), column by column
+  std::vector<CompressedColumn> columns;
+  size_t ncompressed;
+  // Rows [ncompressed, nrows)
+  std::vector<SymbolId> data;
+  // Open addressing table of the row numbers in memory, used with the runs
+  // to reject duplicates. It is dropped by compress() and spill() and rebuilt
+  // on the next lookup.
+  mutable std::vector<uint32_t> slots;
+  // Members of a unary relation, in place of slots
+  RoaringBitmap members;
+  std::unordered_map<uint64_t, HashIndex> indexes;
+  std::map<std::vector<size_t>, SortedIndex> sorted_indexes;
+  // Classes of an equivalence relation, in place of the rows
+  std::unique_ptr<EquivalenceClasses> classes;
+
+  size_t find_slot(const SymbolId *values) const;
+  uint64_t hash_row(const SymbolId *values) const;
+  void grow(void);
+  void rebuild_slots(size_t min_slots) const;
+  bool is_spilled(const SymbolId *values) const;
+  void merge_runs(const std::string &directory);
+
+public:
+  Relation(size_t arity);
+  Relation(const Relation &other);
+  Relation(Relation &&other) = default;
+  Relation &operator=(const Relation &) = delete;
+  size_t get_arity(void) const;
+  size_t size(void) const;
+  bool insert(const SymbolId *values);
+  bool insert(const Tuple &tuple);
+  void reserve(size_t nrows);
+  bool contains(const SymbolId *values) const;
+  const SymbolId *get_row(size_t idx, SymbolId *buffer) const;
+  Tuple get_tuple(size_t idx) const;
+  void compress(void);
+  bool is_compressed(void) const;
+  void spill(const std::string &directory);
+  size_t get_spilled(void) const;
+  void drop_indexes(void);
+  const RoaringBitmap *get_members(void) const;
+  void make_equivalence(void);
+  const EquivalenceClasses *get_classes(void) const;
+  size_t memory_usage(void) const;
+  const std::vector<uint32_t> *probe(uint64_t column_mask,
+                                     const SymbolId *key);
+  bool has_index(uint64_t column_mask) const;
+  void update_indexes(void);
+  const SortedIndex &get_sorted_index(const std::vector<size_t> &order);
+};
+
+/**
+ * @brief Extensional storage for a program: the symbol table and one
+ * \ref Relation per predicate.
+ * Versions of a database, see version(), share the symbol table and the
+ * relations that they do not modify.
+ */
+class Database {
+private:
+  std::shared_ptr<SymbolTable> symbols;
+  std::map<std::string, std::shared_ptr<Relation>> relations;
+  // Bytes of rows and indexes kept in memory before relations spill, 0 for
+  // no limit
+  size_t memory_budget;
+  std::string spill_directory;
+
+public:
+  Database(void);
+  Database(const Database &) = delete;
+  Database(Database &&other) = default;
+  Database version(const std::set<std::string> &modified) const;
+  SymbolTable &get_symbols(void);
+  Relation &get_relation(const std::string &predicate, size_t arity);
+  Relation *find_relation(const std::string &predicate);
+  std::map<std::string, std::shared_ptr<Relation>> &get_relations(void);
+  bool add_fact(Atom &fact);
+  size_t load(Program &program);
+  size_t size(void) const;
+  void set_memory_budget(size_t bytes, const std::string &directory);
+  size_t enforce_memory_budget(void);
+  std::string to_string(const std::string &predicate, const Tuple &tuple);
+};
+
+bool is_fact(Rule &rule);
+
+#endif
@@ -0,0 +1,135 @@
+/**
+ * @file scan.cpp
+ *
+ * Vectorised search for token boundaries, used by the lexer to skip over
+ * identifiers a block at a time
+ */
+
+#include "scan.hh"
+
+#include <cstdint>
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+static const char DELIMITERS[] = {'(', ')', ',', '.', ':', '-', '<', '>', '=',
+                                   '!', '+', '*', '/', '%', ' ', '\r', '\n'};
+
+bool
+is_delimiter(char c) {
+  for (char d : DELIMITERS) {
+    if (c == d) {
+      return true;
+    }
+  }
+  return false;
+}
+
+struct DelimiterTable {
+  bool table[256];
+  DelimiterTable(void) : table() {
+    for (char d : DELIMITERS) {
+      table[static_cast<unsigned char>(d)] = true;
+    }
+  }
+};
+
+size_t
+find_delimiter_scalar(const char *s, size_t n) {
+  static const DelimiterTable delimiters;
+  for (size_t i = 0; i < n; ++i) {
+    if (delimiters.table[static_cast<unsigned char>(s[i])]) {
+      return i;
+    }
+  }
+  return n;
+}
+
+#ifdef SCAN_X86
+
+#if defined(__GNUC__)
+#define SCAN_CTZ(x) static_cast<size_t>(__builtin_ctz(x))
+#define SCAN_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#include <intrin.h>
+static size_t
+scan_ctz(unsigned int x) {
+  unsigned long idx;
+  _BitScanForward(&idx, x);
+  return idx;
+}
+#define SCAN_CTZ(x) scan_ctz(x)
+#define SCAN_TARGET_AVX2
+#endif
+
+static size_t
+find_delimiter_sse2(const char *s, size_t n) {
+  __m128i needles[sizeof(DELIMITERS)];
+  for (size_t k = 0; k < sizeof(DELIMITERS); ++k) {
+    needles[k] = _mm_set1_epi8(DELIMITERS[k]);
+  }
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+    __m128i hits = _mm_setzero_si128();
+    for (size_t k = 0; k < sizeof(DELIMITERS); ++k) {
+      hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, needles[k]));
+    }
+    unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(hits));
+    if (mask != 0) {
+      return i + SCAN_CTZ(mask);
+    }
+  }
+  return i + find_delimiter_scalar(s + i, n - i);
+}
+
+SCAN_TARGET_AVX2 static size_t
+find_delimiter_avx2(const char *s, size_t n) {
+  __m256i needles[sizeof(DELIMITERS)];
+  for (size_t k = 0; k < sizeof(DELIMITERS); ++k) {
+    needles[k] = _mm256_set1_epi8(DELIMITERS[k]);
+  }
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i block
+      = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i));
+    __m256i hits = _mm256_setzero_si256();
+    for (size_t k = 0; k < sizeof(DELIMITERS); ++k) {
+      hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, needles[k]));
+    }
+    unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(hits));
+    if (mask != 0) {
+      return i + SCAN_CTZ(mask);
+    }
+  }
+  return i + find_delimiter_sse2(s + i, n - i);
+}
+
+typedef size_t (*ScanFunction)(const char *, size_t);
+
+static ScanFunction
+select_scan(void) {
+#if defined(__GNUC__)
+  if (__builtin_cpu_supports("avx2")) {
+    return find_delimiter_avx2;
+  }
+#endif
+  return find_delimiter_sse2;
+}
+
+size_t
+find_delimiter(const char *s, size_t n) {
+  static const ScanFunction scan = select_scan();
+  return scan(s, n);
+}
+
+#else
+
+size_t
+find_delimiter(const char *s, size_t n) {
+  return find_delimiter_scalar(s, n);
+}
+
+#endif
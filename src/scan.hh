@@ -0,0 +1,17 @@
+#ifndef SCAN_HH_INCLUDED
+#define SCAN_HH_INCLUDED
+
+#include <cstddef>
+
+/**
+ * @brief Find the first byte of s that ends an identifier: one of the
+ * punctuation tokens "(),.:-", the operators "<>=!+*%/" or a space, '\r' or
+ * '\n'.
+ * Uses AVX2 or SSE2 when the CPU supports them.
+ * @returns The index of the delimiter, or n if there is none
+ */
+size_t find_delimiter(const char *s, size_t n);
+size_t find_delimiter_scalar(const char *s, size_t n);
+bool is_delimiter(char c);
+
+#endif
@@ -0,0 +1,493 @@
+/**
+ * @file server.cpp
+ *
+ * Query server over a Unix domain socket
+ */
+
+#include "server.hh"
+#include "interpreter.hh"
+#include "lexer.hh"
+#include "parser.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Requests beyond this are rejected and their connection closed
+static const uint32_t MAX_FRAME = 1 << 20;
+// Connections open at once, beyond which new ones are refused
+static const size_t MAX_CONNECTIONS = 1000;
+
+void
+LatencyStats::add(uint64_t us) {
+  size_t bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+  ++buckets[bucket < NBUCKETS ? bucket : NBUCKETS - 1];
+  ++requests;
+  total_us += us;
+  max_us = us > max_us ? us : max_us;
+}
+
+/**
+ * @returns An upper bound of the latency of the fraction p of the requests,
+ * in microseconds
+ */
+uint64_t
+LatencyStats::percentile(double p) const {
+  size_t seen = 0;
+  for (size_t i = 0; i < NBUCKETS; ++i) {
+    seen += buckets[i];
+    if (seen > 0 && seen >= p * requests) {
+      return std::min(uint64_t(1) << i, max_us);
+    }
+  }
+  return max_us;
+}
+
+static uint32_t
+frame_size(const unsigned char *header) {
+  return (uint32_t(header[0]) << 24) | (uint32_t(header[1]) << 16)
+         | (uint32_t(header[2]) << 8) | uint32_t(header[3]);
+}
+
+static bool
+read_fully(int fd, char *buffer, size_t size) {
+  while (size > 0) {
+    ssize_t n = read(fd, buffer, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    buffer += n;
+    size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+/**
+ * @returns false at the end of the stream, on an error or on a frame longer
+ * than MAX_FRAME
+ */
+bool
+read_frame(int fd, std::string &payload) {
+  unsigned char header[4];
+  if (!read_fully(fd, reinterpret_cast<char *>(header), sizeof(header))) {
+    return false;
+  }
+  uint32_t size = frame_size(header);
+  if (size > MAX_FRAME) {
+    return false;
+  }
+  payload.resize(size);
+  return read_fully(fd, payload.data(), size);
+}
+
+bool
+write_frame(int fd, const std::string &payload) {
+  uint32_t size = static_cast<uint32_t>(payload.size());
+  std::string frame{char(size >> 24), char(size >> 16), char(size >> 8),
+                    char(size)};
+  frame += payload;
+  const char *buffer = frame.data();
+  size_t left = frame.size();
+  while (left > 0) {
+    // A client gone away is an error, not a SIGPIPE
+    ssize_t n = send(fd, buffer, left, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // The buffer of a non-blocking socket is full
+      pollfd writable{fd, POLLOUT, 0};
+      poll(&writable, 1, -1);
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    buffer += n;
+    left -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+/**
+ * @brief Read what the client of the non-blocking socket fd has sent so far
+ * after received, up to the end of a request
+ * @returns false when the client closed the connection, on an error or on a
+ * frame longer than MAX_FRAME
+ */
+static bool
+receive(int fd, std::string &received) {
+  char buffer[4096];
+  while (true) {
+    if (received.size() >= 4) {
+      uint32_t size = frame_size(
+        reinterpret_cast<const unsigned char *>(received.data()));
+      if (size > MAX_FRAME) {
+        return false;
+      }
+      if (received.size() - 4 >= size) {
+        return true;
+      }
+    }
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    received.append(buffer, static_cast<size_t>(n));
+  }
+}
+
+/**
+ * @brief Move the first request out of the bytes received on a connection
+ * @returns false if they do not hold a whole frame yet
+ */
+static bool
+take_frame(std::string &received, std::string &payload) {
+  if (received.size() < 4) {
+    return false;
+  }
+  uint32_t size
+    = frame_size(reinterpret_cast<const unsigned char *>(received.data()));
+  if (received.size() - 4 < size) {
+    return false;
+  }
+  payload.assign(received, 4, size);
+  received.erase(0, 4 + size);
+  return true;
+}
+
+QueryServer::
+QueryServer(VersionedDatabase &versions, ThreadPool &pool)
+  : versions(versions), pool(pool), cache(nullptr), graph(nullptr),
+    max_connections(MAX_CONNECTIONS), mutex(), stats(), connections(), idle(),
+    stopping(false), listen_fd(-1), wake_fds{-1, -1} {
+}
+
+/**
+ * @brief Answer the queries through cache from now on, or directly when it
+ * is null; inserts drop the answers of the predicates they change and of
+ * those that depend on them in graph
+ */
+void
+QueryServer::set_cache(QueryCache *cache, const DependencyGraph *graph) {
+  this->cache = cache;
+  this->graph = graph;
+}
+
+/**
+ * @brief Refuse connections beyond max_connections open at once, sending
+ * them an error
+ */
+void
+QueryServer::set_max_connections(size_t max_connections) {
+  this->max_connections = max_connections;
+}
+
+/**
+ * @brief The response to request, see \ref QueryServer
+ * @param halt Set when the request is halt
+ */
+std::string
+QueryServer::answer(const std::string &request, bool &halt) {
+  bool inserting = !request.empty() && request[0] == '+';
+  std::string text = request.substr(inserting ? 1 : 0);
+  // Requests are answered concurrently, and only in their responses
+  Lexer lexer;
+  lexer.set_quiet(true);
+  std::vector<Token> tokens = lexer.run(text);
+  std::vector<Token> no_tokens;
+  Parser parser(no_tokens);
+  std::vector<Rule> rules = parser.parse(tokens).get_rules();
+  if (rules.empty()) {
+    return inserting ? "Error: no facts\n" : "Error: not a query\n";
+  }
+  if (inserting) {
+    std::vector<Atom> facts;
+    std::set<std::string> predicates;
+    for (Rule &rule : rules) {
+      if (!is_fact(rule)) {
+        return "Error: not a fact\n";
+      }
+      facts.push_back(rule.get_head());
+      predicates.insert(facts.back().get_predicate());
+    }
+    uint64_t epoch = versions.insert(facts);
+    // Published first, so that answers cached from here on are current
+    if (cache != nullptr) {
+      for (const std::string &predicate : predicates) {
+        cache->invalidate(predicate, *graph);
+      }
+    }
+    return "Epoch " + std::to_string(epoch) + "\n";
+  }
+  Atom query = rules[0].get_head();
+  if (query.get_predicate() == HALT_COMMAND) {
+    halt = true;
+    return "Halted.\n";
+  }
+  if (query.get_predicate() == COMPACT_COMMAND) {
+    WriteAheadLog *log = versions.get_log();
+    if (log == nullptr) {
+      return "Error: no log\n";
+    }
+    return "Compacted " + std::to_string(log->compact()) + " bytes\n";
+  }
+  std::vector<Tuple> answers = cache != nullptr
+                                 ? cache->query(versions, query)
+                                 : versions.query(query);
+  if (answers.empty()) {
+    return "False\n";
+  }
+  // Any version names the symbols of the earlier ones
+  std::shared_ptr<Snapshot> snapshot = versions.pin();
+  std::string response;
+  for (Tuple &tuple : answers) {
+    response += snapshot->to_string(query.get_predicate(), tuple) + "\n";
+  }
+  return response;
+}
+
+/**
+ * @brief Answer request, read whole from the connection fd by serve(), and
+ * hand the connection back to it, or close it when the client closed it or
+ * the server stops
+ */
+void
+QueryServer::serve_request(int fd, const std::string &request) {
+  bool open = !stopping;
+  if (open) {
+    auto start = std::chrono::steady_clock::now();
+    std::string response;
+    bool halt = false;
+    try {
+      response = answer(request, halt);
+    }
+    catch (std::exception &error) {
+      response = std::string("Error: ") + error.what() + "\n";
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      stats.add(static_cast<uint64_t>(elapsed.count()));
+      stats.errors += response.compare(0, 5, "Error") == 0 ? 1 : 0;
+    }
+    open = write_frame(fd, response);
+    if (halt) {
+      stop();
+    }
+  }
+  std::lock_guard<std::mutex> guard(mutex);
+  if (open && !stopping) {
+    idle.push_back(fd);
+    wake();
+    return;
+  }
+  connections.erase(fd);
+  close(fd);
+}
+
+/**
+ * @brief Wake serve() up from poll(); mutex must be held
+ */
+void
+QueryServer::wake(void) {
+  if (wake_fds[1] >= 0) {
+    // A full pipe already wakes it up
+    ssize_t n = write(wake_fds[1], "", 1);
+    (void) n;
+  }
+}
+
+/**
+ * @brief Accept a connection on the listening socket fd, or refuse it with
+ * an error beyond the limit of connections
+ */
+void
+QueryServer::accept_connection(int fd) {
+  // Read by serve() only as far as the client has written
+  int client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+  if (client < 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(mutex);
+  if (stopping) {
+    close(client);
+    return;
+  }
+  if (connections.size() >= max_connections) {
+    write_frame(client, "Error: too many connections\n");
+    close(client);
+    return;
+  }
+  connections.emplace(client, std::string());
+  idle.push_back(client);
+}
+
+/**
+ * @brief Stop accepting connections and end the open ones after their
+ * current request
+ */
+void
+QueryServer::stop(void) {
+  std::lock_guard<std::mutex> guard(mutex);
+  stopping = true;
+  if (listen_fd >= 0) {
+    shutdown(listen_fd, SHUT_RDWR);
+  }
+  for (auto &entry : connections) {
+    shutdown(entry.first, SHUT_RD);
+  }
+  wake();
+}
+
+/**
+ * @brief Listen on the socket path, replacing any file there, and serve
+ * connections until stopped: the requests of the idle connections are
+ * read here as their bytes arrive, and each whole one answered on the thread
+ * pool
+ * @throws std::runtime_error if the socket cannot be set up
+ */
+void
+QueryServer::serve(const std::string &path) {
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw std::runtime_error("Socket path too long: " + path);
+  }
+  std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    throw std::runtime_error("Cannot create socket: "
+                             + std::string(std::strerror(errno)));
+  }
+  unlink(path.c_str());
+  int wake_pipe[2];
+  if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0
+      || listen(fd, SOMAXCONN) < 0
+      || pipe2(wake_pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+    std::string cause(std::strerror(errno));
+    close(fd);
+    throw std::runtime_error("Cannot listen on " + path + ": " + cause);
+  }
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    listen_fd = fd;
+    wake_fds[0] = wake_pipe[0];
+    wake_fds[1] = wake_pipe[1];
+  }
+  std::vector<pollfd> polled;
+  std::vector<std::pair<int, std::string *>> readable;
+  std::vector<std::pair<int, std::string>> requests;
+  while (!stopping) {
+    polled.clear();
+    readable.clear();
+    requests.clear();
+    polled.push_back(pollfd{fd, POLLIN, 0});
+    polled.push_back(pollfd{wake_pipe[0], POLLIN, 0});
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      for (int client : idle) {
+        polled.push_back(pollfd{client, POLLIN, 0});
+      }
+    }
+    if (poll(polled.data(), polled.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    char drained[64];
+    while (read(wake_pipe[0], drained, sizeof(drained)) > 0) {
+    }
+    // The bytes received on idle connections are only touched here
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      for (size_t i = 2; i < polled.size(); ++i) {
+        if (polled[i].revents != 0) {
+          readable.emplace_back(polled[i].fd,
+                                &connections.at(polled[i].fd));
+        }
+      }
+    }
+    std::vector<int> closed;
+    for (auto &entry : readable) {
+      if (!receive(entry.first, *entry.second)) {
+        closed.push_back(entry.first);
+      }
+    }
+    {
+      // Connections handed back may hold requests received earlier
+      std::lock_guard<std::mutex> guard(mutex);
+      for (int client : closed) {
+        idle.erase(std::find(idle.begin(), idle.end(), client));
+        connections.erase(client);
+        close(client);
+      }
+      for (size_t i = 0; i < idle.size();) {
+        std::string request;
+        if (take_frame(connections.at(idle[i]), request)) {
+          requests.emplace_back(idle[i], std::move(request));
+          idle.erase(idle.begin() + static_cast<std::ptrdiff_t>(i));
+        }
+        else {
+          ++i;
+        }
+      }
+    }
+    for (auto &entry : requests) {
+      int client = entry.first;
+      std::string request = std::move(entry.second);
+      pool.submit([this, client, request]() {
+        serve_request(client, request);
+      });
+    }
+    if (polled[0].revents != 0) {
+      accept_connection(fd);
+    }
+  }
+  stop();
+  pool.wait();
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    for (int client : idle) {
+      connections.erase(client);
+      close(client);
+    }
+    idle.clear();
+    listen_fd = -1;
+    wake_fds[0] = -1;
+    wake_fds[1] = -1;
+  }
+  close(wake_pipe[0]);
+  close(wake_pipe[1]);
+  close(fd);
+  unlink(path.c_str());
+}
+
+LatencyStats
+QueryServer::get_stats(void) {
+  std::lock_guard<std::mutex> guard(mutex);
+  return stats;
+}
@@ -0,0 +1,93 @@
+#ifndef SERVER_HH_INCLUDED
+#define SERVER_HH_INCLUDED
+
+#include "dependency_graph.hh"
+#include "query_cache.hh"
+#include "snapshot.hh"
+#include "thread_pool.hh"
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+const std::string_view COMPACT_COMMAND = "compact";
+
+/**
+ * @brief Latencies of the requests served, in power-of-two buckets of
+ * microseconds
+ */
+struct LatencyStats {
+  static const size_t NBUCKETS = 32;
+  size_t requests;
+  size_t errors;
+  uint64_t total_us;
+  uint64_t max_us;
+  // Requests of latency in [2^(i-1), 2^i) microseconds, bucket 0 below 1
+  size_t buckets[NBUCKETS];
+
+  void add(uint64_t us);
+  uint64_t percentile(double p) const;
+};
+
+/**
+ * @brief Server answering queries over a Unix domain socket, from relations
+ * evaluated beforehand and shared by all the connections.
+ * Requests and responses are frames of a 4-byte big-endian length followed
+ * by that many bytes of text. A request holds one query, as typed at the
+ * datalogsh prompt; its response holds the answers, one per line, or False,
+ * or a line starting with Error. A request starting with + holds facts to
+ * insert; its response is the epoch of the version holding them. The
+ * request compact compacts the log of the inserted facts, if any, and the
+ * request halt stops the server.
+ * The thread of serve() reads the requests of every connection, without
+ * blocking, and answers each whole one in a task of a thread pool, so that
+ * idle connections and partial requests hold no thread; connections beyond
+ * a limit are sent an error and closed. Each
+ * query runs on the version current when it starts, see
+ * \ref VersionedDatabase, or is answered from a cache, which inserts
+ * invalidate.
+ */
+class QueryServer {
+private:
+  VersionedDatabase &versions;
+  ThreadPool &pool;
+  // Answers of earlier queries, if any, and the dependencies between the
+  // predicates that invalidate them
+  QueryCache *cache;
+  const DependencyGraph *graph;
+  size_t max_connections;
+  // Guards the fields below
+  std::mutex mutex;
+  LatencyStats stats;
+  // Open connections, and the bytes received on each after its last whole
+  // request
+  std::map<int, std::string> connections;
+  // Connections waiting for their next request, polled by serve()
+  std::vector<int> idle;
+  std::atomic<bool> stopping;
+  int listen_fd;
+  // Pipe whose write end wakes serve() up when idle changes or on stop()
+  int wake_fds[2];
+
+  void accept_connection(int fd);
+  void serve_request(int fd, const std::string &request);
+  void wake(void);
+  std::string answer(const std::string &request, bool &halt);
+
+public:
+  QueryServer(VersionedDatabase &versions, ThreadPool &pool);
+  void set_cache(QueryCache *cache, const DependencyGraph *graph);
+  void set_max_connections(size_t max_connections);
+  void serve(const std::string &path);
+  void stop(void);
+  LatencyStats get_stats(void);
+};
+
+bool read_frame(int fd, std::string &payload);
+bool write_frame(int fd, const std::string &payload);
+
+#endif
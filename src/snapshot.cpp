@@ -0,0 +1,244 @@
+/**
+ * @file snapshot.cpp
+ *
+ * Versions of a database, queried while the next ones are derived
+ */
+
+#include "snapshot.hh"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Version epoch of db, whose relations must be closed under the
+ * rules of program
+ */
+Snapshot::
+Snapshot(uint64_t epoch, Database db, Program &program)
+  : epoch(epoch), db(std::move(db)), program(program),
+    evaluator(this->db, this->program) {
+}
+
+uint64_t
+Snapshot::get_epoch(void) const {
+  return epoch;
+}
+
+/**
+ * @brief Build the indexes and the duplicate table of relation that the
+ * rules read it through, and extend those that earlier queries built, before
+ * the snapshot is published
+ */
+void
+Snapshot::prepare(Relation *relation) {
+  evaluator.prepare_reads(relation);
+  relation->update_indexes();
+}
+
+/**
+ * @brief Whether query(atom) finds the index of its constant columns, if it
+ * probes one
+ */
+bool
+Snapshot::is_indexed(Atom &atom) {
+  return evaluator.is_prepared(atom);
+}
+
+/**
+ * @brief Answers of atom, see Evaluator::query(). Queries only read, and
+ * run concurrently: without its index, a query scans the relation.
+ */
+std::vector<Tuple>
+Snapshot::query(Atom &atom) {
+  if (evaluator.is_prepared(atom)) {
+    return evaluator.query(atom);
+  }
+  return evaluator.scan(atom);
+}
+
+std::string
+Snapshot::to_string(const std::string &predicate, const Tuple &tuple) {
+  return db.to_string(predicate, tuple);
+}
+
+/**
+ * @brief Versions of db, the first one with epoch 0. The relations of db
+ * must be closed under the rules of program, as after Evaluator::run().
+ */
+VersionedDatabase::
+VersionedDatabase(Database db, Program &program)
+  : program(program),
+    current(std::make_shared<Snapshot>(0, std::move(db), this->program)),
+    writer(), log(nullptr), arities(), arities_mutex() {
+  for (auto &entry : current->db.get_relations()) {
+    arities[entry.first] = entry.second->get_arity();
+    current->prepare(entry.second.get());
+  }
+}
+
+/**
+ * @brief Log the facts inserted from now on to log, or nowhere when null
+ */
+void
+VersionedDatabase::set_log(WriteAheadLog *log) {
+  this->log = log;
+}
+
+WriteAheadLog *
+VersionedDatabase::get_log(void) {
+  return log;
+}
+
+/**
+ * @brief The current version, kept alive for as long as it is held
+ */
+std::shared_ptr<Snapshot>
+VersionedDatabase::pin(void) const {
+  return std::atomic_load(&current);
+}
+
+/**
+ * @brief Answers of atom on the current version, see Snapshot::query().
+ * The first query of a binding pattern without an index scans, and unless
+ * a writer is busy then publishes the version with the index.
+ */
+std::vector<Tuple>
+VersionedDatabase::query(Atom &atom) {
+  std::shared_ptr<Snapshot> snapshot = pin();
+  if (!snapshot->is_indexed(atom)) {
+    std::unique_lock<std::mutex> guard(writer, std::try_to_lock);
+    if (guard.owns_lock()) {
+      snapshot = index(atom);
+    }
+  }
+  return snapshot->query(atom);
+}
+
+/**
+ * @brief Publish the current version again, with a copy of the relation of
+ * atom holding the index of its constant columns; writer must be held
+ * @returns The version published, or the current one if it has the index
+ */
+std::shared_ptr<Snapshot>
+VersionedDatabase::index(Atom &atom) {
+  std::shared_ptr<Snapshot> base = pin();
+  if (base->is_indexed(atom)) {
+    return base;
+  }
+  std::set<std::string> copied{atom.get_predicate()};
+  std::shared_ptr<Snapshot> next = std::make_shared<Snapshot>(
+    base->epoch, base->db.version(copied), program);
+  // Unpublished, the copy is indexed by querying it
+  next->evaluator.query(atom);
+  next->prepare(next->db.find_relation(atom.get_predicate()));
+  std::atomic_store(&current, next);
+  return next;
+}
+
+/**
+ * @brief Predicates of the relations that inserting facts into db may
+ * modify: those of the facts and the heads of the rules reading them, and
+ * of the rules without atoms, which are evaluated again
+ */
+static std::set<std::string>
+modified_predicates(Database &db, Evaluator &evaluator,
+                    std::vector<Atom> &facts) {
+  std::map<const Relation *, std::string> predicates;
+  for (auto &entry : db.get_relations()) {
+    predicates[entry.second.get()] = entry.first;
+  }
+  std::set<std::string> modified;
+  for (Atom &fact : facts) {
+    modified.insert(fact.get_predicate());
+  }
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (const CompiledRule &rule : evaluator.get_rules()) {
+      bool reads = rule.body.empty();
+      for (const CompiledAtom &atom : rule.body) {
+        reads = reads || modified.count(predicates[atom.relation]) != 0;
+      }
+      if (reads && modified.insert(predicates[rule.head.relation]).second) {
+        changed = true;
+      }
+    }
+  }
+  return modified;
+}
+
+/**
+ * @brief Check that facts are ground and use each predicate with the arity
+ * of its relation, registering those of new predicates, so that they are
+ * logged and inserted only if they can be inserted
+ * @throws std::runtime_error if any cannot be, before any is registered
+ */
+void
+VersionedDatabase::accept(std::vector<Atom> &facts) {
+  std::lock_guard<std::mutex> guard(arities_mutex);
+  std::map<std::string, size_t> added;
+  for (Atom &fact : facts) {
+    std::vector<Term> terms = fact.get_terms();
+    for (Term &term : terms) {
+      if (term.get_term_type() == TermType::VARIABLE) {
+        throw std::runtime_error("Facts must be ground");
+      }
+    }
+    std::string predicate = fact.get_predicate();
+    auto it = arities.find(predicate);
+    if (it == arities.end()) {
+      it = added.emplace(predicate, terms.size()).first;
+    }
+    if (it->second != terms.size()) {
+      throw std::runtime_error("Predicate " + predicate
+                               + " used with different arities");
+    }
+  }
+  arities.insert(added.begin(), added.end());
+}
+
+/**
+ * @brief Publish a version with facts and their consequences. Queries of
+ * earlier versions go on undisturbed.
+ * @returns The epoch of the new version
+ * @throws std::runtime_error if facts cannot be inserted, see accept(), in
+ * which case none is logged or inserted
+ */
+uint64_t
+VersionedDatabase::insert(std::vector<Atom> &facts) {
+  accept(facts);
+  // Concurrent writers share a sync of the log, see WriteAheadLog::append()
+  if (log != nullptr) {
+    log->append(facts);
+  }
+  std::lock_guard<std::mutex> guard(writer);
+  std::shared_ptr<Snapshot> base = pin();
+  std::set<std::string> modified
+    = modified_predicates(base->db, base->evaluator, facts);
+  // The relations shared with earlier versions are read through the indexes
+  // they were published with; the modified ones are private copies until
+  // this version is published
+  std::shared_ptr<Snapshot> next = std::make_shared<Snapshot>(
+    base->epoch + 1, base->db.version(modified), program);
+  for (auto &entry : next->db.get_relations()) {
+    next->evaluator.set_known(entry.second.get(), entry.second->size());
+  }
+  for (Atom &fact : facts) {
+    next->db.add_fact(fact);
+  }
+  next->evaluator.run();
+  for (const std::string &predicate : modified) {
+    Relation *relation = next->db.find_relation(predicate);
+    if (relation != nullptr) {
+      next->prepare(relation);
+    }
+  }
+  std::atomic_store(&current, next);
+  return next->epoch;
+}
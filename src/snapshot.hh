@@ -0,0 +1,82 @@
+#ifndef SNAPSHOT_HH_INCLUDED
+#define SNAPSHOT_HH_INCLUDED
+
+#include "evaluator.hh"
+#include "parser.hh"
+#include "relation.hh"
+#include "wal.hh"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+/**
+ * @brief One version of a database, closed under the rules of a program.
+ * A published snapshot is never modified, but for the symbols that later
+ * versions intern: its relations come with the indexes that the rules and
+ * the earlier queries read them through, and its queries only read.
+ */
+class Snapshot {
+private:
+  uint64_t epoch;
+  Database db;
+  Program program;
+  Evaluator evaluator;
+
+  void prepare(Relation *relation);
+
+  friend class VersionedDatabase;
+
+public:
+  Snapshot(uint64_t epoch, Database db, Program &program);
+  uint64_t get_epoch(void) const;
+  bool is_indexed(Atom &atom);
+  std::vector<Tuple> query(Atom &atom);
+  std::string to_string(const std::string &predicate, const Tuple &tuple);
+};
+
+/**
+ * @brief Multi-version storage: queries pin the current \ref Snapshot and
+ * run on it concurrently with writers, which derive the next version from a
+ * copy and publish it atomically. Neither readers nor writers lock the
+ * versions, only the symbols that writers add.
+ * A query whose index is missing scans its relation; it also publishes a
+ * copy of the version with the index built, for the next queries, unless a
+ * writer is busy.
+ * A version is reclaimed as soon as it is neither current nor pinned.
+ * Writers are serialised; a new version shares the symbols and the
+ * relations it does not modify with the last one and costs a copy of the
+ * relations of the inserted facts and of those derived from them, and the
+ * evaluation of the rules over the inserted facts only. With a log, facts
+ * are durable before they are visible, and only facts that can be inserted
+ * are logged.
+ */
+class VersionedDatabase {
+private:
+  Program program;
+  // Read and replaced with std::atomic_load() and std::atomic_store()
+  std::shared_ptr<Snapshot> current;
+  std::mutex writer;
+  WriteAheadLog *log;
+  // Arity of each predicate of the facts accepted so far, checked before
+  // any fact is logged
+  std::map<std::string, size_t> arities;
+  std::mutex arities_mutex;
+
+  void accept(std::vector<Atom> &facts);
+  std::shared_ptr<Snapshot> index(Atom &atom);
+
+public:
+  VersionedDatabase(Database db, Program &program);
+  void set_log(WriteAheadLog *log);
+  WriteAheadLog *get_log(void);
+  std::shared_ptr<Snapshot> pin(void) const;
+  std::vector<Tuple> query(Atom &atom);
+  uint64_t insert(std::vector<Atom> &facts);
+};
+
+#endif
@@ -0,0 +1,218 @@
+/**
+ * @file spill.cpp
+ *
+ * Rows of relations spilled to disk
+ */
+
+#include "spill.hh"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * @brief Layout of the start of a spill file; the rows and then their order
+ * follow
+ */
+struct SpillHeader {
+  uint64_t arity;
+  uint64_t first_row;
+  uint64_t count;
+};
+
+static FILE *
+create_spill_file(const std::string &directory, std::string &path) {
+  std::vector<char> name(directory.begin(), directory.end());
+  std::string suffix = "/datalog-spill-XXXXXX";
+  name.insert(name.end(), suffix.begin(), suffix.end());
+  name.push_back('\0');
+  int fd = mkstemp(name.data());
+  if (fd < 0) {
+    throw std::runtime_error("Cannot create a spill file in " + directory);
+  }
+  path = name.data();
+  FILE *file = fdopen(fd, "w+b");
+  if (file == nullptr) {
+    close(fd);
+    unlink(path.c_str());
+    throw std::runtime_error("Cannot open spill file " + path);
+  }
+  return file;
+}
+
+static void
+write_all(FILE *file, const std::string &path, const void *buf, size_t size) {
+  if (size > 0 && std::fwrite(buf, 1, size, file) != size) {
+    std::fclose(file);
+    unlink(path.c_str());
+    throw std::runtime_error("Cannot write spill file " + path);
+  }
+}
+
+static bool
+row_less(const SymbolId *r1, const SymbolId *r2, size_t arity) {
+  return std::lexicographical_compare(r1, r1 + arity, r2, r2 + arity);
+}
+
+/**
+ * @brief Write rows, which hold the rows numbered from first_row, to a new
+ * file in directory
+ */
+SpilledRun::
+SpilledRun(const std::string &directory, size_t arity, size_t first_row,
+           const std::vector<SymbolId> &rows)
+  : arity(arity), first_row(first_row),
+    count(arity == 0 ? 0 : rows.size() / arity), map(nullptr), map_size(0),
+    rows(nullptr), order(nullptr) {
+  std::vector<uint32_t> sorted(count);
+  for (size_t i = 0; i < count; ++i) {
+    sorted[i] = static_cast<uint32_t>(i);
+  }
+  std::sort(sorted.begin(), sorted.end(), [&](uint32_t i1, uint32_t i2) {
+    return row_less(rows.data() + i1 * arity, rows.data() + i2 * arity, arity);
+  });
+  std::string path;
+  FILE *file = create_spill_file(directory, path);
+  SpillHeader header{arity, first_row, count};
+  write_all(file, path, &header, sizeof(header));
+  write_all(file, path, rows.data(), count * arity * sizeof(SymbolId));
+  write_all(file, path, sorted.data(), count * sizeof(uint32_t));
+  map_file(file, path);
+}
+
+/**
+ * @brief External merge of runs, which must hold consecutive rows, into a
+ * new file. Rows are copied in order; their sorted orders are merged with one
+ * cursor per run, so memory use does not depend on the size of the runs.
+ */
+SpilledRun::
+SpilledRun(const std::string &directory,
+           const std::vector<const SpilledRun *> &runs)
+  : arity(runs.at(0)->arity), first_row(runs[0]->first_row), count(0),
+    map(nullptr), map_size(0), rows(nullptr), order(nullptr) {
+  for (const SpilledRun *run : runs) {
+    if (run->arity != arity || run->first_row != first_row + count) {
+      throw std::runtime_error("Spilled runs to merge are not consecutive");
+    }
+    count += run->count;
+  }
+  std::string path;
+  FILE *file = create_spill_file(directory, path);
+  SpillHeader header{arity, first_row, count};
+  write_all(file, path, &header, sizeof(header));
+  for (const SpilledRun *run : runs) {
+    write_all(file, path, run->rows, run->count * arity * sizeof(SymbolId));
+  }
+
+  // Cursors (run, position in the run's order), smallest row first
+  auto greater = [&](const std::pair<size_t, size_t> &c1,
+                     const std::pair<size_t, size_t> &c2) {
+    return row_less(runs[c2.first]->get_sorted_row(c2.second),
+                    runs[c1.first]->get_sorted_row(c1.second), arity);
+  };
+  std::priority_queue<std::pair<size_t, size_t>,
+                      std::vector<std::pair<size_t, size_t>>,
+                      decltype(greater)>
+    cursors(greater);
+  for (size_t r = 0; r < runs.size(); ++r) {
+    if (runs[r]->count > 0) {
+      cursors.emplace(r, 0);
+    }
+  }
+  std::vector<uint32_t> buffer;
+  while (!cursors.empty()) {
+    std::pair<size_t, size_t> cursor = cursors.top();
+    cursors.pop();
+    const SpilledRun *run = runs[cursor.first];
+    buffer.push_back(static_cast<uint32_t>(run->first_row - first_row
+                                           + run->order[cursor.second]));
+    if (buffer.size() == 4096) {
+      write_all(file, path, buffer.data(), buffer.size() * sizeof(uint32_t));
+      buffer.clear();
+    }
+    if (cursor.second + 1 < run->count) {
+      cursors.emplace(cursor.first, cursor.second + 1);
+    }
+  }
+  write_all(file, path, buffer.data(), buffer.size() * sizeof(uint32_t));
+  map_file(file, path);
+}
+
+/**
+ * @brief Map the file just written, then close and unlink it: the mapping
+ * keeps the data alive until the run is destroyed
+ */
+void
+SpilledRun::map_file(FILE *file, const std::string &path) {
+  bool flushed = std::fflush(file) == 0;
+  struct stat st;
+  if (flushed && fstat(fileno(file), &st) == 0) {
+    map_size = static_cast<size_t>(st.st_size);
+    map = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+  }
+  std::fclose(file);
+  unlink(path.c_str());
+  if (map == nullptr || map == MAP_FAILED) {
+    map = nullptr;
+    throw std::runtime_error("Cannot map spill file " + path);
+  }
+  const char *base = static_cast<const char *>(map);
+  rows = reinterpret_cast<const SymbolId *>(base + sizeof(SpillHeader));
+  order = reinterpret_cast<const uint32_t *>(rows + count * arity);
+}
+
+SpilledRun::
+~SpilledRun(void) {
+  if (map != nullptr) {
+    munmap(map, map_size);
+  }
+}
+
+size_t
+SpilledRun::get_first_row(void) const {
+  return first_row;
+}
+
+size_t
+SpilledRun::size(void) const {
+  return count;
+}
+
+/**
+ * @brief Row idx of the run, in insertion order
+ */
+const SymbolId *
+SpilledRun::get_row(size_t idx) const {
+  return rows + idx * arity;
+}
+
+/**
+ * @brief Row idx of the run, in lexicographic order
+ */
+const SymbolId *
+SpilledRun::get_sorted_row(size_t idx) const {
+  return rows + order[idx] * arity;
+}
+
+bool
+SpilledRun::contains(const SymbolId *values) const {
+  size_t lo = 0;
+  size_t hi = count;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (row_less(get_sorted_row(mid), values, arity)) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+  return lo < count && !row_less(values, get_sorted_row(lo), arity);
+}
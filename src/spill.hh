@@ -0,0 +1,47 @@
+#ifndef SPILL_HH_INCLUDED
+#define SPILL_HH_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+typedef uint32_t SymbolId;
+
+/**
+ * @brief Consecutive rows of a relation, written to a temporary file and
+ * read back through mmap.
+ * The file holds the rows in insertion order followed by their positions in
+ * lexicographic order, so that rows are found by binary search without
+ * loading the run. The file is unlinked as soon as it is mapped.
+ */
+class SpilledRun {
+private:
+  size_t arity;
+  size_t first_row;
+  size_t count;
+  void *map;
+  size_t map_size;
+  const SymbolId *rows;
+  const uint32_t *order;
+
+  void map_file(FILE *file, const std::string &path);
+
+public:
+  SpilledRun(const std::string &directory, size_t arity, size_t first_row,
+             const std::vector<SymbolId> &rows);
+  SpilledRun(const std::string &directory,
+             const std::vector<const SpilledRun *> &runs);
+  ~SpilledRun(void);
+  SpilledRun(const SpilledRun &) = delete;
+  SpilledRun &operator=(const SpilledRun &) = delete;
+
+  size_t get_first_row(void) const;
+  size_t size(void) const;
+  const SymbolId *get_row(size_t idx) const;
+  const SymbolId *get_sorted_row(size_t idx) const;
+  bool contains(const SymbolId *values) const;
+};
+
+#endif
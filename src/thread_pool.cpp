@@ -0,0 +1,161 @@
+#include "thread_pool.hh"
+
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+ThreadPool::
+ThreadPool(size_t nthreads)
+  : workers(), tasks(), mutex(), task_ready(), all_done(), pending(0),
+    stopping(false), error(nullptr) {
+  for (size_t i = 0; nthreads > 1 && i < nthreads; ++i) {
+    workers.emplace_back(&ThreadPool::work, this);
+  }
+}
+
+ThreadPool::~
+ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  task_ready.notify_all();
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+}
+
+void
+ThreadPool::run_task(std::function<void()> &task) {
+  try {
+    task();
+  }
+  catch (...) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!error) {
+      error = std::current_exception();
+    }
+  }
+}
+
+/**
+ * @brief Run the first queued task, with lock held on entry and on return
+ */
+void
+ThreadPool::run_next(std::unique_lock<std::mutex> &lock) {
+  std::function<void()> task = std::move(tasks.front());
+  tasks.pop();
+  lock.unlock();
+  run_task(task);
+  lock.lock();
+  if (--pending == 0) {
+    all_done.notify_all();
+  }
+}
+
+void
+ThreadPool::work(void) {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    task_ready.wait(lock, [this]() { return stopping || !tasks.empty(); });
+    if (tasks.empty()) {
+      return;
+    }
+    run_next(lock);
+  }
+}
+
+void
+ThreadPool::submit(std::function<void()> task) {
+  if (workers.empty()) {
+    run_task(task);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.push(std::move(task));
+    ++pending;
+  }
+  task_ready.notify_one();
+}
+
+/**
+ * @brief Wait for all the submitted tasks to complete
+ * @throws The first exception thrown by a task, if any
+ */
+void
+ThreadPool::wait(void) {
+  std::unique_lock<std::mutex> lock(mutex);
+  all_done.wait(lock, [this]() { return pending == 0; });
+  if (error) {
+    std::exception_ptr e = error;
+    error = nullptr;
+    std::rethrow_exception(e);
+  }
+}
+
+/**
+ * @brief Run f(0) to f(n - 1) on the pool and wait for these calls only,
+ * not for every submitted task as wait() does. The calling thread runs
+ * queued tasks while it waits, so that a task may call parallel_for() on
+ * the pool it runs on.
+ * @throws The first exception thrown by a call of f, if any
+ */
+void
+ThreadPool::parallel_for(size_t n, const std::function<void(size_t)> &f) {
+  if (workers.empty()) {
+    for (size_t i = 0; i < n; ++i) {
+      f(i);
+    }
+    return;
+  }
+  size_t remaining = n;
+  std::exception_ptr failure;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < n; ++i) {
+      tasks.push([this, &f, &remaining, &failure, i]() {
+        std::exception_ptr e;
+        try {
+          f(i);
+        }
+        catch (...) {
+          e = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (e && !failure) {
+          failure = e;
+        }
+        if (--remaining == 0) {
+          all_done.notify_all();
+        }
+      });
+      ++pending;
+    }
+  }
+  task_ready.notify_all();
+  std::unique_lock<std::mutex> lock(mutex);
+  while (remaining > 0) {
+    if (!tasks.empty()) {
+      run_next(lock);
+    }
+    else {
+      all_done.wait(lock);
+    }
+  }
+  if (failure) {
+    std::rethrow_exception(failure);
+  }
+}
+
+size_t
+ThreadPool::size(void) const {
+  return workers.empty() ? 1 : workers.size();
+}
+
+size_t
+default_concurrency(void) {
+  size_t n = std::thread::hardware_concurrency();
+  return n == 0 ? 1 : n;
+}
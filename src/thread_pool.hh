@@ -0,0 +1,43 @@
+#ifndef THREAD_POOL_HH_INCLUDED
+#define THREAD_POOL_HH_INCLUDED
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Fixed set of worker threads running submitted tasks in FIFO order.
+ * A pool of a single thread runs every task inline, in submit().
+ */
+class ThreadPool {
+private:
+  std::vector<std::thread> workers;
+  std::queue<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable task_ready;
+  std::condition_variable all_done;
+  size_t pending;
+  bool stopping;
+  // First exception thrown by a task, rethrown by wait()
+  std::exception_ptr error;
+
+  void work(void);
+  void run_task(std::function<void()> &task);
+  void run_next(std::unique_lock<std::mutex> &lock);
+
+public:
+  ThreadPool(size_t nthreads);
+  ~ThreadPool();
+  void submit(std::function<void()> task);
+  void wait(void);
+  void parallel_for(size_t n, const std::function<void(size_t)> &f);
+  size_t size(void) const;
+};
+
+size_t default_concurrency(void);
+
+#endif
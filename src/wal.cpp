@@ -0,0 +1,341 @@
+/**
+ * @file wal.cpp
+ *
+ * Write-ahead log of inserted facts, with group commit
+ */
+
+#include "wal.hh"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static const size_t HEADER_SIZE = 8;
+
+static uint32_t
+checksum(const char *data, size_t size) {
+  // FNV-1a
+  uint32_t hash = 2166136261U;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619U;
+  }
+  return hash;
+}
+
+static void
+put_u32(std::string &out, uint32_t value) {
+  out.push_back(static_cast<char>(value >> 24));
+  out.push_back(static_cast<char>(value >> 16));
+  out.push_back(static_cast<char>(value >> 8));
+  out.push_back(static_cast<char>(value));
+}
+
+static uint32_t
+get_u32(const char *in) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(in);
+  return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16)
+         | (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
+}
+
+static std::runtime_error
+io_error(const std::string &what, const std::string &path) {
+  return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+static void
+write_all(int fd, const std::string &data, const std::string &path) {
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t n = write(fd, data.data() + done, data.size() - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      throw io_error("Cannot write", path);
+    }
+    done += static_cast<size_t>(n);
+  }
+}
+
+/**
+ * @brief Append the contents of the file open at fd to data
+ * @returns false on a read error
+ */
+static bool
+read_all(int fd, std::string &data) {
+  char buffer[1 << 16];
+  ssize_t n;
+  off_t offset = 0;
+  while ((n = pread(fd, buffer, sizeof(buffer), offset)) != 0) {
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return false;
+    }
+    data.append(buffer, static_cast<size_t>(n));
+    offset += n;
+  }
+  return true;
+}
+
+static int
+open_log(const std::string &path) {
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    throw io_error("Cannot open", path);
+  }
+  return fd;
+}
+
+static std::string
+make_record(const std::string &payload) {
+  std::string record;
+  put_u32(record, static_cast<uint32_t>(payload.size()));
+  put_u32(record, checksum(payload.data(), payload.size()));
+  return record + payload;
+}
+
+/**
+ * @brief Replace the file at path with data atomically: data is written to
+ * a temporary file and synced, which is then renamed over path, and the
+ * rename synced with the directory
+ */
+static void
+replace_file(const std::string &path, const std::string &data) {
+  std::string temporary = path + ".tmp";
+  int fd = open(temporary.c_str(),
+                O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    throw io_error("Cannot open", temporary);
+  }
+  try {
+    write_all(fd, data, temporary);
+    if (fsync(fd) < 0) {
+      throw io_error("Cannot sync", temporary);
+    }
+  }
+  catch (std::runtime_error &) {
+    close(fd);
+    unlink(temporary.c_str());
+    throw;
+  }
+  close(fd);
+  if (rename(temporary.c_str(), path.c_str()) < 0) {
+    std::runtime_error error = io_error("Cannot rename", temporary);
+    unlink(temporary.c_str());
+    throw error;
+  }
+  size_t slash = path.rfind('/');
+  std::string directory = slash == std::string::npos ? "."
+                          : slash == 0               ? "/"
+                                                     : path.substr(0, slash);
+  int dir = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir < 0) {
+    throw io_error("Cannot open", directory);
+  }
+  bool ok = fsync(dir) == 0;
+  close(dir);
+  if (!ok) {
+    throw io_error("Cannot sync", directory);
+  }
+}
+
+/**
+ * @brief Open the log at path, creating it if needed
+ * @throws std::runtime_error if it cannot be opened
+ */
+WriteAheadLog::
+WriteAheadLog(const std::string &path)
+  : path(path), fd(-1), mutex(), synced(), pending(), appended(0), durable(0),
+    failed(0), syncing(false), nsyncs(0) {
+  fd = open_log(path);
+}
+
+WriteAheadLog::~
+WriteAheadLog(void) {
+  close(fd);
+}
+
+/**
+ * @brief Source of the facts of each complete record, the torn one at the
+ * end, if any, being cut from the log
+ */
+std::vector<std::string>
+WriteAheadLog::read_records(void) {
+  std::string log;
+  if (!read_all(fd, log)) {
+    throw io_error("Cannot read", path);
+  }
+  std::vector<std::string> records;
+  size_t pos = 0;
+  while (log.size() - pos >= HEADER_SIZE) {
+    uint32_t size = get_u32(log.data() + pos);
+    const char *payload = log.data() + pos + HEADER_SIZE;
+    if (log.size() - pos - HEADER_SIZE < size
+        || checksum(payload, size) != get_u32(log.data() + pos + 4)) {
+      break;
+    }
+    records.emplace_back(payload, size);
+    pos += HEADER_SIZE + size;
+  }
+  if (pos < log.size() && ftruncate(fd, static_cast<off_t>(pos)) < 0) {
+    throw io_error("Cannot truncate", path);
+  }
+  return records;
+}
+
+/**
+ * @brief Pass the source of the facts of each record logged since the last
+ * compaction to load, on startup after the snapshot is loaded. The records
+ * load rejects are dropped from the log, which is replaced by one of the
+ * others, so that they are neither replayed nor compacted again.
+ * @returns The number of records rejected
+ */
+size_t
+WriteAheadLog::replay(const std::function<bool(const std::string &)> &load) {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::string accepted;
+  size_t nrejected = 0;
+  for (const std::string &record : read_records()) {
+    if (load(record)) {
+      accepted += make_record(record);
+    }
+    else {
+      ++nrejected;
+    }
+  }
+  if (nrejected > 0) {
+    replace_file(path, accepted);
+    close(fd);
+    fd = open_log(path);
+  }
+  return nrejected;
+}
+
+/**
+ * @brief Log the ground facts, returning once they are on disk
+ * @throws std::runtime_error if the log cannot be written
+ */
+void
+WriteAheadLog::append(std::vector<Atom> &facts) {
+  std::string payload;
+  for (Atom &fact : facts) {
+    std::vector<Term> terms = fact.get_terms();
+    payload += fact.get_predicate();
+    for (size_t i = 0; i < terms.size(); ++i) {
+      if (terms[i].get_term_type() == TermType::VARIABLE) {
+        throw std::runtime_error("Facts must be ground");
+      }
+      payload += (i == 0 ? "(" : ", ") + terms[i].get_name();
+    }
+    payload += terms.empty() ? ".\n" : ").\n";
+  }
+  std::string record = make_record(payload);
+
+  std::unique_lock<std::mutex> lock(mutex);
+  pending += record;
+  uint64_t sequence = ++appended;
+  while (durable < sequence) {
+    if (sequence <= failed) {
+      throw std::runtime_error("Cannot write " + path);
+    }
+    if (syncing) {
+      synced.wait(lock);
+      continue;
+    }
+    // Lead the group: write every pending record with a single sync
+    syncing = true;
+    std::string group;
+    group.swap(pending);
+    uint64_t last = appended;
+    lock.unlock();
+    off_t end = lseek(fd, 0, SEEK_END);
+    bool ok = end >= 0;
+    try {
+      write_all(fd, group, path);
+      ok = ok && fdatasync(fd) == 0;
+    }
+    catch (std::runtime_error &) {
+      ok = false;
+    }
+    // The group fails as a whole: cut what was written of it, or the log
+    // takes no more records, as replay stops at the torn one
+    bool torn = !ok && (end < 0 || ftruncate(fd, end) < 0);
+    lock.lock();
+    syncing = false;
+    if (ok) {
+      durable = last;
+      ++nsyncs;
+    }
+    else {
+      failed = torn ? UINT64_MAX : last;
+    }
+    synced.notify_all();
+  }
+}
+
+/**
+ * @brief Move the logged facts to the snapshot and empty the log. The
+ * snapshot is replaced by a copy with the facts appended, see
+ * replace_file(), so that a crash leaves either version of it whole; a crash
+ * before the log is emptied only loads facts twice, which loading ignores.
+ * @returns The size in bytes of the facts moved to the snapshot
+ */
+size_t
+WriteAheadLog::compact(void) {
+  std::unique_lock<std::mutex> lock(mutex);
+  // Records still pending are written after the log is emptied
+  synced.wait(lock, [this]() { return !syncing; });
+  std::string source;
+  for (const std::string &record : read_records()) {
+    source += record;
+  }
+  if (source.empty()) {
+    return 0;
+  }
+  std::string snapshot_path = get_snapshot_path();
+  std::string snapshot;
+  int snapshot_fd = open(snapshot_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (snapshot_fd < 0 && errno != ENOENT) {
+    throw io_error("Cannot open", snapshot_path);
+  }
+  if (snapshot_fd >= 0) {
+    bool ok = read_all(snapshot_fd, snapshot);
+    close(snapshot_fd);
+    if (!ok) {
+      throw io_error("Cannot read", snapshot_path);
+    }
+  }
+  replace_file(snapshot_path, snapshot + source);
+  if (ftruncate(fd, 0) < 0 || fdatasync(fd) < 0) {
+    throw io_error("Cannot truncate", path);
+  }
+  return source.size();
+}
+
+/**
+ * @brief Path of the Datalog source the log is compacted into
+ */
+std::string
+WriteAheadLog::get_snapshot_path(void) const {
+  return path + ".snapshot.pl";
+}
+
+/**
+ * @brief Number of writes and syncs of the log so far, each of a group of
+ * appends
+ */
+size_t
+WriteAheadLog::get_syncs(void) {
+  std::lock_guard<std::mutex> lock(mutex);
+  return nsyncs;
+}
@@ -0,0 +1,56 @@
+#ifndef WAL_HH_INCLUDED
+#define WAL_HH_INCLUDED
+
+#include "parser.hh"
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Append-only log of the facts inserted since the last compaction.
+ * Each record holds the facts of one insertion, as Datalog source, after
+ * its 4-byte big-endian length and checksum; a torn record at the end of
+ * the log is dropped on replay. Appends wait until their record is synced
+ * to disk, and concurrent appends share a single write and fdatasync, led
+ * by the first to arrive.
+ * Compaction moves the logged facts to a snapshot file, next to the log
+ * and read like any other source file, which it replaces atomically by a
+ * copy with the facts appended, and then empties the log.
+ */
+class WriteAheadLog {
+private:
+  std::string path;
+  int fd;
+  std::mutex mutex;
+  std::condition_variable synced;
+  // Records appended but not yet written
+  std::string pending;
+  // Sequence numbers of the last record appended and synced
+  uint64_t appended;
+  uint64_t durable;
+  // Last record of the last group that could not be written
+  uint64_t failed;
+  // Set while a leader writes and syncs the pending records
+  bool syncing;
+  size_t nsyncs;
+
+  std::vector<std::string> read_records(void);
+
+public:
+  WriteAheadLog(const std::string &path);
+  ~WriteAheadLog(void);
+  WriteAheadLog(const WriteAheadLog &) = delete;
+  WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+  size_t replay(const std::function<bool(const std::string &)> &load);
+  void append(std::vector<Atom> &facts);
+  size_t compact(void);
+  std::string get_snapshot_path(void) const;
+  size_t get_syncs(void);
+};
+
+#endif
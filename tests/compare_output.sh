@@ -0,0 +1,11 @@
+#!/bin/sh
+# Usage: compare_output.sh DATALOGSH COMPILED KB QUERIES
+# Succeeds iff COMPILED, built from KB, prints exactly what DATALOGSH KB
+# prints for QUERIES
+set -e
+expected=$("$1" "$3" < "$4")
+actual=$("$2" < "$4")
+if [ "$expected" != "$actual" ]; then
+  echo "Outputs differ" >&2
+  exit 1
+fi
@@ -0,0 +1,12 @@
+edge(a, b).
+edge(b, c).
+edge(c, d).
+edge(d, b).
+edge(e, e).
+path(X, Y) :- edge(X, Y).
+path(X, Z) :- path(X, Y), edge(Y, Z).
+cycle(X) :- path(X, X).
+from_a(Y) :- path(a, Y).
+self(X) :- edge(X, X), path(X, _).
+twice(X, Y) :- path(X, Y), path(Y, X), edge(X, _).
+unsafe(X, Y) :- edge(X, _).
@@ -0,0 +1,346 @@
+/**
+ * @file ubench.cpp
+ *
+ * Microbenchmarks of the lexer, parser, unification, relation and join hot
+ * paths.
+ * The global allocation functions are interposed to count the heap
+ * allocations of each operation. With --check, the counts are compared to
+ * the budgets below and the run fails if any is exceeded.
+ */
+
+#include "btree.hh"
+#include "datalog.hh"
+#include "evaluator.hh"
+#include "intersect.hh"
+#include "relation.hh"
+#include "snapshot.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+static std::atomic<size_t> nallocs(0);
+
+void *
+operator new(size_t size) {
+  nallocs.fetch_add(1, std::memory_order_relaxed);
+  void *p = std::malloc(size == 0 ? 1 : size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void *
+operator new[](size_t size) {
+  return operator new(size);
+}
+
+void *
+operator new(size_t size, const std::nothrow_t &) noexcept {
+  nallocs.fetch_add(1, std::memory_order_relaxed);
+  return std::malloc(size == 0 ? 1 : size);
+}
+
+void *
+operator new[](size_t size, const std::nothrow_t &tag) noexcept {
+  return operator new(size, tag);
+}
+
+void
+operator delete(void *p) noexcept {
+  std::free(p);
+}
+
+void
+operator delete[](void *p) noexcept {
+  std::free(p);
+}
+
+void
+operator delete(void *p, size_t) noexcept {
+  std::free(p);
+}
+
+void
+operator delete[](void *p, size_t) noexcept {
+  std::free(p);
+}
+
+/**
+ * @brief Allocation budgets, in heap allocations per operation
+ */
+struct Budget {
+  const char *name;
+  double max_allocs;
+};
+
+const Budget BUDGETS[] = {
+  {"lexer", 0.05},          // per token
+  {"parser", 8.0},          // per clause
+  {"parser_flat", 0.02},    // per clause, the tables only
+  {"unify_term", 0.0},      // per call
+  {"unify_atom", 2.0},      // per call, including the trace on stderr
+  {"relation_probe", 0.0},  // per probe
+  {"relation_insert", 0.01}, // per new tuple, amortised growth only
+  {"btree_insert_hint", 0.1}, // per key, node splits only
+  {"btree_lower_bound", 0.0}, // per lookup
+  // per query of a key, one at a time and in batches sharing the compiled
+  // query and its buffers
+  {"query_each", 40.0},
+  {"query_batch", 20.0},
+  {"snapshot_insert", 40.0}, // per version, whatever the size of the others
+  // per symbol of the longer array, for size ratios 1, 8 and 64
+  {"intersect_scalar_1", 0.0},
+  {"intersect_sorted_1", 0.0},
+  {"intersect_scalar_8", 0.0},
+  {"intersect_sorted_8", 0.0},
+  {"intersect_scalar_64", 0.0},
+  {"intersect_sorted_64", 0.0}
+};
+
+class NullBuffer : public std::streambuf {
+protected:
+  int
+  overflow(int c) override {
+    return c;
+  }
+};
+
+struct Result {
+  std::string name;
+  size_t ops;
+  double ns_per_op;
+  double allocs_per_op;
+};
+
+/**
+ * @brief Time runs calls of f, each performing ops_per_run operations
+ */
+template <class F>
+Result
+measure(const std::string &name, size_t ops_per_run, size_t runs, F f) {
+  f(); // warm up caches and lazily built structures
+  size_t allocs_before = nallocs.load();
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < runs; ++i) {
+    f();
+  }
+  std::chrono::duration<double, std::nano> ns
+    = std::chrono::steady_clock::now() - start;
+  size_t ops = ops_per_run * runs;
+  double allocs = static_cast<double>(nallocs.load() - allocs_before);
+  return Result{name, ops, ns.count() / ops, allocs / ops};
+}
+
+/**
+ * @brief n distinct symbols drawn uniformly from [0, range), in order
+ */
+std::vector<SymbolId>
+make_sorted(size_t n, size_t range, std::mt19937 &rng) {
+  std::vector<bool> taken(range, false);
+  size_t ntaken = 0;
+  while (ntaken < n) {
+    size_t v = rng() % range;
+    ntaken += taken[v] ? 0 : 1;
+    taken[v] = true;
+  }
+  std::vector<SymbolId> sorted;
+  for (size_t v = 0; v < range; ++v) {
+    if (taken[v]) {
+      sorted.push_back(static_cast<SymbolId>(v));
+    }
+  }
+  return sorted;
+}
+
+std::string
+make_kb(size_t nfacts) {
+  std::string kb;
+  for (size_t i = 0; i < nfacts; ++i) {
+    kb += "edge(n" + std::to_string(i) + ", n" + std::to_string(i + 1)
+          + ").\n";
+  }
+  return kb + "path(X, Y) :- edge(X, Z), path(Z, Y).\n";
+}
+
+int
+main(int argc, char **argv) {
+  bool check = argc > 1 && std::string(argv[1]) == "--check";
+  // The lexer, parser and unification trace their progress
+  NullBuffer null_buffer;
+  std::streambuf *out = std::cout.rdbuf(&null_buffer);
+  std::streambuf *err = std::cerr.rdbuf(&null_buffer);
+
+  std::vector<Result> results;
+  std::string kb = make_kb(1000);
+  Lexer lexer;
+  std::vector<Token> tokens = lexer.run(kb);
+  results.push_back(measure("lexer", tokens.size(), 20, [&]() {
+    std::vector<Token> run_tokens = lexer.run(kb);
+  }));
+
+  Parser parser(tokens);
+  size_t nclauses = parser.parse(tokens).get_rules().size();
+  results.push_back(measure("parser", nclauses, 20, [&]() {
+    Program prog = parser.parse(tokens);
+  }));
+  results.push_back(measure("parser_flat", nclauses, 20, [&]() {
+    FlatProgram prog = parser.parse_flat(tokens);
+  }));
+
+  EvaluatedTerm var("X", TermType::VARIABLE);
+  EvaluatedTerm cnst("a", TermType::CONSTANT);
+  results.push_back(measure("unify_term", 1, 100000, [&]() {
+    unify_term(var, cnst);
+    var.reset_binding();
+  }));
+
+  std::vector<EvaluatedTerm> goal_terms{EvaluatedTerm("X", TermType::VARIABLE),
+                                        EvaluatedTerm("Y", TermType::VARIABLE)};
+  std::vector<EvaluatedTerm> query_terms{
+    EvaluatedTerm("a", TermType::CONSTANT),
+    EvaluatedTerm("b", TermType::CONSTANT)};
+  std::string pred("edge");
+  EvaluatedAtom goal(pred, goal_terms);
+  EvaluatedAtom query(pred, query_terms);
+  results.push_back(measure("unify_atom", 1, 10000, [&]() {
+    unify_atom(goal, query);
+    goal.reset();
+  }));
+
+  Relation rel(2);
+  for (SymbolId i = 0; i < 10000; ++i) {
+    SymbolId row[2] = {i % 1000, i};
+    rel.insert(row);
+  }
+  SymbolId key = 0;
+  results.push_back(measure("relation_probe", 1000, 100, [&]() {
+    for (SymbolId i = 0; i < 1000; ++i) {
+      key = i;
+      rel.probe(1, &key);
+    }
+  }));
+
+  results.push_back(measure("relation_insert", 10000, 10, [&]() {
+    Relation fresh(2);
+    for (SymbolId i = 0; i < 10000; ++i) {
+      SymbolId row[2] = {i % 1000, i};
+      fresh.insert(row);
+    }
+  }));
+
+  results.push_back(measure("btree_insert_hint", 10000, 10, [&]() {
+    BTreeIndex tree(2);
+    for (SymbolId i = 0; i < 10000; ++i) {
+      SymbolId key[2] = {i / 10, i % 10};
+      tree.insert_hint(key);
+    }
+  }));
+
+  BTreeIndex tree(2);
+  for (SymbolId i = 0; i < 100000; ++i) {
+    SymbolId k[2] = {i % 1000, i};
+    tree.insert(k);
+  }
+  results.push_back(measure("btree_lower_bound", 1000, 100, [&]() {
+    for (SymbolId i = 0; i < 1000; ++i) {
+      key = i;
+      tree.lower_bound(&key, 1);
+    }
+  }));
+
+  // 1000 point queries of 10 answers each
+  Database db;
+  Relation &edges = db.get_relation("edge", 2);
+  std::vector<Atom> queries;
+  for (size_t i = 0; i < 10000; ++i) {
+    SymbolId from = db.get_symbols().intern("v" + std::to_string(i % 1000));
+    SymbolId to = db.get_symbols().intern("w" + std::to_string(i));
+    SymbolId row[2] = {from, to};
+    edges.insert(row);
+  }
+  for (size_t i = 0; i < 1000; ++i) {
+    std::string name = "v" + std::to_string(i);
+    std::string var = "Y";
+    std::vector<Term> terms{Term(name, TermType::CONSTANT),
+                            Term(var, TermType::VARIABLE)};
+    queries.push_back(Atom(pred, terms));
+  }
+  Program empty;
+  Evaluator evaluator(db, empty);
+  results.push_back(measure("query_each", queries.size(), 10, [&]() {
+    for (Atom &atom : queries) {
+      evaluator.query(atom);
+    }
+  }));
+  results.push_back(measure("query_batch", queries.size(), 10, [&]() {
+    evaluator.query(queries);
+  }));
+
+  // Inserts into a small relation next to a large one, which versions share
+  Database versioned;
+  Relation &shared = versioned.get_relation("edge", 2);
+  for (size_t i = 0; i < 10000; ++i) {
+    Tuple row{versioned.get_symbols().intern("v" + std::to_string(i)),
+              versioned.get_symbols().intern("w" + std::to_string(i))};
+    shared.insert(row);
+  }
+  VersionedDatabase versions(std::move(versioned), empty);
+  std::string tag("tag");
+  size_t ntags = 0;
+  results.push_back(measure("snapshot_insert", 100, 10, [&]() {
+    for (size_t i = 0; i < 100; ++i) {
+      std::string name = "t" + std::to_string(ntags++);
+      std::vector<Term> terms{Term(name, TermType::CONSTANT)};
+      std::vector<Atom> facts{Atom(tag, terms)};
+      versions.insert(facts);
+    }
+  }));
+
+  // Sorted intersection, the scalar merge against the dispatching kernel,
+  // with half of the shorter array in the longer one
+  std::mt19937 rng(1);
+  for (size_t ratio : {1, 8, 64}) {
+    std::vector<SymbolId> large = make_sorted(64000, 128000, rng);
+    std::vector<SymbolId> small = make_sorted(64000 / ratio, 128000, rng);
+    std::vector<SymbolId> both(small.size());
+    std::string suffix = "_" + std::to_string(ratio);
+    results.push_back(measure("intersect_scalar" + suffix, large.size(), 20,
+                              [&]() {
+      intersect_sorted_scalar(small.data(), small.size(), large.data(),
+                              large.size(), both.data());
+    }));
+    results.push_back(measure("intersect_sorted" + suffix, large.size(), 20,
+                              [&]() {
+      intersect_sorted(small.data(), small.size(), large.data(),
+                       large.size(), both.data());
+    }));
+  }
+
+  std::cout.rdbuf(out);
+  std::cerr.rdbuf(err);
+  bool within_budget = true;
+  for (Result &result : results) {
+    double budget = 0;
+    for (const Budget &b : BUDGETS) {
+      if (result.name == b.name) {
+        budget = b.max_allocs;
+      }
+    }
+    bool ok = result.allocs_per_op <= budget;
+    within_budget = within_budget && ok;
+    std::cout << "{\"op\": \"" << result.name << "\", \"ops\": " << result.ops
+              << ", \"ns_per_op\": " << result.ns_per_op
+              << ", \"allocs_per_op\": " << result.allocs_per_op
+              << ", \"alloc_budget\": " << budget
+              << ", \"within_budget\": " << (ok ? "true" : "false") << "}\n";
+  }
+  return check && !within_budget ? 1 : 0;
+}